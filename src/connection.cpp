@@ -1,6 +1,9 @@
 
 /// @file connection.cpp
 
+#include <algorithm>
+#include <cstring>
+
 #include "connection.h"
 #include "util.h"
 
@@ -12,6 +15,230 @@ namespace pv3 {
 //============================================================================
 
 
+//////////////////////////////////////////////////////////////////////////////
+std::pmr::memory_resource *bufferResource()
+{
+  static std::pmr::synchronized_pool_resource pool;
+  return &pool;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+SessionCache &SessionCache::instance()
+{
+  static SessionCache cache;
+  return cache;
+}
+
+
+//----------------------------------------------------------------------------
+SessionCache::SessionCache()
+  : m_index(SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr)),
+    m_ctx_index(SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr,
+                                         nullptr))
+{}
+
+
+//----------------------------------------------------------------------------
+std::string SessionCache::key(const asio::ip::tcp::endpoint &ep,
+                              const std::string &sni, SSLMode sslmode,
+                              SSL_CTX *ctx)
+{
+  auto serial = reinterpret_cast<std::uintptr_t>(
+                  SSL_CTX_get_ex_data(ctx, instance().m_ctx_index));
+  return ep.address().to_string() + ":" + std::to_string(ep.port())
+         + "/" + sni + "/" + std::to_string(static_cast<int>(sslmode))
+         + "/" + std::to_string(serial);
+}
+
+
+//----------------------------------------------------------------------------
+/// OpenSSL keeps no client sessions of its own, they are all handed to
+/// newSession().
+void SessionCache::attach(SSL_CTX *ctx)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (SSL_CTX_sess_get_new_cb(ctx) == &SessionCache::newSession) { return; }
+  SSL_CTX_set_ex_data(ctx, m_ctx_index, reinterpret_cast<void*>(++m_serial));
+  SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT
+                                      | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+  SSL_CTX_sess_set_new_cb(ctx, &SessionCache::newSession);
+}
+
+
+//----------------------------------------------------------------------------
+void SessionCache::offer(SSL *ssl, const std::string *key)
+{
+  SSL_set_ex_data(ssl, m_index, const_cast<std::string*>(key));
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_session.find(*key);
+  if (it != m_session.end() && SSL_SESSION_is_resumable(it->second.get())) {
+    SSL_set_session(ssl, it->second.get());
+  }
+}
+
+
+//----------------------------------------------------------------------------
+void SessionCache::erase(const std::string &key)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_session.erase(key);
+}
+
+
+//----------------------------------------------------------------------------
+std::size_t SessionCache::size() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_session.size();
+}
+
+
+//----------------------------------------------------------------------------
+/// Returns 1 to keep the reference to session, 0 to leave it to OpenSSL.
+int SessionCache::newSession(SSL *ssl, SSL_SESSION *session)
+{
+  auto &cache = instance();
+  auto key = static_cast<const std::string*>(SSL_get_ex_data(ssl,
+                                                             cache.m_index));
+  if (!key) { return 0; }
+
+  std::lock_guard<std::mutex> lock(cache.m_mutex);
+  if (cache.m_session.size() >= MAX_SESSIONS
+      && cache.m_session.find(*key) == cache.m_session.end())
+  {
+    cache.m_session.erase(cache.m_session.begin());
+  }
+  cache.m_session.insert_or_assign(*key, Session(session, SSL_SESSION_free));
+  return 1;
+}
+
+
+
+//////////////////////////////////////////////////////////////////////////////
+asio::execution_context::id RecvPool::id;
+
+RecvPool::RecvPool(asio::execution_context &ctx)
+  : asio::execution_context::service(ctx)
+{}
+
+
+//----------------------------------------------------------------------------
+/// The slab is allocated and registered on first use. If the registration
+/// fails, e.g. because the application registered buffers of its own, the
+/// pool stays empty and every RecvBuffer owns its storage.
+std::optional<asio::mutable_registered_buffer> RecvPool::acquire()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  if (!m_slab) {
+    m_slab = std::make_unique<char[]>(SLOTS * RecvBuffer::CAPACITY);
+
+    std::vector<asio::mutable_buffer> slots;
+    for (std::size_t i = 0; i < SLOTS; ++i) {
+      slots.emplace_back(asio::buffer(m_slab.get() + i * RecvBuffer::CAPACITY,
+                                      RecvBuffer::CAPACITY));
+    }
+    try {
+      m_registration.emplace(context(), std::move(slots));
+      m_free.assign(m_registration->begin(), m_registration->end());
+    }
+    catch (const std::system_error &) {}
+  }
+
+  if (m_free.empty()) { return std::nullopt; }
+  auto slot = m_free.back();
+  m_free.pop_back();
+  return slot;
+}
+
+
+//----------------------------------------------------------------------------
+void RecvPool::release(const asio::mutable_registered_buffer &slot)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_free.push_back(slot);
+}
+
+
+//----------------------------------------------------------------------------
+void RecvPool::shutdown()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_free.clear();
+  m_registration.reset();
+}
+
+
+
+//////////////////////////////////////////////////////////////////////////////
+RecvBuffer::RecvBuffer()
+  : m_own(std::make_unique<char[]>(CAPACITY)), m_data(m_own.get())
+{}
+
+
+//----------------------------------------------------------------------------
+RecvBuffer::RecvBuffer(asio::execution_context &ctx)
+{
+  auto &pool = asio::use_service<RecvPool>(ctx);
+  auto slot = pool.acquire();
+  if (slot) {
+    m_pool = &pool;
+    m_slot = *slot;
+    m_data = static_cast<char*>(m_slot.data());
+  }
+  else {
+    m_own = std::make_unique<char[]>(CAPACITY);
+    m_data = m_own.get();
+  }
+}
+
+
+//----------------------------------------------------------------------------
+RecvBuffer::~RecvBuffer()
+{
+  if (m_pool) { m_pool->release(m_slot); }
+}
+
+
+//----------------------------------------------------------------------------
+std::size_t RecvBuffer::take(std::size_t len, Buffer &out)
+{
+  auto n = std::min(len, size());
+  out.insert(out.end(), m_data + m_begin, m_data + m_begin + n);
+  m_begin += n;
+  if (m_begin == m_end) { m_begin = m_end = 0; }
+  return n;
+}
+
+
+//----------------------------------------------------------------------------
+void RecvBuffer::compact()
+{
+  if (m_begin == 0) { return; }
+  std::memmove(m_data, m_data + m_begin, size());
+  m_end -= m_begin;
+  m_begin = 0;
+}
+
+
+//----------------------------------------------------------------------------
+asio::mutable_buffer RecvBuffer::space()
+{
+  compact();
+  return asio::buffer(m_data + m_end, CAPACITY - m_end);
+}
+
+
+//----------------------------------------------------------------------------
+asio::mutable_registered_buffer RecvBuffer::registeredSpace()
+{
+  compact();
+  return m_slot + m_end;
+}
+
+
 //////////////////////////////////////////////////////////////////////////////
 void ConnectionBase::handshake(EHandler &&ehandler)
 {
@@ -19,10 +246,18 @@ void ConnectionBase::handshake(EHandler &&ehandler)
 }
 
 
+//----------------------------------------------------------------------------
+void ConnectionBase::cancel(int pid, int key, EHandler &&ehandler)
+{
+  ehandler(std::error_code(ENOSYS, std::system_category()));
+}
+
+
 
 //////////////////////////////////////////////////////////////////////////////
-Connection::Connection(asio::io_service &ios, const EndpointType &ep)
-  : m_socket(ios), m_remote_ep(ep)
+Connection::Connection(asio::io_service &ios, const EndpointType &ep,
+                       const util::SocketOption &so)
+  : m_socket(ios), m_remote_ep(ep), m_option(so), m_buf(bufferResource())
 {}
 
 
@@ -31,6 +266,7 @@ void Connection::connect(EHandler &&ehandler)
 {
   std::error_code ec;
   m_socket.connect(m_remote_ep, ec);
+  if (!ec) { ec = setSocketOption(m_socket, m_option); }
   ehandler(ec);
 }
 
@@ -39,10 +275,9 @@ void Connection::connect(EHandler &&ehandler)
 void Connection::read(std::size_t len, RHandler &&whandler)
 {
   std::error_code ec;
-  Buffer buf(len);
-  auto bytes = asio::read(m_socket, asio::buffer(buf), ec);
-  //DBG(buf);
-  whandler(ec, bytes, buf);
+  auto bytes = syncRead(m_socket, m_recv, len, m_buf, ec);
+  //DBG(m_buf);
+  whandler(ec, bytes, m_buf);
 }
 
 
@@ -64,15 +299,96 @@ void Connection::close(EHandler &&ehandler)
 }
 
 
+//----------------------------------------------------------------------------
+void Connection::cancel(int pid, int key, EHandler &&ehandler)
+{
+  Socket socket(m_socket.get_executor());
+  ehandler(syncCancel(socket, m_remote_ep, pid, key));
+}
+
+
+
+
+//////////////////////////////////////////////////////////////////////////////
+namespace {
+
+const unsigned char ALPN[] = "\x0apostgresql";
+
+std::error_code sslError()
+{
+  return std::error_code(static_cast<int>(ERR_get_error()),
+                         asio::error::get_ssl_category());
+}
+
+
+/// Set the SNI host name of ssl, unless sni is empty or an address, ALPN
+/// for direct negotiation, and offer the cached session of the server for
+/// sslmode and the context of ssl.
+std::error_code prepareSession(SSL *ssl, const asio::ip::tcp::endpoint &ep,
+                               const std::string &sni, SSLMode sslmode,
+                               SSLNegotiation negotiation, std::string &key)
+{
+  if (negotiation == SSLNegotiation::direct) {
+    if (SSL_set_alpn_protos(ssl, ALPN, sizeof(ALPN) - 1) != 0) {
+      return sslError();
+    }
+  }
+
+  std::error_code ec;
+  asio::ip::make_address(sni, ec);
+  if (!sni.empty() && ec) {
+    if (!SSL_set_tlsext_host_name(ssl, sni.c_str())) { return sslError(); }
+  }
+
+  key = SessionCache::key(ep, sni, sslmode, SSL_get_SSL_CTX(ssl));
+  SessionCache::instance().offer(ssl, &key);
+  return {};
+}
+
+
+/// With direct negotiation the server must have selected ALPN
+/// "postgresql", as libpq requires.
+std::error_code checkALPN(SSL *ssl, SSLNegotiation negotiation)
+{
+  if (negotiation != SSLNegotiation::direct) { return {}; }
+
+  const unsigned char *alpn = nullptr;
+  unsigned int len = 0;
+  SSL_get0_alpn_selected(ssl, &alpn, &len);
+  if (len != sizeof(ALPN) - 2 || std::memcmp(alpn, ALPN + 1, len) != 0) {
+    return std::error_code(EPROTO, std::generic_category());
+  }
+  return {};
+}
+
+
+/// Mark the session as closed cleanly, without sending close_notify.
+/// OpenSSL makes the session of a connection freed without a shutdown
+/// unresumable.
+void quietShutdown(SSL *ssl)
+{
+  if (SSL_is_init_finished(ssl)) {
+    SSL_set_quiet_shutdown(ssl, 1);
+    SSL_shutdown(ssl);
+  }
+}
+
+} // namespace
 
 
 //////////////////////////////////////////////////////////////////////////////
 SSLConnection::SSLConnection(asio::io_service &ios,
                              SSLMode sslmode,
                              asio::ssl::context &context,
-                             const EndpointType &ep)
-  : m_socket(ios, context), m_remote_ep(ep)
+                             const Endpoints &ep,
+                             const util::SocketOption &so,
+                             const std::string &sni,
+                             SSLNegotiation negotiation)
+  : m_socket(ios, context), m_sslmode(sslmode), m_endpoint(ep),
+    m_option(so), m_sni(sni), m_negotiation(negotiation),
+    m_buf(bufferResource())
 {
+  SessionCache::instance().attach(context.native_handle());
   m_socket.set_verify_mode(asio::ssl::verify_peer);
   m_socket.set_verify_callback([sslmode](bool preverified,
                                asio::ssl::verify_context& ctx)->bool
@@ -86,34 +402,44 @@ SSLConnection::SSLConnection(asio::io_service &ios,
 void SSLConnection::connect(EHandler &&ehandler)
 {
   std::error_code ec;
-  m_socket.lowest_layer().connect(m_remote_ep, ec);
+  m_remote_ep = asio::connect(m_socket.lowest_layer(), m_endpoint, ec);
+  if (!ec) { ec = setSocketOption(m_socket.lowest_layer(), m_option); }
   ehandler(ec);
 }
 
 
 //----------------------------------------------------------------------------
+/// Direct negotiation skips the SSLRequest and its reply.
 void SSLConnection::handshake(EHandler &&ehandler)
 {
   std::error_code ec;
-  pv3::SSLRequest msg;
-
-  auto bytes = syncWrite(m_socket.next_layer(), msg, ec);
-  if (ec) { ehandler(ec); return; }
 
-  Buffer buf(1);
-  bytes = asio::read(m_socket.next_layer(), asio::buffer(buf), ec);
-  if (ec) { ehandler(ec); return; }
-  if (bytes != 1) {
-    ehandler(std::error_code(EMSGSIZE, std::generic_category()));
-    return;
-  }
-
-  if (buf[0] != 'S') {
-    ehandler(std::error_code(EMSGSIZE, std::generic_category()));
-    return;
+  if (m_negotiation == SSLNegotiation::postgres)
+  {
+    pv3::SSLRequest msg;
+    auto bytes = syncWrite(m_socket.next_layer(), msg, ec);
+    if (ec) { ehandler(ec); return; }
+
+    Buffer buf(1);
+    bytes = asio::read(m_socket.next_layer(), asio::buffer(buf), ec);
+    if (ec) { ehandler(ec); return; }
+    if (bytes != 1) {
+      ehandler(std::error_code(EMSGSIZE, std::generic_category()));
+      return;
+    }
+
+    if (buf[0] != 'S') {
+      ehandler(std::error_code(EMSGSIZE, std::generic_category()));
+      return;
+    }
   }
 
-  m_socket.handshake(asio::ssl::stream_base::client, ec);
+  auto ssl = m_socket.native_handle();
+  ec = prepareSession(ssl, m_remote_ep, m_sni, m_sslmode, m_negotiation,
+                      m_session_key);
+  if (!ec) { m_socket.handshake(asio::ssl::stream_base::client, ec); }
+  if (!ec) { ec = checkALPN(ssl, m_negotiation); }
+  if (ec) { SessionCache::instance().erase(m_session_key); }
   ehandler(ec);
 
 }
@@ -123,10 +449,9 @@ void SSLConnection::handshake(EHandler &&ehandler)
 void SSLConnection::read(std::size_t len, RHandler &&rhandler)
 {
   std::error_code ec;
-  Buffer buf(len);
-  auto bytes = asio::read(m_socket, asio::buffer(buf), ec);
-  //DBG(buf);
-  rhandler(ec, bytes, buf);
+  auto bytes = syncRead(m_socket, m_recv, len, m_buf, ec);
+  //DBG(m_buf);
+  rhandler(ec, bytes, m_buf);
 }
 
 
@@ -144,41 +469,110 @@ void SSLConnection::write(const Message &msg, WHandler &&whandler)
 void SSLConnection::close(EHandler &&ehandler)
 {
   std::error_code ec;
+  quietShutdown(m_socket.native_handle());
   m_socket.lowest_layer().close(ec);
   ehandler(ec);
 }
 
 
+//----------------------------------------------------------------------------
+bool SSLConnection::resumed() const
+{
+  return SSL_session_reused(const_cast<Socket&>(m_socket).native_handle());
+}
+
+
+//----------------------------------------------------------------------------
+/// The CancelRequest is sent unencrypted, as libpq does.
+void SSLConnection::cancel(int pid, int key, EHandler &&ehandler)
+{
+  asio::ip::tcp::socket socket(m_socket.get_executor());
+  ehandler(syncCancel(socket, m_remote_ep, pid, key));
+}
+
+
 
 
 //////////////////////////////////////////////////////////////////////////////
-AsyncConnection::AsyncConnection(asio::io_service &ios, const EndpointType &ep)
-  : m_socket(ios), m_remote_ep(ep)
+TCPConnection::TCPConnection(asio::io_service &ios, const Endpoints &ep,
+                             const util::SocketOption &so)
+  : m_socket(ios), m_endpoint(ep), m_option(so), m_buf(bufferResource())
 {}
 
 
 //----------------------------------------------------------------------------
-void AsyncConnection::connect(EHandler &&handler)
+void TCPConnection::connect(EHandler &&ehandler)
 {
-  m_socket.async_connect(m_remote_ep, handler);
+  std::error_code ec;
+  m_remote_ep = asio::connect(m_socket, m_endpoint, ec);
+  if (!ec) { ec = setSocketOption(m_socket, m_option); }
+  ehandler(ec);
 }
 
 
 //----------------------------------------------------------------------------
-void AsyncConnection::read(std::size_t len, RHandler &&rh)
+void TCPConnection::read(std::size_t len, RHandler &&rhandler)
 {
   std::error_code ec;
-  //auto self(shared_from_this());
-  auto buf = std::make_shared<Buffer>(len);
-  asio::async_read(m_socket, asio::buffer(*buf),
-  [buf, rhandler = std::move(rh)] (std::error_code ec, std::size_t bytes)
+  auto bytes = syncRead(m_socket, m_recv, len, m_buf, ec);
+  rhandler(ec, bytes, m_buf);
+}
+
+
+//----------------------------------------------------------------------------
+void TCPConnection::write(const Message &msg, WHandler &&whandler)
+{
+  std::error_code ec;
+  auto bytes = syncWrite(m_socket, msg, ec);
+  whandler(ec, bytes);
+}
+
+
+//----------------------------------------------------------------------------
+void TCPConnection::close(EHandler &&ehandler)
+{
+  std::error_code ec;
+  m_socket.close(ec);
+  ehandler(ec);
+}
+
+
+//----------------------------------------------------------------------------
+void TCPConnection::cancel(int pid, int key, EHandler &&ehandler)
+{
+  Socket socket(m_socket.get_executor());
+  ehandler(syncCancel(socket, m_remote_ep, pid, key));
+}
+
+
+
+
+//////////////////////////////////////////////////////////////////////////////
+AsyncConnection::AsyncConnection(asio::io_service &ios,
+                                 const EndpointType &ep,
+                                 const util::SocketOption &so)
+  : m_socket(ios), m_remote_ep(ep), m_option(so), m_recv(ios)
+{}
+
+
+//----------------------------------------------------------------------------
+void AsyncConnection::connect(EHandler &&eh)
+{
+  m_socket.async_connect(m_remote_ep, [this, ehandler = std::move(eh)]
+  (const std::error_code &ec)
   {
-    //DBG(*buf);
-    rhandler(ec, bytes, *buf);
+    ehandler(ec ? ec : setSocketOption(m_socket, m_option));
   });
 }
 
 
+//----------------------------------------------------------------------------
+void AsyncConnection::read(std::size_t len, RHandler &&rh)
+{
+  asyncRead(m_socket, m_recv, len, shared_from_this(), std::move(rh));
+}
+
+
 //----------------------------------------------------------------------------
 void AsyncConnection::write(const Message &msg, WHandler &&wh)
 {
@@ -194,13 +588,77 @@ void AsyncConnection::close(EHandler &&ehandler)
 }
 
 
+//----------------------------------------------------------------------------
+void AsyncConnection::cancel(int pid, int key, EHandler &&ehandler)
+{
+  auto socket = std::make_shared<Socket>(m_socket.get_executor());
+  asyncCancel(socket, m_remote_ep, pid, key, std::move(ehandler));
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+TCPAsyncConnection::TCPAsyncConnection(asio::io_service &ios,
+                                       const Endpoints &ep,
+                                       const util::SocketOption &so)
+  : m_socket(ios), m_endpoint(ep), m_option(so), m_recv(ios)
+{}
+
+
+//----------------------------------------------------------------------------
+void TCPAsyncConnection::connect(EHandler &&eh)
+{
+  asio::async_connect(m_socket, m_endpoint, [this, ehandler = std::move(eh)]
+  (const std::error_code &ec, const EndpointType &ep)
+  {
+    m_remote_ep = ep;
+    ehandler(ec ? ec : setSocketOption(m_socket, m_option));
+  });
+}
+
+
+//----------------------------------------------------------------------------
+void TCPAsyncConnection::read(std::size_t len, RHandler &&rh)
+{
+  asyncRead(m_socket, m_recv, len, shared_from_this(), std::move(rh));
+}
+
+
+//----------------------------------------------------------------------------
+void TCPAsyncConnection::write(const Message &msg, WHandler &&wh)
+{
+  asyncWrite(m_socket, msg, std::move(wh));
+}
+
+
+//----------------------------------------------------------------------------
+void TCPAsyncConnection::close(EHandler &&ehandler)
+{
+  std::error_code ec;
+  m_socket.close(ec);
+  ehandler(ec);
+}
+
+
+//----------------------------------------------------------------------------
+void TCPAsyncConnection::cancel(int pid, int key, EHandler &&ehandler)
+{
+  auto socket = std::make_shared<Socket>(m_socket.get_executor());
+  asyncCancel(socket, m_remote_ep, pid, key, std::move(ehandler));
+}
+
+
 //////////////////////////////////////////////////////////////////////////////
 SSLAsyncConnection::SSLAsyncConnection(asio::io_service &ios,
                                        SSLMode sslmode,
                                        asio::ssl::context &context,
-                                       const EndpointType &ep)
-  : m_socket(ios, context), m_remote_ep(ep)
+                                       const Endpoints &ep,
+                                       const util::SocketOption &so,
+                                       const std::string &sni,
+                                       SSLNegotiation negotiation)
+  : m_socket(ios, context), m_sslmode(sslmode), m_endpoint(ep),
+    m_option(so), m_sni(sni), m_negotiation(negotiation), m_recv(ios)
 {
+  SessionCache::instance().attach(context.native_handle());
   m_socket.set_verify_mode(asio::ssl::verify_peer);
   m_socket.set_verify_callback([sslmode](bool preverified,
                                asio::ssl::verify_context& ctx)->bool
@@ -210,39 +668,46 @@ SSLAsyncConnection::SSLAsyncConnection(asio::io_service &ios,
 }
 
 //----------------------------------------------------------------------------
-void SSLAsyncConnection::connect(EHandler &&ehandler)
+void SSLAsyncConnection::connect(EHandler &&eh)
 {
-  m_socket.lowest_layer().async_connect(m_remote_ep, ehandler);
+  asio::async_connect(m_socket.lowest_layer(), m_endpoint,
+  [this, ehandler = std::move(eh)]
+  (const std::error_code &ec, const EndpointType &ep)
+  {
+    m_remote_ep = ep;
+    ehandler(ec ? ec : setSocketOption(m_socket.lowest_layer(), m_option));
+  });
 }
 
 
 //----------------------------------------------------------------------------
 void SSLAsyncConnection::read(std::size_t len, RHandler &&rh)
 {
-  auto buf = std::make_shared<Buffer>(len);
-  asio::async_read(m_socket, asio::buffer(*buf),
-  [buf, rhandler = std::move(rh)] (std::error_code ec, std::size_t bytes)
-  {
-    //DBG(*buf);
-    rhandler(ec, bytes, *buf);
-  });
+  asyncRead(m_socket, m_recv, len, shared_from_this(), std::move(rh));
 }
 
 
 
 //----------------------------------------------------------------------------
+/// Direct negotiation skips the SSLRequest and its reply.
 void SSLAsyncConnection::handshake(EHandler &&eh)
 {
+  if (m_negotiation == SSLNegotiation::direct) {
+    startTLS(std::move(eh));
+    return;
+  }
+
   pv3::SSLRequest msg;
 
   asyncWrite(m_socket.next_layer(), msg, [this, ehandler = std::move(eh)]
-  (const std::error_code &ec, std::size_t bytes)
+  (const std::error_code &ec, std::size_t bytes) mutable
   {
       if (ec) { ehandler(ec); return; }
 
       auto buf = std::make_shared<Buffer>(1);
       asio::async_read(m_socket.next_layer(), asio::buffer(*buf),
-      [this, buf, ehandler] (std::error_code ec, std::size_t bytes)
+      [this, buf, ehandler = std::move(ehandler)]
+      (std::error_code ec, std::size_t bytes) mutable
       {
         if (ec) { ehandler(ec); return; }
         if (bytes != 1) {
@@ -254,12 +719,30 @@ void SSLAsyncConnection::handshake(EHandler &&eh)
           ehandler(std::error_code(EMSGSIZE, std::generic_category()));
            return;
         }
-        m_socket.async_handshake(asio::ssl::stream_base::client, ehandler);
+        startTLS(std::move(ehandler));
       });
   });
 }
 
 
+//----------------------------------------------------------------------------
+void SSLAsyncConnection::startTLS(EHandler &&eh)
+{
+  auto ssl = m_socket.native_handle();
+  auto ec = prepareSession(ssl, m_remote_ep, m_sni, m_sslmode,
+                           m_negotiation, m_session_key);
+  if (ec) { eh(ec); return; }
+
+  m_socket.async_handshake(asio::ssl::stream_base::client,
+  [this, ssl, ehandler = std::move(eh)] (std::error_code ec)
+  {
+    if (!ec) { ec = checkALPN(ssl, m_negotiation); }
+    if (ec) { SessionCache::instance().erase(m_session_key); }
+    ehandler(ec);
+  });
+}
+
+
 
 
 //----------------------------------------------------------------------------
@@ -272,11 +755,314 @@ void SSLAsyncConnection::write(const Message &msg, WHandler &&wh)
 void SSLAsyncConnection::close(EHandler &&ehandler)
 {
   std::error_code ec;
+  quietShutdown(m_socket.native_handle());
   m_socket.lowest_layer().close(ec);
   ehandler(ec);
 }
 
 
+//----------------------------------------------------------------------------
+bool SSLAsyncConnection::resumed() const
+{
+  return SSL_session_reused(const_cast<Socket&>(m_socket).native_handle());
+}
+
+
+//----------------------------------------------------------------------------
+void SSLAsyncConnection::cancel(int pid, int key, EHandler &&ehandler)
+{
+  using Tcp = asio::ip::tcp::socket;
+  auto socket = std::make_shared<Tcp>(m_socket.get_executor());
+  asyncCancel(socket, m_remote_ep, pid, key, std::move(ehandler));
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+KTLSAsyncConnection::KTLSAsyncConnection(asio::io_service &ios,
+                                         SSLMode sslmode,
+                                         asio::ssl::context &context,
+                                         const Endpoints &ep,
+                                         const util::SocketOption &so,
+                                         const std::string &sni,
+                                         SSLNegotiation negotiation)
+  : m_socket(ios), m_ssl(SSL_new(context.native_handle()), SSL_free),
+    m_sslmode(sslmode), m_endpoint(ep), m_option(so), m_sni(sni),
+    m_negotiation(negotiation), m_recv(ios)
+{
+  SessionCache::instance().attach(context.native_handle());
+
+  auto ssl = m_ssl.get();
+  SSL_set_app_data(ssl, this);
+  SSL_set_verify(ssl, SSL_VERIFY_PEER, &KTLSAsyncConnection::verifyPeer);
+  SSL_set_options(ssl, SSL_OP_ENABLE_KTLS);
+  SSL_set_mode(ssl, SSL_MODE_ENABLE_PARTIAL_WRITE
+                    | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+  SSL_set_connect_state(ssl);
+}
+
+
+//----------------------------------------------------------------------------
+int KTLSAsyncConnection::verifyPeer(int preverified, X509_STORE_CTX *ctx)
+{
+  auto ssl = static_cast<SSL*>(X509_STORE_CTX_get_ex_data(ctx,
+                                 SSL_get_ex_data_X509_STORE_CTX_idx()));
+  auto self = static_cast<KTLSAsyncConnection*>(SSL_get_app_data(ssl));
+
+  asio::ssl::verify_context vc(ctx);
+  return util::verifyCertificate(self->m_sslmode, preverified, vc);
+}
+
+
+//----------------------------------------------------------------------------
+void KTLSAsyncConnection::connect(EHandler &&eh)
+{
+  asio::async_connect(m_socket, m_endpoint, [this, ehandler = std::move(eh)]
+  (const std::error_code &ec, const EndpointType &ep)
+  {
+    m_remote_ep = ep;
+    ehandler(ec ? ec : setSocketOption(m_socket, m_option));
+  });
+}
+
+
+//----------------------------------------------------------------------------
+/// Direct negotiation skips the SSLRequest and its reply.
+void KTLSAsyncConnection::handshake(EHandler &&eh)
+{
+  if (m_negotiation == SSLNegotiation::direct) {
+    startTLS(std::move(eh));
+    return;
+  }
+
+  asyncWrite(m_socket, pv3::SSLRequest(), [this, ehandler = std::move(eh)]
+  (const std::error_code &ec, std::size_t bytes) mutable
+  {
+    if (ec) { ehandler(ec); return; }
+
+    auto buf = std::make_shared<Buffer>(1);
+    asio::async_read(m_socket, asio::buffer(*buf),
+    [this, buf, ehandler = std::move(ehandler)]
+    (const std::error_code &ec, std::size_t bytes) mutable
+    {
+      if (ec) { ehandler(ec); return; }
+      if (bytes != 1 || (*buf)[0] != 'S') {
+        ehandler(std::error_code(EMSGSIZE, std::generic_category()));
+        return;
+      }
+      startTLS(std::move(ehandler));
+    });
+  });
+}
+
+
+//----------------------------------------------------------------------------
+/// OpenSSL enables kTLS as the keys are set during the handshake, which
+/// requires its own socket BIO.
+void KTLSAsyncConnection::startTLS(EHandler &&eh)
+{
+  auto ssl = m_ssl.get();
+  std::error_code ec;
+  m_socket.non_blocking(true, ec);
+  if (!ec && !SSL_set_fd(ssl, m_socket.native_handle())) { ec = sslError(); }
+  if (!ec) {
+    ec = prepareSession(ssl, m_remote_ep, m_sni, m_sslmode, m_negotiation,
+                        m_session_key);
+  }
+  if (ec) { eh(ec); return; }
+
+  perform([ssl] { return SSL_do_handshake(ssl); },
+  [this, ssl, ehandler = std::move(eh)] (std::error_code ec, int)
+  {
+    if (!ec) { ec = checkALPN(ssl, m_negotiation); }
+    if (ec) { SessionCache::instance().erase(m_session_key); }
+    ehandler(ec);
+  });
+}
+
+
+//----------------------------------------------------------------------------
+void KTLSAsyncConnection::perform(Op &&op, Done &&done)
+{
+  ERR_clear_error();
+  auto result = op();
+  if (result > 0) { done({}, result); return; }
+
+  auto wait = asio::socket_base::wait_read;
+  switch (SSL_get_error(m_ssl.get(), result))
+  {
+    case SSL_ERROR_WANT_READ: break;
+    case SSL_ERROR_WANT_WRITE: wait = asio::socket_base::wait_write; break;
+    case SSL_ERROR_ZERO_RETURN: done(asio::error::eof, 0); return;
+
+    case SSL_ERROR_SYSCALL:
+      if (errno == 0) { done(asio::error::eof, 0); return; }
+      done(std::error_code(errno, std::system_category()), 0);
+      return;
+
+    default: done(sslError(), 0); return;
+  }
+
+  m_socket.async_wait(wait,
+  [self = shared_from_this(), op = std::move(op), done = std::move(done)]
+  (const std::error_code &ec) mutable
+  {
+    if (ec) { done(ec, 0); return; }
+    self->perform(std::move(op), std::move(done));
+  });
+}
+
+
+//----------------------------------------------------------------------------
+/// As asyncRead(), with SSL_read() refilling the RecvBuffer.
+void KTLSAsyncConnection::read(std::size_t len, RHandler &&rh)
+{
+  std::pmr::polymorphic_allocator<Buffer> alloc(bufferResource());
+  auto out = std::allocate_shared<Buffer>(alloc);
+  out->reserve(len);
+  m_recv.take(len, *out);
+
+  if (out->size() == len) {
+    asio::post(m_socket.get_executor(),
+    [self = shared_from_this(), out, rhandler = std::move(rh)]
+    {
+      rhandler({}, out->size(), *out);
+    });
+    return;
+  }
+  fill(len, out, std::move(rh));
+}
+
+
+//----------------------------------------------------------------------------
+/// The handler is always posted, SSL_read() may complete at once.
+void KTLSAsyncConnection::fill(std::size_t len, std::shared_ptr<Buffer> out,
+                               RHandler &&rh)
+{
+  auto ssl = m_ssl.get();
+  auto have = out->size();
+  bool direct = (len - have >= RecvBuffer::CAPACITY);
+
+  Op op;
+  if (direct) {
+    out->resize(len);
+    op = [ssl, out, have, len]
+    {
+      return SSL_read(ssl, out->data() + have, static_cast<int>(len - have));
+    };
+  }
+  else {
+    op = [this, ssl]
+    {
+      auto space = m_recv.space();
+      return SSL_read(ssl, space.data(), static_cast<int>(space.size()));
+    };
+  }
+
+  perform(std::move(op),
+  [self = shared_from_this(), len, out, have, direct, rhandler = std::move(rh)]
+  (const std::error_code &ec, int bytes) mutable
+  {
+    if (direct) { out->resize(have + (ec ? 0 : bytes)); }
+    else if (!ec) {
+      self->m_recv.commit(bytes);
+      self->m_recv.take(len - out->size(), *out);
+    }
+
+    if (!ec && out->size() < len) {
+      self->fill(len, out, std::move(rhandler));
+      return;
+    }
+    asio::post(self->m_socket.get_executor(),
+    [self, ec, out, rhandler = std::move(rhandler)]
+    {
+      rhandler(ec, out->size(), *out);
+    });
+  });
+}
+
+
+//----------------------------------------------------------------------------
+void KTLSAsyncConnection::write(const Message &msg, WHandler &&wh)
+{
+  std::pmr::polymorphic_allocator<Buffer> alloc(bufferResource());
+  auto buf = std::allocate_shared<Buffer>(alloc);
+  Buffer body(bufferResource());
+  pv3::Message::serialize(msg, *buf, body);
+  buf->insert(buf->end(), body.begin(), body.end());
+
+  send(buf, 0, std::move(wh));
+}
+
+
+//----------------------------------------------------------------------------
+/// Write buf from sent on. The handler is always posted.
+void KTLSAsyncConnection::send(std::shared_ptr<Buffer> buf, std::size_t sent,
+                               WHandler &&wh)
+{
+  auto ssl = m_ssl.get();
+  perform([ssl, buf, sent]
+  {
+    return SSL_write(ssl, buf->data() + sent,
+                     static_cast<int>(buf->size() - sent));
+  },
+  [self = shared_from_this(), buf, sent, whandler = std::move(wh)]
+  (const std::error_code &ec, int bytes) mutable
+  {
+    auto total = sent + (ec ? 0 : bytes);
+    if (!ec && total < buf->size()) {
+      self->send(buf, total, std::move(whandler));
+      return;
+    }
+    asio::post(self->m_socket.get_executor(),
+    [ec, total, whandler = std::move(whandler)]
+    {
+      whandler(ec, total);
+    });
+  });
+}
+
+
+//----------------------------------------------------------------------------
+void KTLSAsyncConnection::close(EHandler &&ehandler)
+{
+  std::error_code ec;
+  quietShutdown(m_ssl.get());
+  m_socket.close(ec);
+  ehandler(ec);
+}
+
+
+//----------------------------------------------------------------------------
+void KTLSAsyncConnection::cancel(int pid, int key, EHandler &&ehandler)
+{
+  auto socket = std::make_shared<Socket>(m_socket.get_executor());
+  asyncCancel(socket, m_remote_ep, pid, key, std::move(ehandler));
+}
+
+
+//----------------------------------------------------------------------------
+bool KTLSAsyncConnection::resumed() const
+{
+  return SSL_session_reused(m_ssl.get());
+}
+
+
+//----------------------------------------------------------------------------
+bool KTLSAsyncConnection::ktlsSend() const
+{
+  auto bio = SSL_get_wbio(m_ssl.get());
+  return bio && BIO_get_ktls_send(bio);
+}
+
+
+//----------------------------------------------------------------------------
+bool KTLSAsyncConnection::ktlsReceive() const
+{
+  auto bio = SSL_get_rbio(m_ssl.get());
+  return bio && BIO_get_ktls_recv(bio);
+}
+
+
 //////////////////////////////////////////////////////////////////////////////
 } // namespace pv3
 } // namespace lapq
@@ -4,8 +4,13 @@
 #ifndef LAPQ_CONNECTION_H
 #define LAPQ_CONNECTION_H
 
+#include <cstdint>
 #include <iostream>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
 
 #include "asio.hpp"
 #include "asio/ssl.hpp"
@@ -22,6 +27,137 @@ namespace pv3 {
 class Header;
 class Message;
 
+/// The process wide pool that message buffers are allocated from.
+std::pmr::memory_resource *bufferResource();
+
+
+//============================================================================
+/// TLS sessions of earlier connections in this process, keyed by server
+/// endpoint, SNI host name, sslmode and SSL_CTX. A new connection to the
+/// same server offers the cached session so that the server may resume it
+/// with an abbreviated handshake. Sessions, and TLS 1.3 tickets that arrive
+/// after the handshake, are stored through the new session callback of the
+/// SSL_CTX.
+///
+/// OpenSSL does not verify the certificate of a resumed session, so a
+/// session is only offered to connections with the sslmode and the trust
+/// store, the SSL_CTX, of the one that verified it.
+class SessionCache {
+public:
+  static constexpr std::size_t MAX_SESSIONS = 256;
+
+  static SessionCache &instance();
+
+  /// The cache key of a server reached with sslmode and ctx. ctx is told
+  /// apart from a later context at the same address by a serial number
+  /// given by attach().
+  static std::string key(const asio::ip::tcp::endpoint &ep,
+                         const std::string &sni, SSLMode sslmode,
+                         SSL_CTX *ctx);
+
+  /// Enable client side session caching on ctx, unless it is already.
+  void attach(SSL_CTX *ctx);
+
+  /// Offer the session cached for key on ssl, and store the sessions ssl
+  /// receives under key. key must outlive ssl.
+  void offer(SSL *ssl, const std::string *key);
+
+  /// Forget the session of key, e.g. after a failed handshake.
+  void erase(const std::string &key);
+
+  std::size_t size() const;
+
+private:
+  SessionCache();
+  static int newSession(SSL *ssl, SSL_SESSION *session);
+
+  using Session = std::unique_ptr<SSL_SESSION, decltype(&SSL_SESSION_free)>;
+
+  mutable std::mutex m_mutex;
+  std::unordered_map<std::string, Session> m_session;
+  int m_index;                          // of the key in the SSL ex_data
+  int m_ctx_index;                      // of the serial in the SSL_CTX's
+  std::uintptr_t m_serial = 0;          // of the last attached SSL_CTX
+
+}; // SessionCache
+
+
+
+//============================================================================
+/// Receive buffer slots of one io_context, registered with it as a single
+/// set. With asio on io_uring (LAPQ_IO_URING) a read into a slot is a fixed
+/// buffer read, without the kernel pinning the pages on every call.
+class RecvPool : public asio::execution_context::service {
+public:
+  static asio::execution_context::id id;
+  static constexpr std::size_t SLOTS = 64;
+
+  explicit RecvPool(asio::execution_context &ctx);
+
+  /// A free slot, or std::nullopt if all are taken.
+  std::optional<asio::mutable_registered_buffer> acquire();
+  void release(const asio::mutable_registered_buffer &slot);
+
+private:
+  void shutdown() override;
+
+  using Registration = asio::buffer_registration<
+                         std::vector<asio::mutable_buffer>>;
+
+  std::mutex m_mutex;
+  std::unique_ptr<char[]> m_slab;
+  std::optional<Registration> m_registration;
+  std::vector<asio::mutable_registered_buffer> m_free;
+
+}; // RecvPool
+
+
+
+//============================================================================
+/// Bytes read from the socket and not yet handed out by read(). A refill
+/// reads whatever the socket has, up to CAPACITY, so a message header and
+/// its body usually take one read between them and a run of small DataRows
+/// one read for many.
+class RecvBuffer {
+public:
+  static constexpr std::size_t CAPACITY = 16 * 1024;
+
+  /// Owns its storage.
+  RecvBuffer();
+
+  /// Storage from the RecvPool of ctx, or its own if the pool is full.
+  explicit RecvBuffer(asio::execution_context &ctx);
+  ~RecvBuffer();
+
+  RecvBuffer(const RecvBuffer&) = delete;
+  RecvBuffer &operator=(const RecvBuffer&) = delete;
+
+  std::size_t size() const { return m_end - m_begin; }
+
+  /// Append up to len buffered bytes to out and return how many.
+  std::size_t take(std::size_t len, Buffer &out);
+
+  /// The free space after the buffered bytes. Moves them to the front first.
+  asio::mutable_buffer space();
+  asio::mutable_registered_buffer registeredSpace();
+
+  /// Mark n bytes read into space() as buffered.
+  void commit(std::size_t n) { m_end += n; }
+
+  bool registered() const { return m_pool != nullptr; }
+
+private:
+  void compact();
+
+  RecvPool *m_pool = nullptr;
+  asio::mutable_registered_buffer m_slot;
+  std::unique_ptr<char[]> m_own;
+  char *m_data;
+  std::size_t m_begin = 0;
+  std::size_t m_end = 0;
+
+}; // RecvBuffer
+
 //============================================================================
 class ConnectionBase {
 public:
@@ -40,6 +176,13 @@ public:
   virtual void write(const Message &msg, WHandler &&wh) = 0;
   virtual void close(EHandler &&eh) = 0;
 
+  /// Send a CancelRequest for backend pid on a new connection to the same
+  /// server. The outcome of the cancel is not reported by the server.
+  virtual void cancel(int pid, int key, EHandler &&eh);
+
+  /// True if the handlers are called before read() and write() return.
+  virtual bool blocking() const { return false; }
+
 }; // ConnectionBase
 
 
@@ -48,7 +191,7 @@ public:
 template<typename S>
 std::size_t syncWrite(S &stream, const Message &msg, std::error_code &ec)
 {
-  Buffer header_buf, body_buf;
+  Buffer header_buf(bufferResource()), body_buf(bufferResource());
   pv3::Message::serialize(msg, header_buf, body_buf);
 
   std::vector<asio::const_buffer> buf;
@@ -70,8 +213,9 @@ std::size_t syncWrite(S &stream, const Message &msg, std::error_code &ec)
 template<typename S>
 void asyncWrite(S &stream, const Message &msg, ConnectionBase::WHandler &&wh)
 {
-  auto header_buf = std::make_shared<Buffer>();
-  auto body_buf = std::make_shared<Buffer>();
+  std::pmr::polymorphic_allocator<Buffer> alloc(bufferResource());
+  auto header_buf = std::allocate_shared<Buffer>(alloc);
+  auto body_buf = std::allocate_shared<Buffer>(alloc);
   pv3::Message::serialize(msg, *header_buf, *body_buf);
 
   std::vector<asio::const_buffer> buf;
@@ -92,6 +236,187 @@ void asyncWrite(S &stream, const Message &msg, ConnectionBase::WHandler &&wh)
 }
 
 
+//----------------------------------------------------------------------------
+/// Read exactly len bytes into out through rb. The remainder of a message
+/// larger than the buffer is read straight into out.
+template<typename S>
+std::size_t syncRead(S &stream, RecvBuffer &rb, std::size_t len, Buffer &out,
+                     std::error_code &ec)
+{
+  out.clear();
+  rb.take(len, out);
+
+  if (len - out.size() >= RecvBuffer::CAPACITY) {
+    auto have = out.size();
+    out.resize(len);
+    have += asio::read(stream, asio::buffer(out.data() + have, len - have), ec);
+    return have;
+  }
+
+  while (out.size() < len) {
+    auto bytes = stream.read_some(rb.space(), ec);
+    if (ec) { break; }
+    rb.commit(bytes);
+    rb.take(len - out.size(), out);
+  }
+  return out.size();
+}
+
+
+//----------------------------------------------------------------------------
+template<typename S, typename H>
+void asyncReadSome(S &stream, RecvBuffer &rb, H &&handler)
+{
+  stream.async_read_some(rb.space(), std::forward<H>(handler));
+}
+
+//----------------------------------------------------------------------------
+/// Sockets read into a registered slot when the RecvBuffer has one.
+template<typename P, typename E, typename H>
+void asyncReadSome(asio::basic_stream_socket<P, E> &stream, RecvBuffer &rb,
+                   H &&handler)
+{
+  if (rb.registered()) {
+    stream.async_read_some(rb.registeredSpace(), std::forward<H>(handler));
+  }
+  else { stream.async_read_some(rb.space(), std::forward<H>(handler)); }
+}
+
+
+//----------------------------------------------------------------------------
+template<typename S>
+void asyncFill(S &stream, RecvBuffer &rb, std::size_t len,
+               std::shared_ptr<Buffer> out, std::shared_ptr<void> owner,
+               ConnectionBase::RHandler &&rh)
+{
+  if (len - out->size() >= RecvBuffer::CAPACITY) {
+    auto have = out->size();
+    out->resize(len);
+    asio::async_read(stream, asio::buffer(out->data() + have, len - have),
+    [out, owner, have, rhandler = std::move(rh)]
+    (const std::error_code &ec, std::size_t bytes)
+    {
+      rhandler(ec, have + bytes, *out);
+    });
+    return;
+  }
+
+  asyncReadSome(stream, rb,
+  [&stream, &rb, len, out, owner, rhandler = std::move(rh)]
+  (const std::error_code &ec, std::size_t bytes) mutable
+  {
+    if (ec) { rhandler(ec, out->size(), *out); return; }
+
+    rb.commit(bytes);
+    rb.take(len - out->size(), *out);
+    if (out->size() == len) { rhandler(ec, len, *out); return; }
+    asyncFill(stream, rb, len, out, owner, std::move(rhandler));
+  });
+}
+
+
+//----------------------------------------------------------------------------
+/// Read exactly len bytes through rb. owner keeps the stream and rb alive
+/// until the handler has run. A read served from the buffer is posted, so
+/// a long run of buffered messages does not deepen the stack.
+template<typename S>
+void asyncRead(S &stream, RecvBuffer &rb, std::size_t len,
+               std::shared_ptr<void> owner, ConnectionBase::RHandler &&rh)
+{
+  std::pmr::polymorphic_allocator<Buffer> alloc(bufferResource());
+  auto out = std::allocate_shared<Buffer>(alloc);
+  out->reserve(len);
+  rb.take(len, *out);
+
+  if (out->size() == len) {
+    asio::post(stream.get_executor(),
+    [out, owner, rhandler = std::move(rh)]
+    {
+      rhandler({}, out->size(), *out);
+    });
+    return;
+  }
+  asyncFill(stream, rb, len, out, owner, std::move(rh));
+}
+
+
+//----------------------------------------------------------------------------
+/// Apply so to a connected socket. Only the buffer sizes apply to a socket
+/// that is not tcp.
+template<typename S>
+std::error_code setSocketOption(S &socket, const util::SocketOption &so)
+{
+  std::error_code ec;
+  if (so.rcvbuf > 0) {
+    socket.set_option(asio::socket_base::receive_buffer_size(so.rcvbuf), ec);
+    if (ec) { return ec; }
+  }
+  if (so.sndbuf > 0) {
+    socket.set_option(asio::socket_base::send_buffer_size(so.sndbuf), ec);
+    if (ec) { return ec; }
+  }
+
+  if constexpr (std::is_same_v<typename S::protocol_type, asio::ip::tcp>) {
+    socket.set_option(asio::ip::tcp::no_delay(so.nodelay), ec);
+    if (ec) { return ec; }
+    socket.set_option(asio::socket_base::keep_alive(so.keepalive), ec);
+    if (ec) { return ec; }
+
+    if (so.keepalive) {
+      using Idle = asio::detail::socket_option::integer<IPPROTO_TCP,
+                                                        TCP_KEEPIDLE>;
+      using Interval = asio::detail::socket_option::integer<IPPROTO_TCP,
+                                                            TCP_KEEPINTVL>;
+      using Count = asio::detail::socket_option::integer<IPPROTO_TCP,
+                                                         TCP_KEEPCNT>;
+      if (so.keepalive_idle > 0) {
+        socket.set_option(Idle(so.keepalive_idle), ec);
+      }
+      if (!ec && so.keepalive_interval > 0) {
+        socket.set_option(Interval(so.keepalive_interval), ec);
+      }
+      if (!ec && so.keepalive_count > 0) {
+        socket.set_option(Count(so.keepalive_count), ec);
+      }
+    }
+  }
+  return ec;
+}
+
+
+//----------------------------------------------------------------------------
+template<typename S, typename E>
+std::error_code syncCancel(S &socket, const E &ep, int pid, int key)
+{
+  std::error_code ec, er;
+  socket.connect(ep, ec);
+  if (!ec) { syncWrite(socket, CancelRequest(pid, key), ec); }
+  socket.close(er);
+  return ec;
+}
+
+
+//----------------------------------------------------------------------------
+template<typename S, typename E>
+void asyncCancel(std::shared_ptr<S> socket, const E &ep, int pid, int key,
+                 ConnectionBase::EHandler &&eh)
+{
+  socket->async_connect(ep, [socket, pid, key, handler = std::move(eh)]
+  (const std::error_code &ec)
+  {
+    if (ec) { handler(ec); return; }
+
+    asyncWrite(*socket, CancelRequest(pid, key), [socket, handler]
+    (const std::error_code &ec, std::size_t bytes)
+    {
+      std::error_code er;
+      socket->close(er);
+      handler(ec);
+    });
+  });
+}
+
+
 
 //============================================================================
 class Connection : public ConnectionBase {
@@ -100,12 +425,15 @@ public:
   using EndpointType = Socket::endpoint_type;
 
 //----------------------------------------------------------------------------
-  Connection(asio::io_service &ios, const EndpointType &ep);
+  Connection(asio::io_service &ios, const EndpointType &ep,
+             const util::SocketOption &so = {});
 
   void connect(EHandler &&eh) override;
   void read(std::size_t len, RHandler &&rh) override;
   void write(const Message &msg, WHandler &&wh) override;
   void close(EHandler &&eh) override;
+  void cancel(int pid, int key, EHandler &&eh) override;
+  bool blocking() const override { return true; }
 
 
 
@@ -114,6 +442,9 @@ public:
 private:
   Socket m_socket;
   EndpointType m_remote_ep;
+  util::SocketOption m_option;
+  RecvBuffer m_recv;
+  Buffer m_buf;                 // reused by every read()
 
 }; // Connection
 
@@ -124,28 +455,79 @@ class SSLConnection : public ConnectionBase {
 public:
   using Socket = asio::ssl::stream<asio::ip::tcp::socket>;
   using EndpointType = asio::ip::tcp::endpoint;
+  using Endpoints = std::vector<EndpointType>;
 
 //----------------------------------------------------------------------------
+  /// sni is the host name sent in the TLS handshake, none if empty or an
+  /// address.
   SSLConnection(asio::io_service &ios,
                 SSLMode sslmode,
                 asio::ssl::context &context,
-                const EndpointType &ep);
+                const Endpoints &ep,
+                const util::SocketOption &so = {},
+                const std::string &sni = {},
+                SSLNegotiation negotiation = SSLNegotiation::postgres);
 
   void connect(EHandler &&eh) override;
   void handshake(EHandler &&eh) override;
   void read(std::size_t len, RHandler &&rh) override;
   void write(const Message &msg, WHandler &&wh) override;
   void close(EHandler &&eh) override;
+  void cancel(int pid, int key, EHandler &&eh) override;
+
+  /// True if the handshake resumed a session from the SessionCache.
+  bool resumed() const;
+  bool blocking() const override { return true; }
 
 //----------------------------------------------------------------------------
 private:
   Socket m_socket;
-  EndpointType m_remote_ep;
+  SSLMode m_sslmode;
+  Endpoints m_endpoint;         // tried in order
+  EndpointType m_remote_ep;     // connected
+  util::SocketOption m_option;
+  std::string m_sni;
+  SSLNegotiation m_negotiation;
+  std::string m_session_key;    // in the SessionCache
+  RecvBuffer m_recv;
+  Buffer m_buf;                 // reused by every read()
 
 }; // SSLConnection
 
 
 
+//============================================================================
+/// Plain tcp, without SSLRequest.
+class TCPConnection : public ConnectionBase {
+public:
+  using Socket = asio::ip::tcp::socket;
+  using EndpointType = asio::ip::tcp::endpoint;
+  using Endpoints = std::vector<EndpointType>;
+
+//----------------------------------------------------------------------------
+  TCPConnection(asio::io_service &ios, const Endpoints &ep,
+                const util::SocketOption &so = {});
+
+  void connect(EHandler &&eh) override;
+  void read(std::size_t len, RHandler &&rh) override;
+  void write(const Message &msg, WHandler &&wh) override;
+  void close(EHandler &&eh) override;
+  void cancel(int pid, int key, EHandler &&eh) override;
+  bool blocking() const override { return true; }
+
+//----------------------------------------------------------------------------
+private:
+  Socket m_socket;
+  Endpoints m_endpoint;         // tried in order
+  EndpointType m_remote_ep;     // connected
+  util::SocketOption m_option;
+  RecvBuffer m_recv;
+  Buffer m_buf;                 // reused by every read()
+
+}; // TCPConnection
+
+
+
 //============================================================================
 class AsyncConnection : public ConnectionBase,
                         public std::enable_shared_from_this<AsyncConnection> {
@@ -154,22 +536,58 @@ public:
   using EndpointType = Socket::endpoint_type;
 
 //----------------------------------------------------------------------------
-  AsyncConnection(asio::io_service &ios, const EndpointType &ep);
+  AsyncConnection(asio::io_service &ios, const EndpointType &ep,
+                  const util::SocketOption &so = {});
 
   void connect(EHandler &&eh) override;
   void read(std::size_t len, RHandler &&rh) override;
   void write(const Message &msg, WHandler &&wh) override;
   void close(EHandler &&eh) override;
+  void cancel(int pid, int key, EHandler &&eh) override;
 
 //----------------------------------------------------------------------------
 private:
   Socket m_socket;
   EndpointType m_remote_ep;
+  util::SocketOption m_option;
+  RecvBuffer m_recv;
 
 }; // AsyncConnection
 
 
 
+//============================================================================
+/// Plain tcp, without SSLRequest.
+class TCPAsyncConnection : public ConnectionBase,
+                        public std::enable_shared_from_this<TCPAsyncConnection>
+{
+public:
+  using Socket = asio::ip::tcp::socket;
+  using EndpointType = asio::ip::tcp::endpoint;
+  using Endpoints = std::vector<EndpointType>;
+
+//----------------------------------------------------------------------------
+  TCPAsyncConnection(asio::io_service &ios, const Endpoints &ep,
+                     const util::SocketOption &so = {});
+
+  void connect(EHandler &&eh) override;
+  void read(std::size_t len, RHandler &&rh) override;
+  void write(const Message &msg, WHandler &&wh) override;
+  void close(EHandler &&eh) override;
+  void cancel(int pid, int key, EHandler &&eh) override;
+
+//----------------------------------------------------------------------------
+private:
+  Socket m_socket;
+  Endpoints m_endpoint;         // tried in order
+  EndpointType m_remote_ep;     // connected
+  util::SocketOption m_option;
+  RecvBuffer m_recv;
+
+}; // TCPAsyncConnection
+
+
+
 
 //============================================================================
 class SSLAsyncConnection : public ConnectionBase,
@@ -178,28 +596,118 @@ class SSLAsyncConnection : public ConnectionBase,
 public:
   using Socket = asio::ssl::stream<asio::ip::tcp::socket>;
   using EndpointType = asio::ip::tcp::endpoint;
+  using Endpoints = std::vector<EndpointType>;
 
 //----------------------------------------------------------------------------
+  /// sni is the host name sent in the TLS handshake, none if empty or an
+  /// address.
   SSLAsyncConnection(asio::io_service &ios,
                      SSLMode sslmode,
                      asio::ssl::context &context,
-                     const EndpointType &ep);
+                     const Endpoints &ep,
+                     const util::SocketOption &so = {},
+                     const std::string &sni = {},
+                     SSLNegotiation negotiation = SSLNegotiation::postgres);
 
   void connect(EHandler &&eh) override;
   void handshake(EHandler &&eh) override;
   void read(std::size_t len, RHandler &&rh) override;
   void write(const Message &msg, WHandler &&wh) override;
   void close(EHandler &&eh) override;
+  void cancel(int pid, int key, EHandler &&eh) override;
+
+  /// True if the handshake resumed a session from the SessionCache.
+  bool resumed() const;
 
 //----------------------------------------------------------------------------
 private:
+  void startTLS(EHandler &&eh);
+
   Socket m_socket;
-  EndpointType m_remote_ep;
+  SSLMode m_sslmode;
+  Endpoints m_endpoint;         // tried in order
+  EndpointType m_remote_ep;     // connected
+  util::SocketOption m_option;
+  std::string m_sni;
+  SSLNegotiation m_negotiation;
+  std::string m_session_key;    // in the SessionCache
+  RecvBuffer m_recv;
 
 }; // SSLAsyncConnection
 
 
 
+//============================================================================
+/// TLS through OpenSSL on the socket itself instead of asio::ssl::stream, so
+/// that OpenSSL can hand the record layer to the kernel (kTLS) after the
+/// handshake. The kernel then encrypts and decrypts, and reads and writes
+/// move plaintext through the socket. Without kTLS in the kernel, or for a
+/// cipher it does not offload, OpenSSL encrypts in user space as usual.
+class KTLSAsyncConnection : public ConnectionBase,
+                       public std::enable_shared_from_this<KTLSAsyncConnection>
+{
+public:
+  using Socket = asio::ip::tcp::socket;
+  using EndpointType = asio::ip::tcp::endpoint;
+  using Endpoints = std::vector<EndpointType>;
+
+//----------------------------------------------------------------------------
+  /// sni is the host name sent in the TLS handshake, none if empty or an
+  /// address.
+  KTLSAsyncConnection(asio::io_service &ios,
+                      SSLMode sslmode,
+                      asio::ssl::context &context,
+                      const Endpoints &ep,
+                      const util::SocketOption &so = {},
+                      const std::string &sni = {},
+                      SSLNegotiation negotiation = SSLNegotiation::postgres);
+
+  void connect(EHandler &&eh) override;
+  void handshake(EHandler &&eh) override;
+  void read(std::size_t len, RHandler &&rh) override;
+  void write(const Message &msg, WHandler &&wh) override;
+  void close(EHandler &&eh) override;
+  void cancel(int pid, int key, EHandler &&eh) override;
+
+  /// True if the handshake resumed a session from the SessionCache.
+  bool resumed() const;
+
+  /// True if the kernel encrypts the records sent, or decrypts the records
+  /// received.
+  bool ktlsSend() const;
+  bool ktlsReceive() const;
+
+//----------------------------------------------------------------------------
+private:
+  using Op = std::function<int()>;
+  using Done = std::function<void(const std::error_code &, int)>;
+
+  void startTLS(EHandler &&eh);
+
+  /// Run op, an SSL call on m_ssl, again whenever the socket is ready for
+  /// what it wants, until it returns a positive result or fails.
+  void perform(Op &&op, Done &&done);
+
+  void fill(std::size_t len, std::shared_ptr<Buffer> out, RHandler &&rh);
+  void send(std::shared_ptr<Buffer> buf, std::size_t sent, WHandler &&wh);
+
+  static int verifyPeer(int preverified, X509_STORE_CTX *ctx);
+
+  Socket m_socket;
+  std::unique_ptr<SSL, decltype(&SSL_free)> m_ssl;
+  SSLMode m_sslmode;
+  Endpoints m_endpoint;         // tried in order
+  EndpointType m_remote_ep;     // connected
+  util::SocketOption m_option;
+  std::string m_sni;
+  SSLNegotiation m_negotiation;
+  std::string m_session_key;    // in the SessionCache
+  RecvBuffer m_recv;
+
+}; // KTLSAsyncConnection
+
+
+
 
 
 
@@ -0,0 +1,288 @@
+/// @file dbcolumn.cpp
+
+#include <algorithm>
+
+#include "dbcolumn.h"
+
+namespace lapq {
+//=============================================================================
+
+
+///////////////////////////////////////////////////////////////////////////////
+Column::Column(const pg::FieldSpec &fs, bool dict)
+  : m_field_spec(fs), m_size(0), m_offset{0}
+{
+  m_kind = kindOf(fs, dict);
+}
+
+
+//----------------------------------------------------------------------------
+Column::Kind Column::kindOf(const pg::FieldSpec &fs, bool dict)
+{
+  switch (fs.type_oid)
+  {
+    case pg::PG_BOOLOID:   return Kind::BOOL;
+    case pg::PG_INT2OID:
+    case pg::PG_INT4OID:   return Kind::INT4;
+    case pg::PG_INT8OID:   return Kind::INT8;
+    case pg::PG_FLOAT4OID:
+    case pg::PG_FLOAT8OID: return Kind::FLOAT8;
+    default:               return dict ? Kind::DICT : Kind::TEXT;
+  }
+}
+
+
+//----------------------------------------------------------------------------
+void Column::append(const char *buf, int sz)
+{
+  if (m_size % 64 == 0) { m_valid.push_back(0); }
+
+  bool null = (sz < 0);
+  if (!null) { m_valid.back() |= std::uint64_t{1} << (m_size % 64); }
+
+  switch (m_kind)
+  {
+    case Kind::BOOL:
+      m_bool.push_back(null ? 0 : pg::decodeBool(buf, sz));
+    break;
+
+    case Kind::INT4:
+      m_int4.push_back(null ? 0 : pg::decodeInt4(buf, sz));
+    break;
+
+    case Kind::INT8:
+      m_int8.push_back(null ? 0 : pg::decodeInt8(buf, sz));
+    break;
+
+    case Kind::FLOAT8:
+      m_float8.push_back(null ? 0 : pg::decodeFloat8(buf, sz));
+    break;
+
+    case Kind::TEXT:
+      if (!null) { m_blob.insert(m_blob.end(), buf, buf + sz); }
+      m_offset.push_back(m_blob.size());
+    break;
+
+    case Kind::DICT:
+      m_code.push_back(null ? null_code : intern(std::string_view(buf, sz)));
+    break;
+  }
+
+  ++m_size;
+}
+
+
+//----------------------------------------------------------------------------
+void Column::reserve(size_type n)
+{
+  m_valid.reserve((n + 63) / 64);
+
+  switch (m_kind)
+  {
+    case Kind::BOOL: m_bool.reserve(n); break;
+    case Kind::INT4: m_int4.reserve(n); break;
+    case Kind::INT8: m_int8.reserve(n); break;
+    case Kind::FLOAT8: m_float8.reserve(n); break;
+    case Kind::TEXT: m_offset.reserve(n + 1); break;
+    case Kind::DICT: m_code.reserve(n); break;
+  }
+}
+
+
+//----------------------------------------------------------------------------
+void Column::clear()
+{
+  m_size = 0;
+  m_valid.clear();
+  m_bool.clear();
+  m_int4.clear();
+  m_int8.clear();
+  m_float8.clear();
+  m_offset.resize(1);
+  m_blob.clear();
+  m_code.clear();
+  m_slot.clear();
+}
+
+
+//----------------------------------------------------------------------------
+void Column::extend(const Column &o)
+{
+  if (o.m_kind != m_kind) { throw std::bad_cast(); }
+
+  auto shift = m_size % 64;
+  if (shift == 0) {
+    m_valid.insert(m_valid.end(), o.m_valid.begin(), o.m_valid.end());
+  }
+  else {
+    for (auto w : o.m_valid)
+    {
+      m_valid.back() |= w << shift;
+      m_valid.push_back(w >> (64 - shift));
+    }
+    m_valid.resize((m_size + o.m_size + 63) / 64);
+  }
+
+  switch (m_kind)
+  {
+    case Kind::BOOL:
+      m_bool.insert(m_bool.end(), o.m_bool.begin(), o.m_bool.end());
+    break;
+
+    case Kind::INT4:
+      m_int4.insert(m_int4.end(), o.m_int4.begin(), o.m_int4.end());
+    break;
+
+    case Kind::INT8:
+      m_int8.insert(m_int8.end(), o.m_int8.begin(), o.m_int8.end());
+    break;
+
+    case Kind::FLOAT8:
+      m_float8.insert(m_float8.end(), o.m_float8.begin(), o.m_float8.end());
+    break;
+
+    case Kind::TEXT:
+    {
+      auto base = m_blob.size();
+      m_blob.insert(m_blob.end(), o.m_blob.begin(), o.m_blob.end());
+      for (auto it = o.m_offset.begin() + 1; it != o.m_offset.end(); ++it)
+      {
+        m_offset.push_back(base + *it);
+      }
+    }
+    break;
+
+    case Kind::DICT:
+    {
+      std::vector<code_type> code(o.dictionary_size());
+      for (code_type i = 0; i < code.size(); ++i)
+      {
+        code[i] = intern(o.entry(i));
+      }
+      for (auto c : o.m_code)
+      {
+        m_code.push_back(c == null_code ? null_code : code[c]);
+      }
+    }
+    break;
+  }
+
+  m_size += o.m_size;
+}
+
+
+//----------------------------------------------------------------------------
+Column::code_type Column::intern(std::string_view s)
+{
+  auto n = m_offset.size() - 1;                 // distinct values so far
+  if (2 * (n + 1) > m_slot.size()) {
+    rehash(std::max<size_type>(16, 2 * m_slot.size()));
+  }
+
+  auto mask = m_slot.size() - 1;
+  for (auto i = std::hash<std::string_view>{}(s) & mask; ; i = (i + 1) & mask)
+  {
+    auto slot = m_slot[i];
+    if (slot == 0) {
+      m_blob.insert(m_blob.end(), s.begin(), s.end());
+      m_offset.push_back(m_blob.size());
+      m_slot[i] = static_cast<code_type>(n + 1);
+      return static_cast<code_type>(n);
+    }
+    if (entry(slot - 1) == s) { return slot - 1; }
+  }
+}
+
+
+//----------------------------------------------------------------------------
+void Column::rehash(size_type n)
+{
+  m_slot.assign(n, 0);
+  for (size_type code = 0; code + 1 < m_offset.size(); ++code)
+  {
+    auto i = std::hash<std::string_view>{}(entry(code)) & (n - 1);
+    while (m_slot[i]) { i = (i + 1) & (n - 1); }
+    m_slot[i] = static_cast<code_type>(code + 1);
+  }
+}
+
+
+//----------------------------------------------------------------------------
+void Column::reset(const pg::FieldSpec &fs, bool dict)
+{
+  clear();
+  m_field_spec = fs;
+  m_kind = kindOf(fs, dict);
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+namespace {
+
+bool isDictionary(const pg::FieldSpec &fs, const std::vector<std::string> &dict)
+{
+  return std::find(dict.begin(), dict.end(), fs.name) != dict.end();
+}
+
+} // namespace
+
+
+//----------------------------------------------------------------------------
+ColumnSet::ColumnSet(const std::vector<pg::FieldSpec> &fs,
+                     const std::vector<std::string> &dict)
+  : m_field_spec{fs}, m_size(0)
+{
+  m_column.reserve(fs.size());
+  for (size_type i = 0; i < fs.size(); ++i)
+  {
+    m_column.emplace_back(fs[i], isDictionary(fs[i], dict));
+  }
+}
+
+
+//----------------------------------------------------------------------------
+void ColumnSet::reset(const std::vector<pg::FieldSpec> &fs,
+                      const std::vector<std::string> &dict)
+{
+  m_field_spec = fs;
+  m_field_index.clear();
+  m_error = SQLError();
+  m_size = 0;
+
+  if (m_column.size() > fs.size()) {
+    m_column.erase(m_column.begin() + fs.size(), m_column.end());
+  }
+  for (size_type i = 0; i < fs.size(); ++i)
+  {
+    auto d = isDictionary(fs[i], dict);
+    if (i < m_column.size()) { m_column[i].reset(fs[i], d); }
+    else { m_column.emplace_back(fs[i], d); }
+  }
+}
+
+
+//----------------------------------------------------------------------------
+void ColumnSet::extend(const ColumnSet &o)
+{
+  for (size_type i = 0; i < m_column.size() && i < o.m_column.size(); ++i)
+  {
+    m_column[i].extend(o.m_column[i]);
+  }
+  m_size += o.m_size;
+}
+
+
+//----------------------------------------------------------------------------
+void ColumnSet::reset(const SQLError &er)
+{
+  m_field_spec.clear();
+  m_field_index.clear();
+  m_column.clear();
+  m_error = er;
+  m_size = 0;
+}
+
+
+//=============================================================================
+} // namespace lapq
@@ -0,0 +1,324 @@
+/// @file dbcolumn.h
+
+#ifndef LAPQ_DBCOLUMN_H
+#define LAPQ_DBCOLUMN_H
+
+#include <cstdint>
+#include <vector>
+#include <span>
+#include <string>
+#include <string_view>
+#include <typeinfo>
+#include <type_traits>
+
+#include "error.h"
+#include "pgformat.h"
+#include "dbresult.h"
+
+namespace lapq {
+//=============================================================================
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// One column of a ColumnSet. Values are stored contiguously by type, bool as
+/// std::uint8_t, int2 and int4 as std::int32_t, int8 as std::int64_t, float4
+/// and float8 as double and all other types as text in a char blob with
+/// offsets. NULLs are recorded in a validity bitmap.
+///
+/// A text column in dictionary mode (DICT) interns each distinct value once
+/// and stores a std::uint32_t code per row instead.
+class Column {
+public:
+  using size_type = std::size_t;
+  using code_type = std::uint32_t;
+
+  enum class Kind { BOOL, INT4, INT8, FLOAT8, TEXT, DICT };
+
+  /// The code of NULL in a DICT column.
+  static constexpr code_type null_code = code_type(-1);
+
+  /// With dict a text column is stored in dictionary mode.
+  explicit Column(const pg::FieldSpec &fs, bool dict = false);
+
+  //------------------------------------------------------------------------
+  const pg::FieldSpec &field_spec() const { return m_field_spec; }
+  Kind kind() const { return m_kind; }
+
+  size_type size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+
+  bool is_null(size_type row) const
+  {
+    return !(m_valid[row / 64] & (std::uint64_t{1} << (row % 64)));
+  }
+
+  //------------------------------------------------------------------------
+  /// The values of a fixed width column, NULL rows hold 0.
+  template <typename T> std::span<const T> values() const
+  {
+    return std::span<const T>(data<T>());
+  }
+
+  /// The value of a text or DICT column, NULL is empty.
+  std::string_view text(size_type row) const
+  {
+    if (m_kind == Kind::DICT) {
+      auto c = m_code[row];
+      return (c == null_code) ? std::string_view{} : entry(c);
+    }
+    return entry(row);
+  }
+
+  //------------------------------------------------------------------------
+  /// The codes of a DICT column, see also values<code_type>().
+  code_type code(size_type row) const { return m_code[row]; }
+
+  /// The number of distinct values of a DICT column.
+  size_type dictionary_size() const
+  {
+    return (m_kind == Kind::DICT) ? m_offset.size() - 1 : 0;
+  }
+
+  /// The value of a code of a DICT column.
+  std::string_view dictionary(code_type code) const { return entry(code); }
+
+  std::span<const std::uint64_t> validity() const { return m_valid; }
+
+  //------------------------------------------------------------------------
+  template <typename T> T get(size_type row) const
+  {
+    if constexpr (std::is_same_v<T, std::string> ||
+                  std::is_same_v<T, std::string_view>)
+    {
+      if (m_kind != Kind::TEXT && m_kind != Kind::DICT) {
+        throw std::bad_cast();
+      }
+      return T{text(row)};
+    }
+    else {
+      return values<T>()[row];
+    }
+  }
+
+  //------------------------------------------------------------------------
+  void append(const char *buf, int sz);
+  void reserve(size_type n);
+  void clear();
+
+  /// Clear and take a new field spec, keeping the storage.
+  void reset(const pg::FieldSpec &fs, bool dict = false);
+
+  /// Append the rows of another column of the same kind.
+  void extend(const Column &other);
+
+//----------------------------------------------------------------------------
+private:
+  template <typename T> const std::vector<T> &data() const
+  {
+    if constexpr (std::is_same_v<T, std::uint8_t>) {
+      if (m_kind == Kind::BOOL) { return m_bool; }
+    }
+    else if constexpr (std::is_same_v<T, std::int32_t>) {
+      if (m_kind == Kind::INT4) { return m_int4; }
+    }
+    else if constexpr (std::is_same_v<T, std::int64_t>) {
+      if (m_kind == Kind::INT8) { return m_int8; }
+    }
+    else if constexpr (std::is_same_v<T, double>) {
+      if (m_kind == Kind::FLOAT8) { return m_float8; }
+    }
+    else if constexpr (std::is_same_v<T, code_type>) {
+      if (m_kind == Kind::DICT) { return m_code; }
+    }
+    throw std::bad_cast();
+  }
+
+  /// Entry i of m_blob, a row of a TEXT or a code of a DICT column.
+  std::string_view entry(size_type i) const
+  {
+    return std::string_view(m_blob.data() + m_offset[i],
+                            m_offset[i + 1] - m_offset[i]);
+  }
+
+  code_type intern(std::string_view s);
+  void rehash(size_type n);
+
+  static Kind kindOf(const pg::FieldSpec &fs, bool dict);
+
+  pg::FieldSpec m_field_spec;
+  Kind m_kind;
+  size_type m_size;
+
+  std::vector<std::uint64_t> m_valid;     // bit set if not NULL
+
+  std::vector<std::uint8_t> m_bool;
+  std::vector<std::int32_t> m_int4;
+  std::vector<std::int64_t> m_int8;
+  std::vector<double> m_float8;
+
+  std::vector<size_type> m_offset;        // one more than entries in m_blob
+  std::vector<char> m_blob;
+
+  std::vector<code_type> m_code;          // DICT
+  std::vector<code_type> m_slot;          // DICT hash table, 1 + code
+
+}; // Column
+
+
+//----------------------------------------------------------------------------
+template <> inline bool Column::get<bool>(size_type row) const
+{
+  return values<std::uint8_t>()[row] != 0;
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// The columns returned by one statement.
+class ColumnSet {
+public:
+  using size_type = Column::size_type;
+
+  /// The text columns named in dict are stored in dictionary mode.
+  ColumnSet(const std::vector<pg::FieldSpec> &fs,
+            const std::vector<std::string> &dict = {});
+  ColumnSet(const SQLError &er) : m_size(0), m_error(er) {}
+
+  //------------------------------------------------------------------------
+  const std::vector<pg::FieldSpec> &field_spec() const { return m_field_spec; }
+  const SQLError &error() const { return m_error; }
+
+  explicit operator bool() const { return !m_error.operator bool(); }
+
+  /// Number of rows.
+  size_type size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+
+  //------------------------------------------------------------------------
+  size_type column_count() const { return m_column.size(); }
+
+  const Column &column(size_type col) const { return m_column[col]; }
+  const Column &column(const std::string &col) const
+  {
+    return m_column[m_field_index.at(m_field_spec, col)];
+  }
+
+  const Column &column(ColumnHandle col) const { return m_column[col.index()]; }
+
+  /// Resolve a column name, throws std::out_of_range if there is none.
+  ColumnHandle handle(std::string_view col) const
+  {
+    return ColumnHandle(m_field_index.at(m_field_spec, col));
+  }
+
+  template <typename T> T get(size_type row, size_type col) const
+  {
+    return m_column[col].template get<T>(row);
+  }
+
+  template <typename T> T get(size_type row, ColumnHandle col) const
+  {
+    return get<T>(row, col.index());
+  }
+
+  template <typename T> T get(size_type row, const std::string &col) const
+  {
+    return get<T>(row, m_field_index.at(m_field_spec, col));
+  }
+
+  bool is_null(size_type row, size_type col) const
+  {
+    return m_column[col].is_null(row);
+  }
+
+  //------------------------------------------------------------------------
+  /// Start over with a new field spec, the columns keep their storage.
+  void reset(const std::vector<pg::FieldSpec> &fs,
+             const std::vector<std::string> &dict = {});
+  void reset(const SQLError &er);
+
+  /// Append the rows of a set with the same field spec.
+  void extend(const ColumnSet &other);
+
+  void add_row() { ++m_size; }
+  void add_column(int i, const char *buf, int sz)
+  {
+    if (size_type(i) < m_column.size()) { m_column[i].append(buf, sz); }
+  }
+
+//----------------------------------------------------------------------------
+private:
+  std::vector<pg::FieldSpec> m_field_spec;
+  FieldIndex m_field_index;
+  std::vector<Column> m_column;
+  size_type m_size;
+  SQLError m_error;
+
+}; // ColumnSet
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// A ResultBase that stores each column contiguously instead of a row of
+/// std::any. Suited to results that are scanned by column.
+class ColumnResultSet : public ResultBase {
+public:
+  using value_type = ColumnSet;
+  using vector_type = std::vector<value_type>;
+  using size_type = vector_type::size_type;
+  using reference = vector_type::reference;
+  using const_reference = vector_type::const_reference;
+
+  explicit operator bool() const
+  {
+    if (m_size == 0) { return false; }
+    return m_set[0].operator bool();
+  }
+
+  void add_result(const std::vector<pg::FieldSpec> &fs) override
+  {
+    if (m_size < m_set.size()) { m_set[m_size].reset(fs, m_dictionary); }
+    else { m_set.emplace_back(fs, m_dictionary); }
+    ++m_size;
+  }
+
+  void add_result(const SQLError &e) override
+  {
+    if (m_size < m_set.size()) { m_set[m_size].reset(e); }
+    else { m_set.emplace_back(e); }
+    ++m_size;
+  }
+
+  void add_row() override { m_set[m_size - 1].add_row(); }
+
+  void add_column(int i, const char *buf, int sz) override
+  {
+    m_set[m_size - 1].add_column(i, buf, sz);
+  }
+
+  //------------------------------------------------------------------------
+  size_type size() const { return m_size; }
+
+  /// Make the result ready for the next execution. The ColumnSets keep the
+  /// storage of their columns, including the text blobs.
+  void reset() { m_size = 0; }
+
+  /// Store the text columns with this name in dictionary mode, in the sets
+  /// added after the call. Suited to enums and other low cardinality values.
+  void dictionary(const std::string &col) { m_dictionary.push_back(col); }
+
+  reference operator[](size_type pos) { return m_set[pos]; }
+  const_reference operator[](size_type pos) const { return m_set[pos]; }
+
+//----------------------------------------------------------------------------
+private:
+  vector_type m_set;                // sets past m_size are kept for reuse
+  size_type m_size = 0;
+  std::vector<std::string> m_dictionary;
+
+}; // ColumnResultSet
+
+
+//=============================================================================
+} // namespace lapq
+#endif
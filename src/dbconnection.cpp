@@ -3,6 +3,8 @@
 
 #include <cstdlib>
 
+#include <chrono>
+#include <deque>
 #include <string>
 #include <vector>
 #include <map>
@@ -10,27 +12,464 @@
 
 #include "dbconnection.h"
 #include "dbresult.h"
+#include "dbraw.h"
 
 
 namespace lapq {
 //============================================================================
 
+namespace {
+
+using Endpoints = std::vector<asio::ip::tcp::endpoint>;
+using RHandler = std::function<void(const std::error_code &, Endpoints)>;
+
+//----------------------------------------------------------------------------
+std::error_code resolve(asio::io_service &ios, const util::Address &addr,
+                        Endpoints &ep)
+{
+  std::error_code ec;
+  asio::ip::tcp::resolver resolver(ios);
+  auto res = resolver.resolve(addr.host, addr.port, ec);
+  for (auto &r : res) { ep.push_back(r.endpoint()); }
+  return ec;
+}
+
+
+//----------------------------------------------------------------------------
+void asyncResolve(asio::io_service &ios, const util::Address &addr,
+                  RHandler &&rh)
+{
+  auto resolver = std::make_shared<asio::ip::tcp::resolver>(ios);
+  resolver->async_resolve(addr.host, addr.port,
+  [resolver, rhandler = std::move(rh)]
+  (const std::error_code &ec, asio::ip::tcp::resolver::results_type res)
+  {
+    Endpoints ep;
+    for (auto &r : res) { ep.push_back(r.endpoint()); }
+    rhandler(ec, std::move(ep));
+  });
+}
+
+
+//----------------------------------------------------------------------------
+/// The context of opt::SSLMODE, nullptr without it or if it fails to load.
+std::shared_ptr<asio::ssl::context> sslContext(const Option &option,
+                                               std::error_code &ec)
+{
+  ec.clear();
+  if (option.find(opt::SSLMODE) == option.end()) { return nullptr; }
+
+  Error er;
+  auto context = util::sharedContext(option, er);
+  if (er) { ec = er.code(); }
+  return context;
+}
+
+
+//----------------------------------------------------------------------------
+/// SSL is only negotiated over tcp.
+std::error_code noSSL()
+{
+  return std::error_code(EAFNOSUPPORT, std::generic_category());
+}
+
+
+//----------------------------------------------------------------------------
+/// The query, and its answer, that accepts a server for
+/// opt::TARGET_SESSION_ATTRS. The query is empty for any server.
+struct SessionCheck
+{
+  std::string query;
+  std::string accept;
+};
+
+std::error_code sessionCheck(const Option &option, SessionCheck &check)
+{
+  static const std::map<std::string, SessionCheck> attrs
+  {
+    {"read-write", {"SHOW transaction_read_only", "off"}},
+    {"read-only", {"SHOW transaction_read_only", "on"}},
+    {"primary", {"SELECT pg_catalog.pg_is_in_recovery()", "f"}},
+    {"standby", {"SELECT pg_catalog.pg_is_in_recovery()", "t"}}
+  };
+
+  auto it = option.find(opt::TARGET_SESSION_ATTRS);
+  if (it == option.end() || it->second == "any") { return {}; }
+
+  auto a = attrs.find(it->second);
+  if (a == attrs.end()) {
+    return std::error_code(EINVAL, std::generic_category());
+  }
+  check = a->second;
+  return {};
+}
+
+bool accepted(const SessionCheck &check, const RawResultSet &res)
+{
+  return res.size() == 1 && res[0] && res[0].size() == 1
+         && res[0].text(0, 0) == check.accept;
+}
+
+
 
 //////////////////////////////////////////////////////////////////////////////
-Connection::Connection(asio::io_service &ios) : m_ios(ios) {}
+/// Races connection attempts to the hosts of an Option. The names are
+/// resolved concurrently and the addresses are tried in the order they
+/// resolve. The next attempt starts when the last one failed or after
+/// opt::ATTEMPT_DELAY milliseconds (250 by default), whichever is first. The
+/// first connection to complete StartUp, and to pass
+/// opt::TARGET_SESSION_ATTRS, wins and the others are closed.
+class Race : public std::enable_shared_from_this<Race> {
+public:
+  using Handler = std::function<void(const std::error_code &,
+                                     std::shared_ptr<pv3::ConnectionBase>,
+                                     std::unique_ptr<pv3::FSM>)>;
+
+  Race(asio::io_service &ios, const Option &option,
+       asio::ssl::context *context, Handler &&h);
+
+  void start();
 
 //----------------------------------------------------------------------------
-std::error_code Connection::connect(const Option &option)
+private:
+  struct Candidate
+  {
+    std::string path;                   // unix-domain socket, or
+    asio::ip::tcp::endpoint ep;         // tcp if path is empty
+    std::string host;                   // the name ep resolved from
+  };
+
+  struct Attempt
+  {
+    std::shared_ptr<pv3::ConnectionBase> con;
+    std::unique_ptr<pv3::FSM> fsm;
+    RawResultSet res;                   // of the SessionCheck
+    bool done = false;                  // won, failed or lost
+    bool busy = false;                  // an FSM operation is outstanding
+  };
+
+  using Step = void (Race::*)(std::size_t, const std::error_code &);
+
+  void next();
+  void launch(const Candidate &c);
+  void resolved(const std::error_code &ec, const std::string &host,
+                const Endpoints &ep);
+  void connected(std::size_t i, const std::error_code &ec);
+  void checked(std::size_t i, const std::error_code &ec);
+  void closed(std::size_t i, const std::error_code &ec);
+  void win(std::size_t i);
+  void fail(std::size_t i, const std::error_code &ec);
+  void retire(std::size_t i, const std::error_code &ec);
+  void drop(std::size_t i);
+  void finish(const std::error_code &ec,
+              std::shared_ptr<pv3::ConnectionBase> con = nullptr,
+              std::unique_ptr<pv3::FSM> fsm = nullptr);
+  void arm();
+  void disarm();
+
+  /// The EHandler of the FSM of attempt i. The step runs after the FSM
+  /// returned, so that it may close or release the attempt. An attempt is
+  /// only released by the step of its last operation, whose handlers refer
+  /// to the FSM.
+  pv3::FSM::EHandler handler(std::size_t i, Step step)
+  {
+    return [self = shared_from_this(), i, step](const std::error_code &ec)
+    {
+      asio::post(self->m_ios, [self, i, step, ec]
+      {
+        ((*self).*step)(i, ec);
+      });
+    };
+  }
+
+  asio::io_service &m_ios;
+  Option m_option;
+  asio::ssl::context *m_context;        // nullptr without SSL
+  Handler m_handler;
+
+  SessionCheck m_check;
+  util::SocketOption m_so;
+  SSLMode m_sslmode;
+  SSLNegotiation m_negotiation;
+  bool m_ktls = false;                  // opt::SSLKTLS
+  std::chrono::milliseconds m_delay{250};
+  asio::steady_timer m_timer;
+  std::size_t m_timer_id = 0;           // of the current wait
+  bool m_armed = false;
+
+  std::vector<util::Address> m_address;
+  std::vector<Candidate> m_candidate;
+  std::size_t m_next = 0;               // next candidate to try
+  std::size_t m_resolving = 0;          // hosts not resolved yet
+  std::deque<Attempt> m_attempt;
+  std::size_t m_active = 0;             // attempts not done
+  bool m_done = false;                  // the handler was called
+  std::error_code m_error;              // of the last failure
+
+}; // Race
+
+
+//----------------------------------------------------------------------------
+Race::Race(asio::io_service &ios, const Option &option,
+           asio::ssl::context *context, Handler &&h)
+  : m_ios(ios), m_option(option), m_context(context),
+    m_handler(std::move(h)), m_timer(ios)
 {
-  std::error_code er;
-  std::string s{"/var/run/postgresql/.s.PGSQL.5432"};
-  auto ep = asio::local::stream_protocol::endpoint(s);
+  m_so = util::getSocketOption(option);
+  m_sslmode = util::getSSLMode(option);
+  m_negotiation = util::getSSLNegotiation(option);
 
-  m_con = std::make_unique<pv3::Connection>(m_ios, ep);
-  m_fsm = std::make_unique<pv3::FSM>(m_ios, *m_con);
+  auto ktls = option.find(opt::SSLKTLS);
+  m_ktls = (ktls != option.end() && ktls->second == "1");
 
-  m_fsm->connect(option, [&](const std::error_code &ec) { er = ec; });
-  return er;
+  auto it = option.find(opt::ATTEMPT_DELAY);
+  if (it != option.end()) {
+    m_delay = std::chrono::milliseconds(std::atoi(it->second.c_str()));
+  }
+}
+
+
+//----------------------------------------------------------------------------
+void Race::start()
+{
+  auto ec = sessionCheck(m_option, m_check);
+  if (!ec) {
+    ec = util::getAddresses(m_option, m_address, m_context != nullptr);
+  }
+  if (ec) { finish(ec); return; }
+
+  auto self = shared_from_this();
+  for (auto &addr : m_address)
+  {
+    if (!addr.local()) {
+      ++m_resolving;
+      asyncResolve(m_ios, addr, [self, host = addr.host]
+      (const std::error_code &ec, Endpoints ep)
+      {
+        self->resolved(ec, host, ep);
+      });
+    }
+    else if (m_context) { m_error = noSSL(); }
+    else { m_candidate.push_back({addr.path(), {}, {}}); }
+  }
+
+  next();
+}
+
+
+//----------------------------------------------------------------------------
+/// Start the next candidate, or fail if there are none left.
+void Race::next()
+{
+  if (m_done) { return; }
+
+  if (m_next < m_candidate.size()) {
+    launch(m_candidate[m_next++]);
+    arm();
+    return;
+  }
+
+  if (m_active == 0 && m_resolving == 0) {
+    finish(m_error ? m_error : asio::error::host_not_found);
+  }
+}
+
+
+//----------------------------------------------------------------------------
+void Race::launch(const Candidate &c)
+{
+  auto i = m_attempt.size();
+  auto &a = m_attempt.emplace_back();
+  ++m_active;
+
+  if (!c.path.empty()) {
+    auto ep = asio::local::stream_protocol::endpoint(c.path);
+    a.con = std::make_shared<pv3::AsyncConnection>(m_ios, ep, m_so);
+  }
+  else if (m_context && m_ktls) {
+    a.con = std::make_shared<pv3::KTLSAsyncConnection>(
+      m_ios, m_sslmode, *m_context, Endpoints{c.ep}, m_so, c.host,
+      m_negotiation);
+  }
+  else if (m_context) {
+    a.con = std::make_shared<pv3::SSLAsyncConnection>(
+      m_ios, m_sslmode, *m_context, Endpoints{c.ep}, m_so, c.host,
+      m_negotiation);
+  }
+  else {
+    a.con = std::make_shared<pv3::TCPAsyncConnection>(m_ios, Endpoints{c.ep},
+                                                      m_so);
+  }
+
+  a.fsm = std::make_unique<pv3::FSM>(m_ios, *a.con);
+  a.busy = true;
+  if (m_context) { a.fsm->connectSSL(m_option, handler(i, &Race::connected)); }
+  else { a.fsm->connect(m_option, handler(i, &Race::connected)); }
+}
+
+
+//----------------------------------------------------------------------------
+void Race::resolved(const std::error_code &ec, const std::string &host,
+                    const Endpoints &ep)
+{
+  --m_resolving;
+  if (ec) { m_error = ec; }
+  for (auto &e : ep) { m_candidate.push_back({{}, e, host}); }
+
+  // Nothing in flight or the delay is over, no need to wait.
+  if (m_active == 0 || !m_armed) { next(); }
+}
+
+
+//----------------------------------------------------------------------------
+void Race::connected(std::size_t i, const std::error_code &ec)
+{
+  auto &a = m_attempt[i];
+  a.busy = false;
+  if (a.done) { drop(i); return; }      // lost, its socket was closed
+  if (ec) { fail(i, ec); return; }
+
+  if (m_check.query.empty()) { win(i); return; }
+  a.busy = true;
+  a.fsm->exec(m_check.query, &a.res, handler(i, &Race::checked));
+}
+
+
+//----------------------------------------------------------------------------
+void Race::checked(std::size_t i, const std::error_code &ec)
+{
+  auto &a = m_attempt[i];
+  a.busy = false;
+  if (a.done) { drop(i); return; }
+  if (ec) { fail(i, ec); return; }
+  if (accepted(m_check, a.res)) { win(i); return; }
+
+  // A server of the wrong kind is told to Terminate.
+  retire(i, make_error_code(lapq::errc::session_attrs));
+  a.busy = true;
+  a.fsm->close(handler(i, &Race::closed));
+  next();
+}
+
+
+//----------------------------------------------------------------------------
+void Race::closed(std::size_t i, const std::error_code &)
+{
+  m_attempt[i].busy = false;
+  drop(i);
+}
+
+
+//----------------------------------------------------------------------------
+/// Attempt i won. The others are still connecting, closing their sockets
+/// aborts them and their steps release them.
+void Race::win(std::size_t i)
+{
+  retire(i, {});
+  for (std::size_t j = 0; j < m_attempt.size(); ++j)
+  {
+    auto &a = m_attempt[j];
+    if (a.done) { continue; }
+    retire(j, {});
+    a.con->close([](const std::error_code &) {});
+  }
+
+  // The FSM handler holds this Race, which holds the AsyncConnection.
+  auto &a = m_attempt[i];
+  a.fsm->release();
+  finish({}, std::move(a.con), std::move(a.fsm));
+}
+
+
+//----------------------------------------------------------------------------
+/// Attempt i failed in its own step, it has no operation outstanding.
+void Race::fail(std::size_t i, const std::error_code &ec)
+{
+  retire(i, ec);
+  m_attempt[i].con->close([](const std::error_code &) {});
+  drop(i);
+  next();
+}
+
+
+//----------------------------------------------------------------------------
+void Race::retire(std::size_t i, const std::error_code &ec)
+{
+  m_attempt[i].done = true;
+  --m_active;
+  if (ec) { m_error = ec; }
+}
+
+
+//----------------------------------------------------------------------------
+void Race::drop(std::size_t i)
+{
+  m_attempt[i].fsm.reset();
+  m_attempt[i].con.reset();
+}
+
+
+//----------------------------------------------------------------------------
+/// Call the handler once and let go of it, it holds the AsyncConnection.
+void Race::finish(const std::error_code &ec,
+                  std::shared_ptr<pv3::ConnectionBase> con,
+                  std::unique_ptr<pv3::FSM> fsm)
+{
+  m_done = true;
+  disarm();
+
+  auto h = std::move(m_handler);
+  m_handler = nullptr;
+  h(ec, std::move(con), std::move(fsm));
+}
+
+
+//----------------------------------------------------------------------------
+void Race::arm()
+{
+  m_armed = true;
+  m_timer.expires_after(m_delay);
+  m_timer.async_wait([self = shared_from_this(), id = ++m_timer_id]
+  (const std::error_code &ec)
+  {
+    if (ec || id != self->m_timer_id) { return; }
+    self->m_armed = false;
+    self->next();
+  });
+}
+
+
+//----------------------------------------------------------------------------
+void Race::disarm()
+{
+  ++m_timer_id;
+  m_armed = false;
+  m_timer.cancel();
+}
+
+
+//----------------------------------------------------------------------------
+/// The parameters of a connection that is not open.
+const pg::ServerParameters &noParameters()
+{
+  static const pg::ServerParameters none;
+  return none;
+}
+
+} // namespace
+
+
+
+//////////////////////////////////////////////////////////////////////////////
+Connection::Connection(asio::io_service &ios) : m_ios(ios) {}
+
+//----------------------------------------------------------------------------
+std::error_code Connection::connect(const Option &option)
+{
+  std::error_code ec;
+  m_context = sslContext(option, ec);
+  if (ec) { return ec; }
+  return open(option, m_context.get());
 }
 
 
@@ -38,14 +477,66 @@ std::error_code Connection::connect(const Option &option)
 std::error_code Connection::connect(const Option &option,
                                     asio::ssl::context &context)
 {
-  std::error_code er;
-  asio::ip::tcp::endpoint ep(asio::ip::make_address("127.0.0.1"), 5432);
+  return open(option, &context);
+}
+
+
+//----------------------------------------------------------------------------
+/// Try the hosts in order until one completes StartUp and passes
+/// opt::TARGET_SESSION_ATTRS.
+std::error_code Connection::open(const Option &option,
+                                 asio::ssl::context *context)
+{
+  SessionCheck check;
+  auto er = sessionCheck(option, check);
+  if (er) { return er; }
 
   auto sslmode = util::getSSLMode(option);
-  m_con = std::make_unique<pv3::SSLConnection>(m_ios, sslmode, context, ep);
-  m_fsm = std::make_unique<pv3::FSM>(m_ios, *m_con);
+  auto negotiation = util::getSSLNegotiation(option);
+  auto so = util::getSocketOption(option);
+  auto eh = [&er](const std::error_code &ec) { er = ec; };
+
+  std::vector<util::Address> address;
+  er = util::getAddresses(option, address, context != nullptr);
+  if (er) { return er; }
+
+  for (auto &addr : address)
+  {
+    m_fsm.reset();
+    if (addr.local()) {
+      if (context) { er = noSSL(); continue; }
+      auto ep = asio::local::stream_protocol::endpoint(addr.path());
+      m_con = std::make_unique<pv3::Connection>(m_ios, ep, so);
+    }
+    else {
+      Endpoints ep;
+      er = resolve(m_ios, addr, ep);
+      if (er) { continue; }
+
+      if (context) {
+        m_con = std::make_unique<pv3::SSLConnection>(m_ios, sslmode,
+                                                     *context, ep, so,
+                                                     addr.host, negotiation);
+      }
+      else { m_con = std::make_unique<pv3::TCPConnection>(m_ios, ep, so); }
+    }
+
+    m_fsm = std::make_unique<pv3::FSM>(m_ios, *m_con);
+    if (context) { m_fsm->connectSSL(option, eh); }
+    else { m_fsm->connect(option, eh); }
+
+    if (!er && !check.query.empty()) {
+      RawResultSet res;
+      m_fsm->exec(check.query, &res, eh);
+      if (!er && !accepted(check, res)) {
+        er = make_error_code(lapq::errc::session_attrs);
+      }
+    }
+    if (!er) { return er; }
+
+    m_fsm->close([](const std::error_code &) {});
+  }
 
-  m_fsm->connectSSL(option, [&](const std::error_code &ec) { er = ec; });
   return er;
 }
 
@@ -87,6 +578,14 @@ std::error_code Connection::close()
 
 
 
+//----------------------------------------------------------------------------
+const pg::ServerParameters &Connection::parameters() const
+{
+  return m_fsm ? m_fsm->parameters() : noParameters();
+}
+
+
+
 //////////////////////////////////////////////////////////////////////////////
 std::shared_ptr<AsyncConnection>
 AsyncConnection::create(asio::io_service &ios)
@@ -101,13 +600,10 @@ AsyncConnection::AsyncConnection(Private, asio::io_service &ios) : m_ios(ios) {}
 //----------------------------------------------------------------------------
 void AsyncConnection::connect(const Option &option, EHandler &&eh)
 {
-  std::string s{"/var/run/postgresql/.s.PGSQL.5432"};
-  auto ep = asio::local::stream_protocol::endpoint(s);
-
-  m_con = std::make_shared<pv3::AsyncConnection>(m_ios, ep);
-  m_fsm = std::make_unique<pv3::FSM>(m_ios, *m_con);
-
-  m_fsm->connect(option, std::move(eh));
+  std::error_code ec;
+  m_context = sslContext(option, ec);
+  if (ec) { eh(ec); return; }
+  open(option, m_context.get(), std::move(eh));
 }
 
 
@@ -117,13 +613,27 @@ void AsyncConnection::connect(const Option &option,
                               asio::ssl::context &context,
                               EHandler &&eh)
 {
-  asio::ip::tcp::endpoint ep(asio::ip::make_address("127.0.0.1"), 5432);
+  open(option, &context, std::move(eh));
+}
 
-  auto sslmode = util::getSSLMode(option);
-  m_con = std::make_shared<pv3::SSLAsyncConnection>(m_ios, sslmode, context, ep);
-  m_fsm = std::make_unique<pv3::FSM>(m_ios, *m_con);
 
-  m_fsm->connectSSL(option, std::move(eh));
+//----------------------------------------------------------------------------
+void AsyncConnection::open(const Option &option, asio::ssl::context *context,
+                           EHandler &&eh)
+{
+  auto race = std::make_shared<Race>(m_ios, option, context,
+  [self = shared_from_this(), ehandler = std::move(eh)]
+  (const std::error_code &ec, std::shared_ptr<pv3::ConnectionBase> con,
+   std::unique_ptr<pv3::FSM> fsm)
+  {
+    if (!ec) {
+      self->m_con = std::move(con);
+      self->m_fsm = std::move(fsm);
+    }
+    ehandler(ec);
+  });
+
+  race->start();
 }
 
 //----------------------------------------------------------------------------
@@ -144,5 +654,12 @@ void AsyncConnection::close(EHandler &&eh)
 }
 
 
+//----------------------------------------------------------------------------
+const pg::ServerParameters &AsyncConnection::parameters() const
+{
+  return m_fsm ? m_fsm->parameters() : noParameters();
+}
+
+
 //============================================================================
 } // namespace lapq
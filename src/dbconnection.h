@@ -22,6 +22,15 @@ namespace lapq {
 
 //////////////////////////////////////////////////////////////////////////////
 /// Blocking (synchronous) Connection.
+///
+/// opt::HOST may list several hosts, separated by commas, and opt::PORT one
+/// port for all or one per host. The hosts are tried in order until one
+/// accepts StartUp and opt::TARGET_SESSION_ATTRS, which is any (the
+/// default), read-write, read-only, primary or standby.
+///
+/// connect() without a context uses SSL if opt::SSLMODE is given, with the
+/// context of util::sharedContext(), so that connections with the same SSL
+/// options share the loaded certificates and resume each other's sessions.
 class Connection {
 public:
   Connection(asio::io_service &ios);
@@ -36,9 +45,15 @@ public:
   std::error_code prepare(DBQuery &q);
   std::error_code close();
 
+  /// The server's ParameterStatus values, e.g. server_version and DateStyle.
+  const pg::ServerParameters &parameters() const;
+
 //----------------------------------------------------------------------------
 private:
+  std::error_code open(const Option &option, asio::ssl::context *context);
+
   asio::io_service &m_ios;
+  std::shared_ptr<asio::ssl::context> m_context;  // of opt::SSLMODE
   std::unique_ptr<pv3::ConnectionBase> m_con;
   std::unique_ptr<pv3::FSM> m_fsm;
 
@@ -49,6 +64,11 @@ private:
 
 //////////////////////////////////////////////////////////////////////////////
 /// Asynchronous Connection.
+///
+/// With several hosts in opt::HOST the connection attempts are raced, a new
+/// attempt starting every opt::ATTEMPT_DELAY milliseconds or as soon as one
+/// fails. The first to complete StartUp and pass opt::TARGET_SESSION_ATTRS
+/// is kept. opt::SSLMODE without a context is handled as by Connection.
 class AsyncConnection : public std::enable_shared_from_this<AsyncConnection> {
 private: struct Private {};
 
@@ -64,10 +84,15 @@ public:
   void exec(const std::string &q, ResultBase &res, EHandler &&eh);
   void close(EHandler &&eh);
 
+  const pg::ServerParameters &parameters() const;
+
 
 private:
 //----------------------------------------------------------------------------
+  void open(const Option &option, asio::ssl::context *context, EHandler &&eh);
+
   asio::io_service &m_ios;
+  std::shared_ptr<asio::ssl::context> m_context;  // of opt::SSLMODE
   std::shared_ptr<pv3::ConnectionBase> m_con;
   std::unique_ptr<pv3::FSM> m_fsm;
 
@@ -0,0 +1,224 @@
+/// @file dbparallel.cpp
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <thread>
+
+#include "dbparallel.h"
+#include "protocol.h"
+
+namespace lapq {
+//=============================================================================
+
+namespace {
+
+//----------------------------------------------------------------------------
+ColumnSet failed(const std::string &code, const std::string &message)
+{
+  SQLError er;
+  er[SQLErrorField::CODE] = code;
+  er[SQLErrorField::MESSAGE] = message;
+  return ColumnSet(er);
+}
+
+ColumnSet malformed() { return failed("08P01", "malformed DataRow"); }
+
+//----------------------------------------------------------------------------
+/// A decoder that throws fails the statement with data_exception.
+ColumnSet undecodable(std::exception_ptr ep)
+{
+  try { std::rethrow_exception(ep); }
+  catch (const std::exception &e) { return failed("22000", e.what()); }
+  catch (...) {}
+  return failed("22000", "decoder failed");
+}
+
+
+//----------------------------------------------------------------------------
+/// Decode the rows of a batch, runs on the pool.
+ColumnSet decodeBatch(const std::vector<char> &data,
+                      const std::vector<std::size_t> &end,
+                      const std::vector<pg::FieldSpec> &fs,
+                      const std::vector<std::string> &dict)
+{
+  ColumnSet cs(fs, dict);
+
+  std::size_t start = 0;
+  int num, sz;
+  std::span<const char> col;
+  for (auto e : end)
+  {
+    pv3::Reader rd(std::span<const char>(data.data() + start, e - start));
+    start = e;
+
+    if (!rd.int16(num) || std::size_t(num) != fs.size()) { return malformed(); }
+
+    cs.add_row();
+    for (int i = 0; i < num; ++i)
+    {
+      if (!rd.int32(sz) || (sz >= 0 && !rd.bytes(sz, col))) {
+        return malformed();
+      }
+      cs.add_column(i, sz < 0 ? nullptr : col.data(), sz < 0 ? -1 : sz);
+    }
+  }
+
+  return cs;
+}
+
+} // namespace
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+ParallelColumnResult::ParallelColumnResult(asio::thread_pool &pool,
+                                           size_type batch_rows)
+  : m_pool(pool), m_batch_rows(std::max<size_type>(1, batch_rows)),
+    m_max_pending(2 * std::max(1u, std::thread::hardware_concurrency()))
+{}
+
+
+//----------------------------------------------------------------------------
+ParallelColumnResult::~ParallelColumnResult()
+{
+  for (auto &f : m_pending) { f.wait(); }
+}
+
+
+//----------------------------------------------------------------------------
+void ParallelColumnResult::add_result(const std::vector<pg::FieldSpec> &fs)
+{
+  finish();
+  m_set.emplace_back(fs, m_dictionary);
+  m_field_spec = std::make_shared<const std::vector<pg::FieldSpec>>(fs);
+  m_dict = std::make_shared<const std::vector<std::string>>(m_dictionary);
+}
+
+
+//----------------------------------------------------------------------------
+void ParallelColumnResult::add_result(const SQLError &e)
+{
+  finish();
+  m_set.emplace_back(e);
+  m_field_spec.reset();
+}
+
+
+//----------------------------------------------------------------------------
+bool ParallelColumnResult::add_raw_row(std::span<const char> body)
+{
+  if (!m_field_spec) { return false; }
+
+  m_batch.data.insert(m_batch.data.end(), body.begin(), body.end());
+  m_batch.end.push_back(m_batch.data.size());
+
+  if (m_batch.end.size() >= m_batch_rows) { flush(); }
+  stitchReady();
+  return true;
+}
+
+
+//----------------------------------------------------------------------------
+void ParallelColumnResult::end_result() { finish(); }
+
+
+//----------------------------------------------------------------------------
+// Only reached if the protocol layer does not pass the raw row, the rows are
+// then decoded in place after the batches in flight.
+void ParallelColumnResult::add_row()
+{
+  if (m_set.empty()) { return; }
+  finish();
+  if (m_set.back()) { m_set.back().add_row(); }
+}
+
+
+//----------------------------------------------------------------------------
+void ParallelColumnResult::add_column(int i, const char *buf, int sz)
+{
+  if (m_set.empty() || !m_set.back()) { return; }
+  try {
+    m_set.back().add_column(i, buf, sz);
+  }
+  catch (...) {
+    m_set.back() = undecodable(std::current_exception());
+  }
+}
+
+
+//----------------------------------------------------------------------------
+void ParallelColumnResult::flush()
+{
+  if (m_batch.end.empty()) { return; }
+
+  // Too far ahead of the pool, wait for the oldest batch.
+  if (m_pending.size() >= m_max_pending) {
+    auto f = std::move(m_pending.front());
+    m_pending.pop_front();
+    stitch(f.get());
+  }
+
+  std::promise<ColumnSet> done;
+  m_pending.push_back(done.get_future());
+
+  auto n = m_batch.data.size();
+  asio::post(m_pool,
+    [batch = std::move(m_batch), fs = m_field_spec, dict = m_dict,
+     done = std::move(done)]() mutable
+    {
+      try {
+        done.set_value(decodeBatch(batch.data, batch.end, *fs, *dict));
+      }
+      catch (...) {
+        done.set_value(undecodable(std::current_exception()));
+      }
+    });
+
+  m_batch = Batch{};
+  m_batch.data.reserve(n);
+  m_batch.end.reserve(m_batch_rows);
+}
+
+
+//----------------------------------------------------------------------------
+void ParallelColumnResult::stitch(ColumnSet chunk)
+{
+  auto &set = m_set.back();
+  if (!set) { return; }
+
+  if (!chunk) { set = std::move(chunk); }
+  else if (set.empty()) { set = std::move(chunk); }
+  else { set.extend(chunk); }
+}
+
+
+//----------------------------------------------------------------------------
+void ParallelColumnResult::stitchReady()
+{
+  using namespace std::chrono_literals;
+  while (!m_pending.empty()
+         && m_pending.front().wait_for(0s) == std::future_status::ready)
+  {
+    auto f = std::move(m_pending.front());
+    m_pending.pop_front();
+    stitch(f.get());
+  }
+}
+
+
+//----------------------------------------------------------------------------
+void ParallelColumnResult::finish()
+{
+  flush();
+  while (!m_pending.empty())
+  {
+    auto f = std::move(m_pending.front());
+    m_pending.pop_front();
+    stitch(f.get());
+  }
+}
+
+
+//=============================================================================
+} // namespace lapq
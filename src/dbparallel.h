@@ -0,0 +1,112 @@
+/// @file dbparallel.h
+
+#ifndef LAPQ_DBPARALLEL_H
+#define LAPQ_DBPARALLEL_H
+
+#include <deque>
+#include <future>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "asio.hpp"
+
+#include "error.h"
+#include "pgformat.h"
+#include "dbresult.h"
+#include "dbcolumn.h"
+
+namespace lapq {
+//=============================================================================
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// A ResultBase that moves decoding off the I/O thread. DataRow bodies are
+/// copied into batches of batch_rows rows and each batch is decoded into a
+/// ColumnSet chunk on the pool. The chunks are appended to the result in the
+/// order of the rows, as they complete and at the latest when the statement
+/// completes.
+///
+/// The result is a ColumnSet per statement, as with ColumnResultSet. A
+/// malformed DataRow fails the statement with SQLSTATE 08P01
+/// (protocol_violation) and an exception thrown by a decoder with 22000
+/// (data_exception), nothing is thrown into the I/O thread.
+///
+/// The I/O thread waits for the pool when too many batches are in flight and
+/// when a statement completes, so the pool must not be the thread that runs
+/// the io_context of the connection.
+class ParallelColumnResult : public ResultBase {
+public:
+  using value_type = ColumnSet;
+  using vector_type = std::vector<value_type>;
+  using size_type = vector_type::size_type;
+  using reference = vector_type::reference;
+  using const_reference = vector_type::const_reference;
+
+  explicit ParallelColumnResult(asio::thread_pool &pool,
+                                size_type batch_rows = 4096);
+  ParallelColumnResult(const ParallelColumnResult &) = delete;
+  ParallelColumnResult &operator=(const ParallelColumnResult &) = delete;
+  ~ParallelColumnResult();
+
+  explicit operator bool() const
+  {
+    if (m_set.empty()) { return false; }
+    return m_set[0].operator bool();
+  }
+
+  //------------------------------------------------------------------------
+  void add_result(const std::vector<pg::FieldSpec> &fs) override;
+  void add_result(const SQLError &e) override;
+
+  bool add_raw_row(std::span<const char> body) override;
+  void end_result() override;
+
+  void add_row() override;
+  void add_column(int i, const char *buf, int sz) override;
+
+  //------------------------------------------------------------------------
+  size_type size() const { return m_set.size(); }
+
+  reference operator[](size_type pos) { return m_set[pos]; }
+  const_reference operator[](size_type pos) const { return m_set[pos]; }
+
+  /// Store the text columns with this name in dictionary mode, in the sets
+  /// added after the call.
+  void dictionary(const std::string &col) { m_dictionary.push_back(col); }
+
+  /// Decode the rows still in flight and append them. Called on
+  /// CommandComplete, call it before reading a result that did not complete.
+  void finish();
+
+//----------------------------------------------------------------------------
+private:
+  struct Batch
+  {
+    std::vector<char> data;         // DataRow bodies back to back
+    std::vector<std::size_t> end;   // end of each body in data
+  };
+
+  void flush();
+  void stitch(ColumnSet chunk);
+  void stitchReady();
+
+  asio::thread_pool &m_pool;
+  size_type m_batch_rows;
+  size_type m_max_pending;
+
+  vector_type m_set;
+  std::shared_ptr<const std::vector<pg::FieldSpec>> m_field_spec;
+  std::shared_ptr<const std::vector<std::string>> m_dict;
+  std::vector<std::string> m_dictionary;
+
+  Batch m_batch;
+  std::deque<std::future<ColumnSet>> m_pending;   // in row order
+
+}; // ParallelColumnResult
+
+
+//=============================================================================
+} // namespace lapq
+#endif
@@ -5,8 +5,12 @@
 #define LAPQ_QUERY_H
 
 #include <string>
+#include <string_view>
 #include <vector>
+#include <span>
 #include <sstream>
+#include <charconv>
+#include <type_traits>
 
 #include "error.h"
 
@@ -32,22 +36,55 @@ public:
   const std::string &name() const { return m_name; }
   const std::string &portal() const { return m_portal; }
 
-  const std::vector<std::string> &bind_value() const { return m_bind; }
+  std::span<const std::string> bind_value() const
+  {
+    return std::span<const std::string>(m_bind.data(), m_nbind);
+  }
 
+  /// Bind the next parameter. Numbers are formatted with std::to_chars and
+  /// strings copied, into the storage of a previous value if there is one.
+  /// A char is bound as the character, as std::ostream writes it.
   template<typename T>
   void bind(const T &t)
   {
-    std::ostringstream os;
-    os << t;
-    m_bind.emplace_back(os.str());
+    auto &s = next();
+    if constexpr (std::is_same_v<T, char> || std::is_same_v<T, signed char>
+                  || std::is_same_v<T, unsigned char>)
+    {
+      s.assign(1, static_cast<char>(t));
+    }
+    else if constexpr (std::is_arithmetic_v<T> && !std::is_same_v<T, bool>) {
+      char buf[64];
+      auto r = std::to_chars(buf, buf + sizeof(buf), t);
+      s.assign(buf, r.ptr);
+    }
+    else if constexpr (std::is_convertible_v<const T &, std::string_view>) {
+      s.assign(std::string_view(t));
+    }
+    else {
+      std::ostringstream os;
+      os << t;
+      s.assign(os.str());
+    }
   }
 
+  /// Bind again from the first parameter, for the next execution of the
+  /// same statement. The previous values keep their storage.
+  void reset() { m_nbind = 0; }
+
 private:
+  std::string &next()
+  {
+    if (m_nbind == m_bind.size()) { m_bind.emplace_back(); }
+    return m_bind[m_nbind++];
+  }
+
   std::string m_query;
   std::string m_name;             // name of destination prepared statement
   std::string m_portal;           // name of destination portal
 
-  std::vector<std::string> m_bind;
+  std::vector<std::string> m_bind;  // values past m_nbind are kept for reuse
+  std::size_t m_nbind = 0;
 
 }; // DBQuery
 
@@ -0,0 +1,118 @@
+/// @file dbraw.cpp
+
+#include "dbraw.h"
+#include "protocol.h"
+
+namespace lapq {
+//=============================================================================
+
+namespace {
+
+void appendInt(std::vector<char> &buf, std::uint32_t v, int n)
+{
+  while (n--) { buf.push_back(static_cast<char>(v >> (8 * n))); }
+}
+
+} // namespace
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+RawSet::RawSet(const std::vector<pg::FieldSpec> &fs, const pg::PGFormat &pgf,
+               const pg::ServerParameters *sp)
+  : m_field_spec{fs}, m_pgformat(&pgf)
+{
+  m_decoder.reserve(fs.size());
+  for (auto &f : fs) { m_decoder.push_back(pgf.decoder(f, sp)); }
+}
+
+
+//----------------------------------------------------------------------------
+RawSet::RawSet(const SQLError &er, const pg::PGFormat &pgf)
+  : m_error(er), m_pgformat(&pgf)
+{}
+
+
+//----------------------------------------------------------------------------
+std::any RawSet::decode(size_type row, size_type col) const
+{
+  auto &c = cell(row, col);
+  if (c.sz < 0) { return {}; }
+
+  auto buf = m_row[row] + c.offset;
+  if (auto f = m_decoder[col]) { return (*f)(buf, c.sz); }
+  return m_pgformat->decode(m_field_spec[col], buf, c.sz);
+}
+
+
+//----------------------------------------------------------------------------
+bool RawSet::index(std::span<const char> body)
+{
+  pv3::Reader rd(body);
+
+  int num;
+  if (!rd.int16(num) || size_type(num) != column_count()) { return false; }
+
+  auto start = m_cell.size();
+  int sz;
+  std::span<const char> col;
+  for (int i = 0; i < num; ++i)
+  {
+    if (!rd.int32(sz) || (sz >= 0 && !rd.bytes(sz, col)))
+    {
+      m_cell.resize(start);
+      return false;
+    }
+
+    auto offset = (sz < 0) ? 0 : col.data() - body.data();
+    m_cell.push_back({static_cast<std::uint32_t>(offset), sz < 0 ? -1 : sz});
+  }
+
+  return true;
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+bool RawResultSet::add_raw_row(std::span<const char> body)
+{
+  if (m_set.empty() || !m_set.back().index(body)) { return false; }
+
+  auto row = static_cast<char *>(m_arena.allocate(body.size(), 1));
+  std::memcpy(row, body.data(), body.size());
+  m_set.back().add_row(row);
+  return true;
+}
+
+
+//----------------------------------------------------------------------------
+void RawResultSet::add_row()
+{
+  m_pending.clear();
+  appendInt(m_pending, m_set.back().column_count(), 2);
+}
+
+
+//----------------------------------------------------------------------------
+void RawResultSet::add_column(int i, const char *buf, int sz)
+{
+  appendInt(m_pending, static_cast<std::uint32_t>(sz), 4);
+  if (sz > 0) { m_pending.insert(m_pending.end(), buf, buf + sz); }
+
+  // The row is complete with its last column.
+  if (size_type(i) + 1 == m_set.back().column_count()) {
+    add_raw_row(m_pending);
+  }
+}
+
+
+//----------------------------------------------------------------------------
+void RawResultSet::clear()
+{
+  m_set.clear();
+  m_arena.release();
+}
+
+
+//=============================================================================
+} // namespace lapq
@@ -0,0 +1,196 @@
+/// @file dbraw.h
+
+#ifndef LAPQ_DBRAW_H
+#define LAPQ_DBRAW_H
+
+#include <cstdint>
+#include <vector>
+#include <span>
+#include <string>
+#include <string_view>
+#include <memory_resource>
+
+#include "error.h"
+#include "pgformat.h"
+#include "dbresult.h"
+
+namespace lapq {
+//=============================================================================
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// The undecoded rows returned by one statement. Each row points to a copy of
+/// the DataRow body in the arena of the owning RawResultSet. Cells are only
+/// decoded when they are read.
+class RawSet {
+public:
+  using size_type = std::size_t;
+
+  RawSet(const std::vector<pg::FieldSpec> &fs, const pg::PGFormat &pgf,
+         const pg::ServerParameters *sp = nullptr);
+  RawSet(const SQLError &er, const pg::PGFormat &pgf);
+
+  //------------------------------------------------------------------------
+  const std::vector<pg::FieldSpec> &field_spec() const { return m_field_spec; }
+  const SQLError &error() const { return m_error; }
+
+  explicit operator bool() const { return !m_error.operator bool(); }
+
+  /// Number of rows.
+  size_type size() const { return m_row.size(); }
+  bool empty() const { return m_row.empty(); }
+
+  size_type column_count() const { return m_field_spec.size(); }
+
+  //------------------------------------------------------------------------
+  bool is_null(size_type row, size_type col) const
+  {
+    return cell(row, col).sz < 0;
+  }
+
+  /// The undecoded text of a cell, NULL is empty.
+  std::string_view text(size_type row, size_type col) const
+  {
+    auto &c = cell(row, col);
+    if (c.sz < 0) { return {}; }
+    return std::string_view(m_row[row] + c.offset, c.sz);
+  }
+
+  /// Decode a cell with the decoder for its column. As with Record, reading
+  /// a NULL throws std::bad_any_cast.
+  template <typename T> T get(size_type row, size_type col) const
+  {
+    return std::any_cast<T>(decode(row, col));
+  }
+
+  template <typename T> T get(size_type row, ColumnHandle col) const
+  {
+    return get<T>(row, col.index());
+  }
+
+  template <typename T> T get(size_type row, const std::string &col) const
+  {
+    return get<T>(row, m_field_index.at(m_field_spec, col));
+  }
+
+  /// Resolve a column name, throws std::out_of_range if there is none.
+  ColumnHandle handle(std::string_view col) const
+  {
+    return ColumnHandle(m_field_index.at(m_field_spec, col));
+  }
+
+  std::any decode(size_type row, size_type col) const;
+
+  /// Decode a whole column with pg::Decoder<T> in one loop, NULL is T{}.
+  template <typename T> std::vector<T> column(size_type col) const
+  {
+    std::vector<pg::TextCell> cells;
+    cells.reserve(size());
+    for (size_type row = 0; row < size(); ++row)
+    {
+      auto &c = cell(row, col);
+      cells.push_back({m_row[row] + c.offset, c.sz});
+    }
+
+    std::vector<T> out(size());
+    pg::decodeColumn<T>(cells, out.data());
+    return out;
+  }
+
+  //------------------------------------------------------------------------
+  /// Record the cells of a DataRow body, false if it is malformed.
+  bool index(std::span<const char> body);
+  void add_row(const char *row) { m_row.push_back(row); }
+
+//----------------------------------------------------------------------------
+private:
+  struct Cell
+  {
+    std::uint32_t offset;       // from the start of the row
+    std::int32_t sz;            // -1 for NULL
+  };
+
+  const Cell &cell(size_type row, size_type col) const
+  {
+    return m_cell[row * column_count() + col];
+  }
+
+  std::vector<pg::FieldSpec> m_field_spec;
+  FieldIndex m_field_index;
+  std::vector<const char *> m_row;
+  std::vector<Cell> m_cell;
+  SQLError m_error;
+  const pg::PGFormat *m_pgformat;
+  std::vector<const pg::PGFormat::decode_function *> m_decoder;
+
+}; // RawSet
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// A ResultBase that copies each DataRow body once into a chunked arena and
+/// records the offset and length of every cell. Rows that are never read are
+/// never decoded and all row storage is released at once.
+class RawResultSet : public ResultBase {
+public:
+  using value_type = RawSet;
+  using vector_type = std::vector<value_type>;
+  using size_type = vector_type::size_type;
+  using reference = vector_type::reference;
+  using const_reference = vector_type::const_reference;
+
+  /// The arena takes its chunks from mr.
+  RawResultSet(const pg::PGFormat &pgf = m_PGFormatDefault,
+               std::pmr::memory_resource *mr = std::pmr::get_default_resource())
+    : m_pgformat(pgf), m_arena(mr) {}
+
+  explicit RawResultSet(std::pmr::memory_resource *mr)
+    : RawResultSet(m_PGFormatDefault, mr) {}
+
+  RawResultSet(const RawResultSet &) = delete;
+  RawResultSet &operator=(const RawResultSet &) = delete;
+
+  explicit operator bool() const
+  {
+    if (m_set.empty()) { return false; }
+    return m_set[0].operator bool();
+  }
+
+  //------------------------------------------------------------------------
+  void add_result(const std::vector<pg::FieldSpec> &fs) override
+  {
+    m_set.emplace_back(fs, m_pgformat, parameters());
+  }
+
+  void add_result(const SQLError &e) override
+  {
+    m_set.emplace_back(e, m_pgformat);
+  }
+
+  bool add_raw_row(std::span<const char> body) override;
+
+  void add_row() override;
+  void add_column(int i, const char *buf, int sz) override;
+
+  //------------------------------------------------------------------------
+  size_type size() const { return m_set.size(); }
+
+  reference operator[](size_type pos) { return m_set[pos]; }
+  const_reference operator[](size_type pos) const { return m_set[pos]; }
+
+  /// Drop all results and release the arena.
+  void clear();
+
+//----------------------------------------------------------------------------
+private:
+  vector_type m_set;
+  const pg::PGFormat &m_pgformat;
+  std::pmr::monotonic_buffer_resource m_arena;
+  std::vector<char> m_pending;   // DataRow body built by add_column()
+
+}; // RawResultSet
+
+
+//=============================================================================
+} // namespace lapq
+#endif
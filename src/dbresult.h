@@ -11,6 +11,12 @@
 #include <initializer_list>
 #include <any>
 #include <functional>
+#include <span>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cassert>
 
 #include "util.h"
 #include "pgformat.h"
@@ -22,9 +28,96 @@ extern const pg::PGFormat m_PGFormatDefault;
 
 
 ///////////////////////////////////////////////////////////////////////////////
-/// A row of columns.
-class Record : public std::vector<std::any> {
+/// Maps column names to positions with a flat open addressed hash table. The
+/// table is built on the first lookup, so results that are only read by
+/// position never pay for it. If names repeat the first column wins.
+class FieldIndex {
 public:
+  using size_type = std::size_t;
+  static constexpr size_type npos = size_type(-1);
+
+  /// The position of name in fs, npos if there is none.
+  size_type find(const std::vector<pg::FieldSpec> &fs,
+                 std::string_view name) const
+  {
+    if (m_slot.empty()) { build(fs); }
+
+    auto mask = m_slot.size() - 1;
+    for (auto i = hash(name) & mask; ; i = (i + 1) & mask)
+    {
+      auto s = m_slot[i];
+      if (s == 0) { return npos; }
+      if (fs[s - 1].name == name) { return s - 1; }
+    }
+  }
+
+  /// As find() but throws std::out_of_range if there is no such column.
+  size_type at(const std::vector<pg::FieldSpec> &fs,
+               std::string_view name) const
+  {
+    auto i = find(fs, name);
+    if (i == npos) { throw std::out_of_range(std::string(name)); }
+    return i;
+  }
+
+  void clear() { m_slot.clear(); }
+
+//----------------------------------------------------------------------------
+private:
+  static size_type hash(std::string_view s)
+  {
+    return std::hash<std::string_view>{}(s);
+  }
+
+  void build(const std::vector<pg::FieldSpec> &fs) const
+  {
+    size_type n = 2;
+    while (n < 2 * fs.size()) { n *= 2; }
+    m_slot.assign(n, 0);
+
+    for (size_type c = 0; c < fs.size(); ++c)
+    {
+      auto i = hash(fs[c].name) & (n - 1);
+      while (m_slot[i] && fs[m_slot[i] - 1].name != fs[c].name)
+      {
+        i = (i + 1) & (n - 1);
+      }
+      if (!m_slot[i]) { m_slot[i] = static_cast<std::uint32_t>(c + 1); }
+    }
+  }
+
+  mutable std::vector<std::uint32_t> m_slot;    // 1 + position, 0 is empty
+
+}; // FieldIndex
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// A column resolved by name once, for example before a loop over the rows
+/// or once per prepared statement, and then used as a position.
+class ColumnHandle {
+public:
+  using size_type = FieldIndex::size_type;
+
+  ColumnHandle() = default;
+  explicit ColumnHandle(size_type index) : m_index(index) {}
+
+  size_type index() const { return m_index; }
+  explicit operator bool() const { return m_index != FieldIndex::npos; }
+
+private:
+  size_type m_index = FieldIndex::npos;
+
+}; // ColumnHandle
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// A row of columns. The column vector takes a std::pmr::memory_resource,
+/// which RecordSet passes on from its own.
+class Record : public std::pmr::vector<std::any> {
+public:
+  using std::pmr::vector<std::any>::vector;
+
   template <typename T> T get(size_type pos) const
   {
     return std::any_cast<T>(operator[](pos));
@@ -40,32 +133,64 @@ template<typename R = Record>
 class RecordSet {
 public:
   using value_type = R;
-  using vector_type = std::vector<value_type>;
+  using vector_type = std::pmr::vector<value_type>;
   using size_type = typename vector_type::size_type;
   using iterator = typename vector_type::iterator;
   using const_iterator = typename vector_type::const_iterator;
   using reference = typename vector_type::reference;
   using const_reference = typename vector_type::const_reference;
 
+  using format_type = pg::PGFormatType<typename R::value_type>;
+  using decode_function = typename format_type::decode_function;
+
   RecordSet() = default;
 
   //------------------------------------------------------------------------
-  RecordSet(const std::vector<pg::FieldSpec> &fs)
-    : m_field_spec{fs}
-  {
-    for (size_type i = 0; i < fs.size(); ++i)
-    {
-      m_field_by_name.emplace(fs[i].name, i);
-    }
-  }
+  /// The rows are allocated from mr.
+  RecordSet(const std::vector<pg::FieldSpec> &fs,
+            std::pmr::memory_resource *mr = std::pmr::get_default_resource())
+    : m_field_spec{fs}, m_row(mr) {}
 
 
   //------------------------------------------------------------------------
-  RecordSet(const SQLError &er) : m_error(er) {};
+  RecordSet(const SQLError &er,
+            std::pmr::memory_resource *mr = std::pmr::get_default_resource())
+    : m_row(mr), m_error(er) {};
+
+  //------------------------------------------------------------------------
+  /// Start over with a new field spec. The rows, the field spec and the
+  /// decoder table keep their storage, as do the Records, which are reused
+  /// by emplace_back().
+  void reset(const std::vector<pg::FieldSpec> &fs)
+  {
+    m_field_spec = fs;                // assigns in place
+    m_field_index.clear();
+    m_error = SQLError();
+    m_size = 0;
+  }
+
+  void reset(const SQLError &er)
+  {
+    m_field_spec.clear();
+    m_field_index.clear();
+    m_decoder.clear();
+    m_error = er;
+    m_size = 0;
+  }
 
   //------------------------------------------------------------------------
   virtual ~RecordSet() {}
 
+  // Moves keep the memory resource of the rows. A copy allocates from the
+  // same resource; a defaulted copy would fall back to the default one.
+  RecordSet(const RecordSet &o)
+    : m_field_spec(o.m_field_spec), m_field_index(o.m_field_index),
+      m_row(o.m_row, o.m_row.get_allocator().resource()), m_size(o.m_size),
+      m_error(o.m_error), m_decoder(o.m_decoder) {}
+  RecordSet(RecordSet &&) = default;
+  RecordSet &operator=(const RecordSet &) = default;
+  RecordSet &operator=(RecordSet &&) = default;
+
   //------------------------------------------------------------------------
   const std::vector<pg::FieldSpec> &field_spec() const { return m_field_spec; }
   const SQLError &error() const { return m_error; }
@@ -73,35 +198,66 @@ public:
   explicit operator bool() const { return !m_error.operator bool(); }
 
   //------------------------------------------------------------------------
-  size_type size() const { return m_row.size(); }
-  bool empty() const { return m_row.empty(); }
+  size_type size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
 
   iterator begin() { return m_row.begin(); }
   const_iterator begin() const { return m_row.begin(); }
   const_iterator cbegin() const { return m_row.cbegin(); }
 
-  iterator end() { return m_row.end(); }
-  const_iterator end() const { return m_row.end(); }
-  const_iterator cend() const { return m_row.cend(); }
+  iterator end() { return m_row.begin() + m_size; }
+  const_iterator end() const { return m_row.begin() + m_size; }
+  const_iterator cend() const { return m_row.cbegin() + m_size; }
 
   //------------------------------------------------------------------------
-  reference front() { return m_row.front(); }
-  const_reference front() const { return m_row.front(); }
+  /// The rows in [begin(), end()), without those kept for reuse. An empty
+  /// set has no front() or back(), as there is no operator[] past size().
+  reference front() { assert(m_size > 0); return m_row[0]; }
+  const_reference front() const { assert(m_size > 0); return m_row[0]; }
 
-  reference back() { return m_row.back(); }
-  const_reference back() const {return m_row.back(); }
+  reference back() { assert(m_size > 0); return m_row[m_size - 1]; }
+  const_reference back() const { assert(m_size > 0); return m_row[m_size - 1]; }
 
   //------------------------------------------------------------------------
   void clear() {
-    m_field_spec.clear();  m_field_by_name.clear(); m_row.clear();
+    m_field_spec.clear();  m_field_index.clear(); m_row.clear();
+    m_decoder.clear(); m_size = 0;
+  }
+
+  //------------------------------------------------------------------------
+  /// Look up the decoder of each column once, with the server's parameters
+  /// if known.
+  void resolve(const format_type &pgf,
+               const pg::ServerParameters *sp = nullptr)
+  {
+    m_decoder.clear();
+    m_decoder.reserve(m_field_spec.size());
+    for (auto &fs : m_field_spec) { m_decoder.push_back(pgf.decoder(fs, sp)); }
+  }
+
+  /// The decoder of a column, nullptr if there is none.
+  const decode_function *decoder(size_type col) const
+  {
+    return (col < m_decoder.size()) ? m_decoder[col] : nullptr;
   }
 
-  void push_back(const value_type &value) { return m_row.push_back(value); }
-  void push_back(value_type &&value) { return m_row.push_back(value); }
+  void push_back(const value_type &value) { emplace_back(value); }
+  void push_back(value_type &&value) { emplace_back(std::move(value)); }
 
+  /// Without arguments a row left over from before reset() is cleared and
+  /// reused.
   template <typename... Args>
   void emplace_back(Args&&... args) {
-    m_row.emplace_back(std::forward<Args>(args)...);
+    if (m_size == m_row.size()) {
+      m_row.emplace_back(std::forward<Args>(args)...);
+    }
+    else if constexpr (sizeof...(Args) == 0) {
+      m_row[m_size].clear();
+    }
+    else {
+      m_row[m_size] = value_type(std::forward<Args>(args)...);
+    }
+    ++m_size;
   }
 
   //------------------------------------------------------------------------
@@ -113,16 +269,29 @@ public:
     return m_row[row].template get<T>(col);
   }
 
+  template <typename T> T get(size_type row, ColumnHandle col) const
+  {
+    return get<T>(row, col.index());
+  }
+
   template <typename T> T get(size_type row, const std::string &col) const
   {
-    return get<T>(row, m_field_by_name.at(col));
+    return get<T>(row, m_field_index.at(m_field_spec, col));
+  }
+
+  /// Resolve a column name, throws std::out_of_range if there is none.
+  ColumnHandle handle(std::string_view col) const
+  {
+    return ColumnHandle(m_field_index.at(m_field_spec, col));
   }
 
 private:
   std::vector<pg::FieldSpec> m_field_spec;
-  std::map<std::string, size_type> m_field_by_name;
-  vector_type m_row;
+  FieldIndex m_field_index;
+  vector_type m_row;                // rows past m_size are kept for reuse
+  size_type m_size = 0;
   SQLError m_error;
+  std::vector<const decode_function *> m_decoder;
 
 }; // RecordSet
 
@@ -137,9 +306,54 @@ public:
   virtual void add_result(const SQLError &e) = 0;
 
   virtual void add_row() = 0;
+
+  /// Column i of the current row, sz is -1 for NULL.
   virtual void add_column(int i, const char *buf, int sz) = 0;
 
-  
+  /// The undecoded body of a DataRow. Return true if the row was consumed,
+  /// otherwise it is passed on with add_row() and add_column().
+  virtual bool add_raw_row(std::span<const char> body) { return false; }
+
+  /// The statement of the current result completed (CommandComplete).
+  virtual void end_result() {}
+
+  //------------------------------------------------------------------------
+  /// Limit the DataRow bytes (as received) and rows of each exec. Once
+  /// exceeded the query is cancelled, the remaining rows are dropped and
+  /// exec() fails with errc::budget_exceeded.
+  void budget(std::size_t bytes, std::size_t rows = SIZE_MAX)
+  {
+    m_budget_bytes = bytes;
+    m_budget_rows = rows;
+  }
+
+  /// Count a DataRow of sz bytes, false if the budget is exceeded.
+  bool charge(std::size_t sz)
+  {
+    m_used_bytes += sz;
+    ++m_used_rows;
+    return m_used_bytes <= m_budget_bytes && m_used_rows <= m_budget_rows;
+  }
+
+  /// Start counting for a new exec.
+  void reset_budget() { m_used_bytes = m_used_rows = 0; }
+
+  std::size_t used_bytes() const { return m_used_bytes; }
+  std::size_t used_rows() const { return m_used_rows; }
+
+  //------------------------------------------------------------------------
+  /// The ParameterStatus values of the connection running the exec, for
+  /// picking decoders in add_result(). They follow a SET in the same exec.
+  const pg::ServerParameters *parameters() const { return m_parameters; }
+  void parameters(const pg::ServerParameters *sp) { m_parameters = sp; }
+
+private:
+  const pg::ServerParameters *m_parameters = nullptr;
+  std::size_t m_budget_bytes = SIZE_MAX;
+  std::size_t m_budget_rows = SIZE_MAX;
+  std::size_t m_used_bytes = 0;
+  std::size_t m_used_rows = 0;
+
 }; // ResultBase
 
 
@@ -150,38 +364,70 @@ template<typename R = Record>
 class ResultSetType : public ResultBase {
 public:
   using value_type = RecordSet<R>;
-  using vector_type = typename std::vector<value_type>;
+  using vector_type = typename std::pmr::vector<value_type>;
   using size_type = typename vector_type::size_type;
   using reference = typename vector_type::reference;
   using const_reference = typename vector_type::const_reference;
 
   using record_value_type = typename R::value_type;
 
-  ResultSetType<R>(const pg::PGFormatType<record_value_type> &pgf = m_PGFormatDefault)
-    : m_pgformat(pgf) {}
+  /// The RecordSets and their rows are allocated from mr, for example a
+  /// std::pmr::monotonic_buffer_resource that is released with the request.
+  ResultSetType(const pg::PGFormatType<record_value_type> &pgf = m_PGFormatDefault,
+                std::pmr::memory_resource *mr = std::pmr::get_default_resource())
+    : m_rset(mr), m_pgformat(pgf), m_mr(mr) {}
+
+  /// A copy allocates from the same resource as the original.
+  ResultSetType(const ResultSetType &o)
+    : ResultBase(o), m_rset(o.m_rset, o.m_mr), m_size(o.m_size),
+      m_pgformat(o.m_pgformat), m_mr(o.m_mr) {}
+  ResultSetType(ResultSetType &&) = default;
+
+  explicit ResultSetType(std::pmr::memory_resource *mr)
+    : ResultSetType(m_PGFormatDefault, mr) {}
 
   explicit operator bool() const
   {
-    if (m_rset.empty()) { return false; }
+    if (m_size == 0) { return false; }
     return m_rset[0].operator bool();
   }
 
   void add_result(const std::vector<pg::FieldSpec> &fs) {
-    m_rset.emplace_back(fs);
+    if (m_size < m_rset.size()) { m_rset[m_size].reset(fs); }
+    else { m_rset.emplace_back(fs, m_mr); }
+    m_rset[m_size++].resolve(m_pgformat, parameters());
   }
 
-  void add_result(const SQLError &e) { m_rset.emplace_back(e); }
+  void add_result(const SQLError &e) {
+    if (m_size < m_rset.size()) { m_rset[m_size].reset(e); }
+    else { m_rset.emplace_back(e, m_mr); }
+    ++m_size;
+  }
 
-  void add_row() { m_rset.back().emplace_back(); }
+  void add_row() { current().emplace_back(); }
 
   void add_column(int i, const char *buf, int sz)
   {
-    auto &fs = m_rset.back().field_spec();
-    m_rset.back().back().push_back(m_pgformat.decode(fs[i], buf, sz));
+    auto &rs = current();
+    if (sz < 0) {                     // NULL
+      rs.back().emplace_back();
+      return;
+    }
+
+    if (auto f = rs.decoder(i)) {
+      rs.back().push_back((*f)(buf, sz));
+      return;
+    }
+
+    rs.back().push_back(m_pgformat.decode(rs.field_spec()[i], buf, sz));
   }
 
   //------------------------------------------------------------------------
-  size_type size() const { return m_rset.size(); }
+  size_type size() const { return m_size; }
+
+  /// Make the result ready for the next execution. The RecordSets and their
+  /// rows keep their storage and are reused.
+  void reset() { m_size = 0; }
 
   reference operator[](size_type pos) { return m_rset[pos]; }
   const_reference operator[](size_type pos) const { return m_rset[pos]; }
@@ -189,8 +435,12 @@ public:
 
 //----------------------------------------------------------------------------
 private:
-  vector_type m_rset;
+  value_type &current() { return m_rset[m_size - 1]; }
+
+  vector_type m_rset;               // sets past m_size are kept for reuse
+  size_type m_size = 0;
   const pg::PGFormatType<record_value_type> &m_pgformat;
+  std::pmr::memory_resource *m_mr;
 
 }; // ResultSetType;
 
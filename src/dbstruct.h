@@ -0,0 +1,326 @@
+/// @file dbstruct.h
+
+#ifndef LAPQ_DBSTRUCT_H
+#define LAPQ_DBSTRUCT_H
+
+#include <array>
+#include <span>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <memory_resource>
+
+#include "error.h"
+#include "pgformat.h"
+#include "dbresult.h"
+#include "dbtyped.h"
+#include "protocol.h"
+
+namespace lapq {
+//=============================================================================
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// Maps a column, by name or by position, to a data member of S.
+template <typename S, typename M>
+struct FieldMap
+{
+  using struct_type = S;
+  using member_type = M;
+
+  const char *name;                     // nullptr if mapped by position
+  int index;
+  M S::*member;
+};
+
+template <typename S, typename M>
+constexpr FieldMap<S, M> field(const char *name, M S::*member)
+{
+  return {name, -1, member};
+}
+
+template <typename S, typename M>
+constexpr FieldMap<S, M> field(int index, M S::*member)
+{
+  return {nullptr, index, member};
+}
+
+
+//----------------------------------------------------------------------------
+/// Specialize with a constexpr tuple of field() called fields, or use
+/// LAPQ_MAPPING at namespace scope:
+///
+///   struct Account { int id; std::string name; };
+///   LAPQ_MAPPING(Account, lapq::field("id", &Account::id),
+///                         lapq::field("name", &Account::name))
+template <typename S> struct Mapping;
+
+#define LAPQ_MAPPING(S, ...) \
+  template <> struct lapq::Mapping<S> \
+  { \
+    static constexpr auto fields = std::make_tuple(__VA_ARGS__); \
+  };
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// The rows returned by one statement as S.
+template <typename S>
+class StructSet {
+public:
+  using value_type = S;
+  using vector_type = std::pmr::vector<value_type>;
+  using size_type = typename vector_type::size_type;
+  using const_reference = typename vector_type::const_reference;
+  using const_iterator = typename vector_type::const_iterator;
+
+  StructSet(const std::vector<pg::FieldSpec> &fs, std::pmr::memory_resource *mr)
+    : m_field_spec{fs}, m_row(mr) {}
+  StructSet(const SQLError &er, std::pmr::memory_resource *mr)
+    : m_row(mr), m_error(er) {}
+
+  //------------------------------------------------------------------------
+  const std::vector<pg::FieldSpec> &field_spec() const { return m_field_spec; }
+  const SQLError &error() const { return m_error; }
+
+  explicit operator bool() const { return !m_error.operator bool(); }
+
+  size_type size() const { return m_row.size(); }
+  bool empty() const { return m_row.empty(); }
+
+  const_reference operator[](size_type pos) const { return m_row[pos]; }
+  const_iterator begin() const { return m_row.begin(); }
+  const_iterator end() const { return m_row.end(); }
+
+  /// Move the rows out of the set.
+  vector_type release() { return std::move(m_row); }
+
+//----------------------------------------------------------------------------
+private:
+  template <typename> friend class StructResult;
+
+  void fail(const char *code, const std::string &msg)
+  {
+    if (m_error) { return; }
+    m_error[SQLErrorField::CODE] = code;
+    m_error[SQLErrorField::MESSAGE] = msg;
+    m_row.clear();
+  }
+
+  std::vector<pg::FieldSpec> m_field_spec;
+  vector_type m_row;
+  SQLError m_error;
+
+}; // StructSet
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// A ResultBase that decodes each row straight into S using Mapping<S>.
+///
+/// The columns of the mapping are resolved once per RowDescription. An
+/// unknown column fails the statement with SQLSTATE 42703 (undefined_column),
+/// a type mismatch, or a date or time column while the server's DateStyle
+/// is not ISO or IntervalStyle not postgres, with 42804 and a NULL in a
+/// member that is not std::optional with 22004. Columns that are not mapped
+/// are skipped.
+template <typename S>
+class StructResult : public ResultBase {
+public:
+  using value_type = StructSet<S>;
+  using vector_type = std::vector<value_type>;
+  using size_type = typename vector_type::size_type;
+  using reference = typename vector_type::reference;
+  using const_reference = typename vector_type::const_reference;
+
+  /// The rows and the string_view arena are allocated from mr.
+  explicit StructResult(
+    std::pmr::memory_resource *mr = std::pmr::get_default_resource())
+    : m_arena(mr), m_mr(mr) {}
+  StructResult(const StructResult &) = delete;
+  StructResult &operator=(const StructResult &) = delete;
+
+  explicit operator bool() const
+  {
+    if (m_set.empty()) { return false; }
+    return m_set[0].operator bool();
+  }
+
+  //------------------------------------------------------------------------
+  void add_result(const std::vector<pg::FieldSpec> &fs) override
+  {
+    auto &set = m_set.emplace_back(fs, m_mr);
+    m_column.assign(fs.size(), nullptr);
+
+    for (std::size_t j = 0; j < field_count; ++j)
+    {
+      auto col = s_resolve[j](fs);
+      if (col < 0) {
+        set.fail("42703", "column " + s_name[j]() + " does not exist");
+        return;
+      }
+
+      if (fs[col].type_format != 0 || !s_accepts[j](fs[col].type_oid)) {
+        set.fail("42804", "column " + fs[col].name + " of type "
+                          + std::to_string(fs[col].type_oid)
+                          + " does not match");
+        return;
+      }
+
+      if (s_iso[j] && !(parameters()
+                        && parameters()->isoFormat(fs[col].type_oid)))
+      {
+        set.fail("42804", "column " + fs[col].name + " is not in DateStyle"
+                          " ISO and IntervalStyle postgres");
+        return;
+      }
+
+      m_column[col] = s_assign[j];
+    }
+  }
+
+  void add_result(const SQLError &e) override { m_set.emplace_back(e, m_mr); }
+
+  //------------------------------------------------------------------------
+  bool add_raw_row(std::span<const char> body) override
+  {
+    if (m_set.empty()) { return false; }
+    auto &set = m_set.back();
+    if (!set) { return true; }                // drop rows of a failed set
+
+    pv3::Reader rd(body);
+    int num;
+    if (!rd.int16(num) || std::size_t(num) != m_column.size()) {
+      return false;
+    }
+
+    S row{};
+    int sz;
+    std::span<const char> col;
+    for (int i = 0; i < num; ++i)
+    {
+      if (!rd.int32(sz)) { return false; }
+      if (sz >= 0 && !rd.bytes(sz, col)) { return false; }
+
+      if (m_column[i] && !m_column[i](row, m_arena, col.data(), sz)) {
+        set.fail("22004", "NULL in column " + set.m_field_spec[i].name);
+        return true;
+      }
+    }
+
+    set.m_row.push_back(std::move(row));
+    return true;
+  }
+
+  void add_row() override
+  {
+    auto &set = m_set.back();
+    if (set) { set.m_row.emplace_back(); }
+  }
+
+  void add_column(int i, const char *buf, int sz) override
+  {
+    auto &set = m_set.back();
+    if (!set || std::size_t(i) >= m_column.size() || !m_column[i]) { return; }
+
+    if (!m_column[i](set.m_row.back(), m_arena, buf, sz)) {
+      set.fail("22004", "NULL in column " + set.m_field_spec[i].name);
+    }
+  }
+
+  //------------------------------------------------------------------------
+  size_type size() const { return m_set.size(); }
+
+  reference operator[](size_type pos) { return m_set[pos]; }
+  const_reference operator[](size_type pos) const { return m_set[pos]; }
+
+  /// Drop all results and release the string_view arena.
+  void clear()
+  {
+    m_set.clear();
+    m_arena.release();
+  }
+
+//----------------------------------------------------------------------------
+private:
+  using fields_type = std::remove_cv_t<decltype(Mapping<S>::fields)>;
+  static constexpr std::size_t field_count = std::tuple_size_v<fields_type>;
+
+  using resolve_function = int (*)(const std::vector<pg::FieldSpec> &);
+  using name_function = std::string (*)();
+  using accept_function = bool (*)(int);
+  using assign_function = bool (*)(S &, std::pmr::memory_resource &,
+                                   const char *, int);
+
+  template <std::size_t J>
+  using member_t = typename std::tuple_element_t<J, fields_type>::member_type;
+
+  //------------------------------------------------------------------------
+  /// The column of mapping entry J, -1 if there is none.
+  template <std::size_t J>
+  static int resolve(const std::vector<pg::FieldSpec> &fs)
+  {
+    constexpr auto f = std::get<J>(Mapping<S>::fields);
+    if constexpr (f.name == nullptr) {
+      return (std::size_t(f.index) < fs.size()) ? f.index : -1;
+    }
+    else {
+      for (std::size_t i = 0; i < fs.size(); ++i)
+      {
+        if (fs[i].name == f.name) { return int(i); }
+      }
+      return -1;
+    }
+  }
+
+  template <std::size_t J>
+  static std::string name()
+  {
+    constexpr auto f = std::get<J>(Mapping<S>::fields);
+    if constexpr (f.name == nullptr) { return std::to_string(f.index); }
+    else { return f.name; }
+  }
+
+  template <std::size_t J>
+  static bool assign(S &row, std::pmr::memory_resource &arena,
+                     const char *buf, int sz)
+  {
+    constexpr auto member = std::get<J>(Mapping<S>::fields).member;
+    return assignCell(row.*member, arena, buf, sz);
+  }
+
+  //------------------------------------------------------------------------
+  template <std::size_t... Js>
+  static constexpr auto makeTables(std::index_sequence<Js...>)
+  {
+    return std::make_tuple(
+      std::array<resolve_function, field_count>{{&resolve<Js>...}},
+      std::array<name_function, field_count>{{&name<Js>...}},
+      std::array<accept_function, field_count>{
+        {&pg::Decoder<member_t<Js>>::accepts...}},
+      std::array<assign_function, field_count>{{&assign<Js>...}},
+      std::array<bool, field_count>{{pg::iso_text_v<member_t<Js>>...}});
+  }
+
+  static constexpr auto s_table =
+    makeTables(std::make_index_sequence<field_count>{});
+
+  static constexpr auto s_resolve = std::get<0>(s_table);
+  static constexpr auto s_name = std::get<1>(s_table);
+  static constexpr auto s_accepts = std::get<2>(s_table);
+  static constexpr auto s_assign = std::get<3>(s_table);
+  static constexpr auto s_iso = std::get<4>(s_table);
+
+  vector_type m_set;
+  std::vector<assign_function> m_column;    // per column, nullptr if unmapped
+  std::pmr::monotonic_buffer_resource m_arena;
+  std::pmr::memory_resource *m_mr;
+
+}; // StructResult
+
+
+//=============================================================================
+} // namespace lapq
+#endif
@@ -0,0 +1,285 @@
+/// @file dbtyped.h
+
+#ifndef LAPQ_DBTYPED_H
+#define LAPQ_DBTYPED_H
+
+#include <array>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <memory_resource>
+
+#include "error.h"
+#include "pgformat.h"
+#include "dbresult.h"
+#include "protocol.h"
+
+namespace lapq {
+//=============================================================================
+
+template <typename... Ts> class TypedResult;
+
+template <typename T> struct is_optional : std::false_type {};
+template <typename T> struct is_optional<std::optional<T>> : std::true_type {};
+
+
+//----------------------------------------------------------------------------
+/// Decode a cell into v with pg::Decoder<T>. A std::string_view refers to a
+/// copy of the cell in arena. Returns false for a NULL that T cannot hold.
+template <typename T>
+bool assignCell(T &v, std::pmr::memory_resource &arena,
+                const char *buf, int sz)
+{
+  if (sz < 0) {                         // NULL
+    if constexpr (is_optional<T>::value) { v.reset(); return true; }
+    else { return false; }
+  }
+
+  if constexpr (std::is_same_v<T, std::string_view>
+                || std::is_same_v<T, std::optional<std::string_view>>)
+  {
+    auto p = static_cast<char *>(arena.allocate(sz ? sz : 1, 1));
+    std::memcpy(p, buf, sz);
+    buf = p;
+  }
+
+  v = pg::Decoder<T>::decode(buf, sz);
+  return true;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// The rows returned by one statement as std::tuple<Ts...>.
+template <typename... Ts>
+class TypedSet {
+public:
+  using value_type = std::tuple<Ts...>;
+  using vector_type = std::pmr::vector<value_type>;
+  using size_type = typename vector_type::size_type;
+  using const_reference = typename vector_type::const_reference;
+  using const_iterator = typename vector_type::const_iterator;
+
+  TypedSet(const std::vector<pg::FieldSpec> &fs, std::pmr::memory_resource *mr)
+    : m_field_spec{fs}, m_row(mr) {}
+  TypedSet(const SQLError &er, std::pmr::memory_resource *mr)
+    : m_row(mr), m_error(er) {}
+
+  //------------------------------------------------------------------------
+  const std::vector<pg::FieldSpec> &field_spec() const { return m_field_spec; }
+  const SQLError &error() const { return m_error; }
+
+  explicit operator bool() const { return !m_error.operator bool(); }
+
+  size_type size() const { return m_row.size(); }
+  bool empty() const { return m_row.empty(); }
+
+  const_reference operator[](size_type pos) const { return m_row[pos]; }
+  const_iterator begin() const { return m_row.begin(); }
+  const_iterator end() const { return m_row.end(); }
+
+//----------------------------------------------------------------------------
+private:
+  friend class TypedResult<Ts...>;
+
+  void fail(const char *code, const std::string &msg)
+  {
+    if (m_error) { return; }
+    m_error[SQLErrorField::CODE] = code;
+    m_error[SQLErrorField::MESSAGE] = msg;
+    m_row.clear();
+  }
+
+  std::vector<pg::FieldSpec> m_field_spec;
+  vector_type m_row;
+  SQLError m_error;
+
+}; // TypedSet
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// A ResultBase that decodes each row straight into std::tuple<Ts...>.
+///
+/// The RowDescription is checked against Ts once. A column count or type
+/// mismatch fails the statement with SQLSTATE 42804 (datatype_mismatch), as
+/// does a date or time column while the server's DateStyle is not ISO or
+/// IntervalStyle not postgres, and a NULL in a column that is not
+/// std::optional with 22004 (null_value_not_allowed). std::string_view values refer to an arena
+/// owned by the TypedResult.
+template <typename... Ts>
+class TypedResult : public ResultBase {
+public:
+  using value_type = TypedSet<Ts...>;
+  using vector_type = std::vector<value_type>;
+  using size_type = typename vector_type::size_type;
+  using reference = typename vector_type::reference;
+  using const_reference = typename vector_type::const_reference;
+  using row_type = typename value_type::value_type;
+
+  static constexpr std::size_t column_count = sizeof...(Ts);
+
+  /// The rows and the string_view arena are allocated from mr.
+  explicit TypedResult(
+    std::pmr::memory_resource *mr = std::pmr::get_default_resource())
+    : m_arena(mr), m_mr(mr) {}
+  TypedResult(const TypedResult &) = delete;
+  TypedResult &operator=(const TypedResult &) = delete;
+
+  explicit operator bool() const
+  {
+    if (m_set.empty()) { return false; }
+    return m_set[0].operator bool();
+  }
+
+  //------------------------------------------------------------------------
+  void add_result(const std::vector<pg::FieldSpec> &fs) override
+  {
+    auto &set = m_set.emplace_back(fs, m_mr);
+    if (fs.size() != column_count) {
+      set.fail("42804", "expected " + std::to_string(column_count)
+                        + " columns, got " + std::to_string(fs.size()));
+      return;
+    }
+
+    for (std::size_t i = 0; i < column_count; ++i)
+    {
+      if (fs[i].type_format != 0 || !s_accepts[i](fs[i].type_oid)) {
+        set.fail("42804", "column " + fs[i].name + " of type "
+                          + std::to_string(fs[i].type_oid)
+                          + " does not match");
+        return;
+      }
+
+      if (s_iso[i] && !(parameters()
+                        && parameters()->isoFormat(fs[i].type_oid)))
+      {
+        set.fail("42804", "column " + fs[i].name + " is not in DateStyle"
+                          " ISO and IntervalStyle postgres");
+        return;
+      }
+    }
+  }
+
+  void add_result(const SQLError &e) override { m_set.emplace_back(e, m_mr); }
+
+  //------------------------------------------------------------------------
+  bool add_raw_row(std::span<const char> body) override
+  {
+    if (m_set.empty()) { return false; }
+    auto &set = m_set.back();
+    if (!set) { return true; }                // drop rows of a failed set
+
+    pv3::Reader rd(body);
+    int num;
+    if (!rd.int16(num) || num != int(column_count)) { return false; }
+
+    row_type row;
+    bool ok = decodeRow(rd, set, row, std::index_sequence_for<Ts...>{});
+    if (!ok) { return !rd.error(); }
+
+    set.m_row.push_back(std::move(row));
+    return true;
+  }
+
+  void add_row() override
+  {
+    auto &set = m_set.back();
+    if (set) { set.m_row.emplace_back(); }
+  }
+
+  void add_column(int i, const char *buf, int sz) override
+  {
+    auto &set = m_set.back();
+    if (!set || std::size_t(i) >= column_count) { return; }
+    s_decode[i](*this, set, set.m_row.back(), buf, sz);
+  }
+
+  //------------------------------------------------------------------------
+  size_type size() const { return m_set.size(); }
+
+  reference operator[](size_type pos) { return m_set[pos]; }
+  const_reference operator[](size_type pos) const { return m_set[pos]; }
+
+  /// Drop all results and release the string_view arena.
+  void clear()
+  {
+    m_set.clear();
+    m_arena.release();
+  }
+
+//----------------------------------------------------------------------------
+private:
+  using accept_function = bool (*)(int);
+  using decode_function = void (*)(TypedResult &, value_type &, row_type &,
+                                   const char *, int);
+
+  //------------------------------------------------------------------------
+  template <std::size_t I>
+  static void decodeColumn(TypedResult &self, value_type &set, row_type &row,
+                           const char *buf, int sz)
+  {
+    if (!assignCell(std::get<I>(row), self.m_arena, buf, sz)) {
+      set.fail("22004", "NULL in column " + set.m_field_spec[I].name);
+    }
+  }
+
+  //------------------------------------------------------------------------
+  template <std::size_t... Is>
+  bool decodeRow(pv3::Reader &rd, value_type &set, row_type &row,
+                 std::index_sequence<Is...>)
+  {
+    return (decodeCell<Is>(rd, set, row) && ...);
+  }
+
+  template <std::size_t I>
+  bool decodeCell(pv3::Reader &rd, value_type &set, row_type &row)
+  {
+    int sz;
+    std::span<const char> col;
+    if (!rd.int32(sz)) { return false; }
+    if (sz >= 0 && !rd.bytes(sz, col)) { return false; }
+
+    decodeColumn<I>(*this, set, row, col.data(), sz);
+    return bool(set);
+  }
+
+  //------------------------------------------------------------------------
+  template <std::size_t... Is>
+  static constexpr std::array<accept_function, sizeof...(Is)>
+  makeAccepts(std::index_sequence<Is...>)
+  {
+    return {{&pg::Decoder<std::tuple_element_t<Is, row_type>>::accepts...}};
+  }
+
+  template <std::size_t... Is>
+  static constexpr std::array<decode_function, sizeof...(Is)>
+  makeDecoders(std::index_sequence<Is...>)
+  {
+    return {{&decodeColumn<Is>...}};
+  }
+
+  static constexpr auto s_accepts =
+    makeAccepts(std::index_sequence_for<Ts...>{});
+
+  static constexpr std::array<bool, column_count> s_iso{
+    {pg::iso_text_v<Ts>...}};
+
+  static constexpr auto s_decode =
+    makeDecoders(std::index_sequence_for<Ts...>{});
+
+  vector_type m_set;
+  std::pmr::monotonic_buffer_resource m_arena;
+  std::pmr::memory_resource *m_mr;
+
+}; // TypedResult
+
+
+//=============================================================================
+} // namespace lapq
+#endif
@@ -33,6 +33,15 @@ std::string ErrorCategoryImpl::message(int ev) const
       case errc::sql_error:
         return "Postgres SQL Error";
 
+      case errc::budget_exceeded:
+        return "Result exceeded its budget, query cancelled";
+
+      case errc::session_attrs:
+        return "No server matches target_session_attrs";
+
+      case errc::server_signature:
+        return "Server SCRAM signature did not verify";
+
       default: return "Unknown error";
   }
 }
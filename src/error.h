@@ -20,7 +20,10 @@ enum class errc
   result_empty,
   unsupported_format,
   busy,
-  sql_error
+  sql_error,
+  budget_exceeded,
+  session_attrs,
+  server_signature
 
 };
 
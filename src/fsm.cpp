@@ -1,8 +1,6 @@
 
 /// @file fsm.cpp
 
-#include <map>
-
 #include "fsm.h"
 
 namespace lapq {
@@ -11,50 +9,69 @@ namespace pv3 {
 
 
 ///////////////////////////////////////////////////////////////////////////////
+constexpr FSM::StateTable FSM::makeStateTable()
+{
+  struct Entry { State state; Event event; Action action; };
+
+  constexpr Entry entry[] =
+  {
+    // state           event                          action
+    {State::AUTH,   Authentication::mtype(),       &FSM::authenticate },
+    {State::AUTH,   ErrorResponse::mtype(),        &FSM::authError },
+
+    {State::CONN,   BackendKeyData::mtype(),       &FSM::backendKeyData },
+    {State::CONN,   ReadyForQuery::mtype(),        &FSM::readyForQuery },
+    {State::CONN,   ParameterStatus::mtype(),      &FSM::parameterStatus },
+
+    // A SET of a reported parameter sends ParameterStatus within the query.
+    {State::QUERY,  ParameterStatus::mtype(),      &FSM::parameterStatus },
+    {State::EQUERY, ParameterStatus::mtype(),      &FSM::parameterStatus },
+
+    {State::QUERY,  RowDescription::mtype(),       &FSM::rowDescription },
+    {State::QUERY,  DataRow::mtype(),              &FSM::dataRow },
+    {State::QUERY,  CommandComplete::mtype(),      &FSM::commandComplete },
+    {State::QUERY,  ParseComplete::mtype(),        &FSM::parseComplete },
+    {State::QUERY,  ReadyForQuery::mtype(),        &FSM::readyForQuery },
+    {State::QUERY,  NoticeResponse::mtype(),       &FSM::noticeResponse },
+    {State::QUERY,  ErrorResponse::mtype(),        &FSM::query_error },
+
+    {State::EQUERY, BindComplete::mtype(),         &FSM::bindComplete },
+    {State::EQUERY, RowDescription::mtype(),       &FSM::rowDescription },
+    {State::EQUERY, ParameterDescription::mtype(), &FSM::parameterDescription},
+    {State::EQUERY, DataRow::mtype(),              &FSM::dataRow },
+    {State::EQUERY, CommandComplete::mtype(),      &FSM::commandComplete },
+    {State::EQUERY, ReadyForQuery::mtype(),        &FSM::readyForQuery },
+    {State::EQUERY, NoticeResponse::mtype(),       &FSM::noticeResponse },
+    {State::EQUERY, ErrorResponse::mtype(),        &FSM::query_error },
+
+    {State::CLOSE,  CloseComplete::mtype(),        &FSM::closeComplete }
+  };
+
+  StateTable table{};
+  for (auto &e : entry)
+  {
+    auto s = static_cast<std::size_t>(e.state);
+    table[s][static_cast<unsigned char>(e.event)] = e.action;
+  }
+  return table;
+}
+
+constexpr FSM::StateTable FSM::s_state_table = FSM::makeStateTable();
+
+
+//----------------------------------------------------------------------------
 FSM::FSM(asio::io_service &ios,
          pv3::ConnectionBase &con)
   : m_ios(ios), m_con(con), m_query(nullptr), m_result(nullptr),
-    m_state(State::AUTH),
-    m_state_table
-    {
-      // state           event                          action
-      {State::AUTH,   {{ Authentication::mtype(),       &FSM::authenticate },
-                       { ErrorResponse::mtype(),        &FSM::authError }}
-      },
-
-      {State::CONN,   {{ BackendKeyData::mtype(),       &FSM::backendKeyData },
-                       { ReadyForQuery::mtype(),        &FSM::readyForQuery },
-                       { ParameterStatus::mtype(),      &FSM::parameterStatus }}
-      },
-
-      {State::QUERY,  {{ RowDescription::mtype(),       &FSM::rowDescription },
-                       { DataRow::mtype(),              &FSM::dataRow },
-                       { CommandComplete::mtype(),      &FSM::commandComplete },
-                       { ParseComplete::mtype(),        &FSM::parseComplete },
-                       { ReadyForQuery::mtype(),        &FSM::readyForQuery },
-                       { NoticeResponse::mtype(),       &FSM::noticeResponse },
-                       { ErrorResponse::mtype(),        &FSM::query_error }}
-      },
-
-      {State::EQUERY, {{ BindComplete::mtype(),         &FSM::bindComplete },
-                       { RowDescription::mtype(),       &FSM::rowDescription },
-                       { ParameterDescription::mtype(), &FSM::parameterDescription},
-                       { DataRow::mtype(),              &FSM::dataRow },
-                       { CommandComplete::mtype(),      &FSM::commandComplete },
-                       { ReadyForQuery::mtype(),        &FSM::readyForQuery },
-                       { NoticeResponse::mtype(),       &FSM::noticeResponse },
-                       { ErrorResponse::mtype(),        &FSM::query_error }}
-      },
-
-      {State::CLOSE,  {{ CloseComplete::mtype(),        &FSM::closeComplete }}}
-
-    }
+    m_pid(0), m_key(0), m_draining(false),
+    m_state(State::AUTH), m_receive(false), m_running(false)
 {}
 
 
 //----------------------------------------------------------------------------
 void FSM::connect(const Option &option, EHandler &&eh)
 {
+  credentials(option);
   m_ehandler = std::move(eh);
   m_con.connect([this, msg = pv3::StartUp(option)]
   (const std::error_code &ec)
@@ -74,7 +91,8 @@ void FSM::connect(const Option &option, EHandler &&eh)
 //----------------------------------------------------------------------------
 void FSM::connectSSL(const Option &option, EHandler &&eh)
 {
-  m_ehandler = std::move(eh);
+  credentials(option);
+  m_ehandler = eh;
   m_con.connect([this, msg = pv3::StartUp(option), ehandler = std::move(eh)]
   (const std::error_code &ec)
   {
@@ -106,7 +124,7 @@ void FSM::exec(const std::string &q, ResultBase *res, EHandler &&eh)
     return;
   }
 
-  m_result = res;
+  start(res);
   m_ehandler = eh;
   state(State::QUERY);
 
@@ -129,10 +147,10 @@ void FSM::exec(DBQuery *q, ResultBase *res, EHandler &&eh)
     eh(ec);
     return;
   }
-  m_ehandler = std::move(eh);
+  m_ehandler = eh;
 
   m_query = q;
-  m_result = res;
+  start(res);
   state(State::EQUERY);
 
   pv3::Bind bnd{q->name(), q->portal(), q->bind_value()};
@@ -167,6 +185,19 @@ void FSM::exec(DBQuery *q, ResultBase *res, EHandler &&eh)
 }
 
 
+//----------------------------------------------------------------------------
+void FSM::start(ResultBase *res)
+{
+  m_result = res;
+  m_draining = false;
+  m_described = false;
+  if (m_result) {
+    m_result->reset_budget();
+    m_result->parameters(&m_parameters);
+  }
+}
+
+
 //----------------------------------------------------------------------------
 void FSM::parse(DBQuery *q, EHandler &&eh)
 {
@@ -176,7 +207,7 @@ void FSM::parse(DBQuery *q, EHandler &&eh)
     return;
   }
 
-  m_ehandler = std::move(eh);
+  m_ehandler = eh;
   m_query = q;
   state(State::QUERY);
 
@@ -228,10 +259,10 @@ void FSM::close(EHandler &&eh)
 //----------------------------------------------------------------------------
 void FSM::next(Event event, const Header &head, const Buffer &body)
 {
-  auto &transition = m_state_table.at(m_state);
-  auto it = transition.find(event);
-  if (it != transition.end()) {
-    (this->*(it->second))(head, body);
+  auto &transition = s_state_table[static_cast<std::size_t>(m_state)];
+  auto action = transition[static_cast<unsigned char>(event)];
+  if (action) {
+    (this->*action)(head, body);
   }
   else {
     //end(head, body);
@@ -243,6 +274,12 @@ void FSM::next(Event event, const Header &head, const Buffer &body)
 //----------------------------------------------------------------------------
 void FSM::receive()
 {
+  if (m_con.blocking()) {
+    m_receive = true;
+    if (!m_running) { run(); }
+    return;
+  }
+
   m_con.read(Header::size(),
   [this](const std::error_code &ec, std::size_t bytes, const Buffer &buf)
   {
@@ -250,7 +287,7 @@ void FSM::receive()
 
     Header header;
     auto er = header.deserialize(buf);
-    if (ec) { m_ehandler(ec); return; }
+    if (er) { m_ehandler(er); return; }
 
     //DBG("mtype=" << (int)header.messageType());
 
@@ -264,6 +301,42 @@ void FSM::receive()
   });
 }
 
+
+//----------------------------------------------------------------------------
+/// Message loop for blocking connections. The read handlers complete
+/// inline, so an action calling receive() only sets m_receive and the loop
+/// reads the next message. The stack depth does not grow with the number
+/// of messages.
+void FSM::run()
+{
+  std::error_code er;
+  m_running = true;
+
+  while (m_receive)
+  {
+    m_receive = false;
+
+    Header header;
+    m_con.read(Header::size(),
+    [&](const std::error_code &ec, std::size_t bytes, const Buffer &buf)
+    {
+      er = ec ? ec : header.deserialize(buf);
+    });
+    if (er) { break; }
+
+    m_con.read(header.bodyLen(),
+    [&](const std::error_code &ec, std::size_t bytes, const Buffer &buf)
+    {
+      if (ec) { er = ec; return; }
+      next(header.messageType(), header, buf);
+    });
+    if (er) { break; }
+  }
+
+  m_running = false;
+  if (er) { m_receive = false; m_ehandler(er); }
+}
+
 //----------------------------------------------------------------------------
 void FSM::authenticate(const Header &head, const Buffer &body)
 {
@@ -275,28 +348,116 @@ void FSM::authenticate(const Header &head, const Buffer &body)
   switch (msg.authType())
   {
     case pv3::Authentication::AUTH_OK:
+      // A started SCRAM exchange must end with a verified AUTH_SASL_FINAL,
+      // otherwise the server has not proven it knows the password.
+      if (m_scram) {
+        m_scram.reset();
+        m_ehandler(make_error_code(lapq::errc::server_signature));
+        return;
+      }
       state(State::CONN);
       //DBG("state=CONN");
     break;
 
     case pv3::Authentication::AUTH_MD5_PASSWORD:
+    {
       state(State::AUTH);
       //DBG("state=AUTH");
-      pv3::Password pw("gptest", "secret", msg.salt());
+      pv3::Password pw(m_user, m_password, msg.salt());
+      respond(pw);
+    }
+    return;
 
-      m_con.write(pw, [this]
-      (const std::error_code &ec, std::size_t bytes)
-      {
-        if (ec) { m_ehandler(ec); return; }
-        this->receive();
-      });
+    case pv3::Authentication::AUTH_SASL:
+    {
+      if (!offers(msg.data(), pv3::Scram::MECHANISM)) {
+        m_ehandler(std::error_code(ENOTSUP, std::generic_category()));
+        return;
+      }
+
+      m_scram = std::make_unique<pv3::Scram>(m_user, m_password);
+      if (m_scram->error()) {
+        ec = m_scram->error();
+        m_scram.reset();
+        m_ehandler(ec);
+        return;
+      }
+      respond(pv3::SASLInitialResponse(pv3::Scram::MECHANISM,
+                                       m_scram->clientFirst()));
+    }
+    return;
+
+    case pv3::Authentication::AUTH_SASL_CONTINUE:
+    {
+      if (!m_scram) {
+        m_ehandler(std::error_code(EPROTO, std::generic_category()));
+        return;
+      }
+
+      std::string final;
+      ec = m_scram->serverFirst(msg.data(), final);
+      if (ec) { m_ehandler(ec); return; }
+      respond(pv3::SASLResponse(final));
+    }
+    return;
+
+    case pv3::Authentication::AUTH_SASL_FINAL:
+    {
+      ec = m_scram ? m_scram->serverFinal(msg.data())
+                   : std::error_code(EPROTO, std::generic_category());
+      m_scram.reset();
+      if (ec) { m_ehandler(ec); return; }
+    }
     break;
+
+    default:
+      m_ehandler(std::error_code(ENOTSUP, std::generic_category()));
+    return;
   }
 
   receive();
 }
 
 
+//----------------------------------------------------------------------------
+/// Write an authentication response, then wait for the next Authentication.
+void FSM::respond(const pv3::Message &msg)
+{
+  m_con.write(msg, [this]
+  (const std::error_code &ec, std::size_t bytes)
+  {
+    if (ec) { m_ehandler(ec); return; }
+    this->receive();
+  });
+}
+
+
+//----------------------------------------------------------------------------
+/// True if the NUL separated list of SASL mechanisms has mechanism.
+bool FSM::offers(std::string_view list, std::string_view mechanism)
+{
+  while (!list.empty())
+  {
+    auto end = list.find('\0');
+    if (list.substr(0, end) == mechanism) { return true; }
+    if (end == std::string_view::npos) { break; }
+    list.remove_prefix(end + 1);
+  }
+  return false;
+}
+
+
+//----------------------------------------------------------------------------
+void FSM::credentials(const Option &option)
+{
+  auto u = option.find(opt::USER);
+  m_user = (u != option.end()) ? u->second : std::string();
+
+  auto p = option.find(opt::PASSWORD);
+  m_password = (p != option.end()) ? p->second : std::string();
+}
+
+
 //----------------------------------------------------------------------------
 void FSM::closeComplete(const Header &head, const Buffer &body)
 {
@@ -311,9 +472,8 @@ void FSM::closeComplete(const Header &head, const Buffer &body)
 //----------------------------------------------------------------------------
 void FSM::authError(const Header &head, const Buffer &body)
 {
-  pv3::ErrorResponse msg;
-
-  auto ec = msg.deserialize(head, body);
+  auto ec = decodeFields(body, [](SQLErrorField, std::string_view) {});
+  if (!ec) { ec = make_error_code(lapq::errc::sql_error); }
   m_ehandler(ec);
 }
 
@@ -321,14 +481,12 @@ void FSM::authError(const Header &head, const Buffer &body)
 //----------------------------------------------------------------------------
 void FSM::rowDescription(const Header &head, const Buffer &body)
 {
-  std::vector<pg::FieldSpec> fs;
-  pv3::RowDescription msg;
-  auto ec = msg.deserialize(head, body, fs);
+  auto ec = decodeRowDescription(body, m_field_spec);
   if (ec) { m_ehandler(ec); return; }
+  m_described = true;
 
-  //rep.result->add_result(fs);
-  if (m_result) {
-    m_result->add_result(fs);
+  if (m_result && !m_draining) {
+    m_result->add_result(m_field_spec);
   }
   receive();
 }
@@ -337,11 +495,11 @@ void FSM::rowDescription(const Header &head, const Buffer &body)
 //----------------------------------------------------------------------------
 void FSM::parameterStatus(const Header &head, const Buffer &body)
 {
-  pv3::ParameterStatus msg;
-
-  auto ec = msg.deserialize(head, body);
+  std::string_view name, value;
+  auto ec = decodeParameterStatus(body, name, value);
   if (ec) { m_ehandler(ec); return; }
 
+  m_parameters.set(name, value);
   receive();
 }
 
@@ -349,9 +507,7 @@ void FSM::parameterStatus(const Header &head, const Buffer &body)
 //----------------------------------------------------------------------------
 void FSM::backendKeyData(const Header &head, const Buffer &body)
 {
-  pv3::BackendKeyData msg;
-
-  auto ec = msg.deserialize(head, body);
+  auto ec = decodeBackendKeyData(body, m_pid, m_key);
   if (ec) { m_ehandler(ec); return; }
 
   receive();
@@ -362,9 +518,12 @@ void FSM::backendKeyData(const Header &head, const Buffer &body)
 //----------------------------------------------------------------------------
 void FSM::readyForQuery(const Header &head, const Buffer &body)
 {
-  pv3::ReadyForQuery msg;
-  auto ec = msg.deserialize(head, body);
+  char status;
+  auto ec = decodeReadyForQuery(body, status);
+  if (!ec && m_draining) { ec = make_error_code(lapq::errc::budget_exceeded); }
 
+  m_draining = false;
+  m_described = false;
   state(State::IDLE);
   m_ehandler(ec);
 }
@@ -373,11 +532,23 @@ void FSM::readyForQuery(const Header &head, const Buffer &body)
 //----------------------------------------------------------------------------
 void FSM::dataRow(const Header &head, const Buffer &body)
 {
-  
-  pv3::DataRow msg;
+  if (!m_result || m_draining) { receive(); return; }
+
+  // Over budget, cancel and drop the rows that are already on the way.
+  if (!m_result->charge(head.bodyLen())) {
+    m_draining = true;
+    m_con.cancel(m_pid, m_key, [](const std::error_code &) {});
+    receive();
+    return;
+  }
+
+  // Rows must follow their RowDescription, the sinks index its columns.
+  if (!m_described) {
+    m_ehandler(std::error_code(EBADMSG, std::generic_category()));
+    return;
+  }
 
-  //auto ec = msg.deserialize(head, body, *rep.result);
-  auto ec = msg.deserialize(head, body, *m_result);
+  auto ec = decodeDataRow(body, *m_result, m_field_spec.size());
   if (ec) { m_ehandler(ec); return; }
 
   receive();
@@ -387,11 +558,12 @@ void FSM::dataRow(const Header &head, const Buffer &body)
 //----------------------------------------------------------------------------
 void FSM::commandComplete(const Header &head, const Buffer &body)
 {
-  pv3::CommandComplete msg;
-
-  auto ec = msg.deserialize(head, body);
+  std::string_view tag;
+  auto ec = decodeCommandComplete(body, tag);
   if (ec) { m_ehandler(ec); return; }
 
+  m_described = false;
+  if (m_result) { m_result->end_result(); }
   receive();
 }
 
@@ -399,8 +571,6 @@ void FSM::commandComplete(const Header &head, const Buffer &body)
 //----------------------------------------------------------------------------
 void FSM::parseComplete(const Header &head, const Buffer &body)
 {
-  pv3::ParseComplete msg;
-  auto ec = msg.deserialize(head, body);
   receive();
 }
 
@@ -408,8 +578,6 @@ void FSM::parseComplete(const Header &head, const Buffer &body)
 //----------------------------------------------------------------------------
 void FSM::bindComplete(const Header &head, const Buffer &body)
 {
-  pv3::BindComplete msg;
-  auto ec = msg.deserialize(head, body);
   receive();
 }
 
@@ -418,8 +586,7 @@ void FSM::bindComplete(const Header &head, const Buffer &body)
 void FSM::parameterDescription(const Header &head, const Buffer &body)
 {
   std::vector<decltype(pg::FieldSpec::type_oid)> oid;
-  pv3::ParameterDescription msg;
-  auto ec = msg.deserialize(head, body, oid);
+  auto ec = decodeParameterDescription(body, oid);
   if (ec) { m_ehandler(ec); return; }
 
   /* fixme
@@ -431,9 +598,7 @@ void FSM::parameterDescription(const Header &head, const Buffer &body)
 //----------------------------------------------------------------------------
 void FSM::noticeResponse(const Header &head, const Buffer &body)
 {
-  pv3::NoticeResponse msg;
-
-  auto ec = msg.deserialize(head, body);
+  auto ec = decodeFields(body, [](SQLErrorField, std::string_view) {});
   if (ec) { m_ehandler(ec); return; }
 
   /* fixme
@@ -450,15 +615,23 @@ void FSM::noticeResponse(const Header &head, const Buffer &body)
 //----------------------------------------------------------------------------
 void FSM::query_error(const Header &head, const Buffer &body)
 {
-  pv3::ErrorResponse msg;
+  m_described = false;
+  if (!m_result || m_draining) {
+    auto ec = decodeFields(body, [](SQLErrorField, std::string_view) {});
+    if (ec) { m_ehandler(ec); return; }
+    receive();
+    return;
+  }
 
-  auto ec = msg.deserialize(head, body);
+  SQLError er;
+  auto ec = decodeFields(body, [&er](SQLErrorField f, std::string_view v)
+  {
+    er[f] = v;
+  });
   if (ec) { m_ehandler(ec); return; }
 
-  if (m_result) {
-      m_result->add_result(msg.sql_error());
-  }
-  //DBG(msg.sql_error());
+  m_result->add_result(er);
+  //DBG(er);
 
   receive();
 }
@@ -5,7 +5,8 @@
 #define LAPQ_FSM_H
 
 #include <system_error>
-#include <map>
+#include <array>
+#include <climits>
 
 #include "util.h"
 #include "protocol.h"
@@ -13,6 +14,7 @@
 #include "dbquery.h"
 #include "dbresult.h"
 #include "pgformat.h"
+#include "scram.h"
 
 
 namespace lapq {
@@ -39,6 +41,12 @@ public:
 
   void close(EHandler &&eh);
 
+  /// Drop the handler of the last operation, and what it holds on to.
+  void release() { m_ehandler = nullptr; }
+
+  /// The ParameterStatus values reported so far.
+  const pg::ServerParameters &parameters() const { return m_parameters; }
+
 
 //----------------------------------------------------------------------------
 private:
@@ -48,10 +56,23 @@ private:
   ResultBase *m_result;
   EHandler m_ehandler;
 
+  std::vector<pg::FieldSpec> m_field_spec;  /// last RowDescription
+  bool m_described = false;       /// DataRows may follow m_field_spec
+
+  std::string m_user;             /// for AUTH_MD5_PASSWORD and AUTH_SASL
+  std::string m_password;
+  std::unique_ptr<pv3::Scram> m_scram;
+
+  pg::ServerParameters m_parameters;  /// ParameterStatus
+
+  int m_pid;                      /// BackendKeyData, for CancelRequest
+  int m_key;
+  bool m_draining;                /// budget exceeded, rows are dropped
+
   //------------------------------------------------------------------------
   enum class State
   {
-      AUTH = 0, CONN, IDLE, QUERY, EQUERY, CLOSE, END
+      AUTH = 0, CONN, IDLE, QUERY, EQUERY, CLOSE, END, SIZE
   };
   State m_state;                  /// current state
 
@@ -63,8 +84,16 @@ private:
 
   void next(Event e, const Header &h, const Buffer &b);
   void receive();
+  void run();
+  void start(ResultBase *res);
+
+  bool m_receive;                 /// an action asked for the next message
+  bool m_running;                 /// run() is on the stack
 
   void authenticate(const Header &h, const Buffer &b);
+  void respond(const pv3::Message &msg);
+  void credentials(const Option &option);
+  static bool offers(std::string_view list, std::string_view mechanism);
   void authError(const Header &h, const Buffer &b);
   void closeComplete(const Header &h, const Buffer &b);
 
@@ -88,9 +117,15 @@ private:
   //------------------------------------------------------------------------
   using Action = void (FSM::*)(const Header &h, const Buffer &b);
 
-  using Transition = std::map<Event, Action>;
-  using StateTable = std::map<State, Transition>;
-  StateTable m_state_table;
+  /// Actions indexed by message type byte, nullptr if the event is ignored.
+  using Transition = std::array<Action, 1 << CHAR_BIT>;
+
+  /// Transitions indexed by State, shared by all instances.
+  using StateTable =
+    std::array<Transition, static_cast<std::size_t>(State::SIZE)>;
+
+  static constexpr StateTable makeStateTable();
+  static const StateTable s_state_table;
 };
 
 
@@ -5,5 +5,10 @@
 #define lapq_H
 
 #include "dbconnection.h"
+#include "dbcolumn.h"
+#include "dbraw.h"
+#include "dbtyped.h"
+#include "dbstruct.h"
+#include "dbparallel.h"
 
 #endif
@@ -11,6 +11,208 @@ namespace lapq {
 namespace pg {
 //============================================================================
 
+namespace {
+
+using namespace std::chrono;
+
+/// 2000-01-01, the epoch of the binary formats.
+constexpr sys_days PG_EPOCH = sys_days(year(2000) / January / 1);
+
+
+//----------------------------------------------------------------------------
+[[noreturn]] void invalid(const char *what)
+{
+  throw std::invalid_argument(what);
+}
+
+
+//----------------------------------------------------------------------------
+/// Reads the fixed text formats left to right.
+class Scanner {
+public:
+  Scanner(const char *buf, int sz) : m_p(buf), m_end(buf + sz) {}
+
+  bool done() const { return m_p == m_end; }
+  bool peek(char c) const { return m_p != m_end && *m_p == c; }
+
+  bool skip(char c)
+  {
+    if (!peek(c)) { return false; }
+    ++m_p;
+    return true;
+  }
+
+  /// The rest is s.
+  bool rest(std::string_view s) const
+  {
+    return std::string_view(m_p, m_end - m_p) == s;
+  }
+
+  /// Exactly n digits.
+  bool fixed(int n, int &v)
+  {
+    if (m_end - m_p < n) { return false; }
+    v = 0;
+    for (int i = 0; i < n; ++i, ++m_p)
+    {
+      unsigned d = *m_p - '0';
+      if (d > 9) { return false; }
+      v = v * 10 + d;
+    }
+    return true;
+  }
+
+  /// One to 18 digits.
+  bool number(std::int64_t &v)
+  {
+    auto start = m_p;
+    v = 0;
+    for (; m_p != m_end && m_p - start < 18; ++m_p)
+    {
+      unsigned d = *m_p - '0';
+      if (d > 9) { break; }
+      v = v * 10 + d;
+    }
+    return m_p != start;
+  }
+
+  /// Up to six digits after the decimal point, as microseconds.
+  bool fraction(std::int64_t &us)
+  {
+    static constexpr std::int64_t scale[] = {
+      1000000, 100000, 10000, 1000, 100, 10, 1
+    };
+    auto start = m_p;
+    std::int64_t v;
+    if (!number(v) || m_p - start > 6) { return false; }
+    us = v * scale[m_p - start];
+    return true;
+  }
+
+  /// A word of letters, e.g. the unit of an interval field.
+  std::string_view word()
+  {
+    auto start = m_p;
+    while (m_p != m_end && *m_p >= 'a' && *m_p <= 'z') { ++m_p; }
+    return std::string_view(start, m_p - start);
+  }
+
+private:
+  const char *m_p;
+  const char *m_end;
+
+}; // Scanner
+
+
+//----------------------------------------------------------------------------
+/// YYYY-MM-DD, the year of four or more digits.
+bool scanDate(Scanner &sc, int &y, int &m, int &d)
+{
+  std::int64_t yy;
+  if (!sc.number(yy) || yy > 999999 || !sc.skip('-') || !sc.fixed(2, m)
+      || !sc.skip('-') || !sc.fixed(2, d))
+  {
+    return false;
+  }
+  y = static_cast<int>(yy);
+  return true;
+}
+
+
+//----------------------------------------------------------------------------
+/// HH:MM:SS[.ffffff] as microseconds, HH of one or more digits.
+bool scanTime(Scanner &sc, std::int64_t &us)
+{
+  std::int64_t h, frac = 0;
+  int m, s;
+  if (!sc.number(h) || !sc.skip(':') || !sc.fixed(2, m) || !sc.skip(':')
+      || !sc.fixed(2, s) || m > 59 || s > 60)
+  {
+    return false;
+  }
+  if (sc.skip('.') && !sc.fraction(frac)) { return false; }
+
+  us = ((h * 60 + m) * 60 + s) * 1000000 + frac;
+  return true;
+}
+
+
+//----------------------------------------------------------------------------
+/// +HH[:MM[:SS]] as seconds east of UTC.
+bool scanOffset(Scanner &sc, int &offset)
+{
+  int sign = sc.skip('-') ? -1 : (sc.skip('+') ? 1 : 0);
+  int h, m = 0, s = 0;
+  if (!sign || !sc.fixed(2, h)) { return false; }
+  if (sc.skip(':') && (!sc.fixed(2, m) || (sc.skip(':') && !sc.fixed(2, s)))) {
+    return false;
+  }
+  offset = sign * ((h * 60 + m) * 60 + s);
+  return true;
+}
+
+
+//----------------------------------------------------------------------------
+/// A date followed by " BC" counts years before 1 AD, 1 BC is year 0.
+/// std::chrono::year ends at 32767, later dates are rejected.
+Date toDate(int y, int m, int d, bool bc)
+{
+  if (y > int(year::max())) { invalid("decodeDate"); }
+
+  Date ymd{year(bc ? 1 - y : y), month(m), day(d)};
+  if (!ymd.ok()) { invalid("decodeDate"); }
+  return ymd;
+}
+
+
+//----------------------------------------------------------------------------
+Timestamp timestamp(const char *buf, int sz, bool tz)
+{
+  if (sz > 0 && buf[0] == 'i' && std::string_view(buf, sz) == "infinity") {
+    return Timestamp::max();
+  }
+  if (sz > 0 && buf[0] == '-' && std::string_view(buf, sz) == "-infinity") {
+    return Timestamp::min();
+  }
+
+  Scanner sc(buf, sz);
+  int y, m, d, offset = 0;
+  std::int64_t us;
+  if (!scanDate(sc, y, m, d) || !sc.skip(' ') || !scanTime(sc, us)
+      || (tz && (sc.peek('+') || sc.peek('-')) && !scanOffset(sc, offset)))
+  {
+    invalid("decodeTimestamp");
+  }
+
+  bool bc = sc.rest(" BC");
+  if (!bc && !sc.done()) { invalid("decodeTimestamp"); }
+
+  return Timestamp(sys_days(toDate(y, m, d, bc)))
+         + microseconds(us - std::int64_t(offset) * 1000000);
+}
+
+
+//----------------------------------------------------------------------------
+std::int32_t int32(const char *buf)
+{
+  auto p = reinterpret_cast<const unsigned char *>(buf);
+  return static_cast<std::int32_t>(std::uint32_t(p[0]) << 24
+                                   | std::uint32_t(p[1]) << 16
+                                   | std::uint32_t(p[2]) << 8 | p[3]);
+}
+
+
+//----------------------------------------------------------------------------
+std::int64_t int64(const char *buf)
+{
+  return static_cast<std::int64_t>(
+    std::uint64_t(std::uint32_t(int32(buf))) << 32
+    | std::uint32_t(int32(buf + 4)));
+}
+
+} // namespace
+
+
 //////////////////////////////////////////////////////////////////////////////
 std::ostream &operator<<(std::ostream &os, const std::vector<FieldSpec> &obj)
 {
@@ -28,6 +230,57 @@ std::ostream &operator<<(std::ostream &os, const std::vector<FieldSpec> &obj)
 }
 
 
+//////////////////////////////////////////////////////////////////////////////
+void ServerParameters::set(std::string_view name, std::string_view value)
+{
+  auto it = m_value.find(name);
+  if (it == m_value.end()) { m_value.emplace(name, value); }
+  else { it->second.assign(value); }
+
+  if (name == "DateStyle") {
+    m_iso_datestyle = value.substr(0, 3) == "ISO";
+  }
+  else if (name == "client_encoding") {
+    m_utf8 = (value == "UTF8" || value == "UTF-8");
+  }
+  else if (name == "IntervalStyle") {
+    m_postgres_intervalstyle = (value == "postgres");
+  }
+  else if (name == "integer_datetimes") {
+    m_integer_datetimes = (value == "on");
+  }
+  else if (name == "server_version") {
+    // major.minor or, before 10, major.major.minor, then maybe " (Debian..."
+    int part[3] = {0, 0, 0};
+    std::size_t n = 0;
+    auto p = value.data(), end = value.data() + value.size();
+    while (n < 3 && p < end)
+    {
+      auto [q, ec] = std::from_chars(p, end, part[n]);
+      if (ec != std::errc()) { break; }
+      ++n;
+      if (q == end || *q != '.') { break; }
+      p = q + 1;
+    }
+
+    if (n == 0) { m_server_version = 0; }
+    else if (part[0] >= 10) { m_server_version = part[0] * 10000 + part[1]; }
+    else {
+      m_server_version = part[0] * 10000 + part[1] * 100 + part[2];
+    }
+  }
+}
+
+
+//----------------------------------------------------------------------------
+std::string_view ServerParameters::get(std::string_view name) const
+{
+  auto it = m_value.find(name);
+  return (it != m_value.end()) ? std::string_view(it->second)
+                               : std::string_view();
+}
+
+
 
 //////////////////////////////////////////////////////////////////////////////
 bool decodeBool(const char *buf, int sz)
@@ -40,11 +293,40 @@ bool decodeBool(const char *buf, int sz)
 }
 
 
+//----------------------------------------------------------------------------
+std::int16_t decodeInt2(const char *buf, int sz)
+{
+  return decodeNumber<std::int16_t>(buf, sz);
+}
+
 //----------------------------------------------------------------------------
 int decodeInt4(const char *buf, int sz)
 {
-  auto tmp = reinterpret_cast<const char *>(buf);
-  return std::stoi({tmp, static_cast<std::string::size_type>(sz)});
+  return decodeNumber<int>(buf, sz);
+}
+
+//----------------------------------------------------------------------------
+std::int64_t decodeInt8(const char *buf, int sz)
+{
+  return decodeNumber<std::int64_t>(buf, sz);
+}
+
+//----------------------------------------------------------------------------
+std::uint32_t decodeOid(const char *buf, int sz)
+{
+  return decodeNumber<std::uint32_t>(buf, sz);
+}
+
+//----------------------------------------------------------------------------
+float decodeFloat4(const char *buf, int sz)
+{
+  return decodeNumber<float>(buf, sz);
+}
+
+//----------------------------------------------------------------------------
+double decodeFloat8(const char *buf, int sz)
+{
+  return decodeNumber<double>(buf, sz);
 }
 
 
@@ -56,6 +338,135 @@ std::string decodeText(const char *buf, int sz)
 }
 
 
+//////////////////////////////////////////////////////////////////////////////
+Date decodeDate(const char *buf, int sz)
+{
+  std::string_view s(buf, sz);
+  if (s == "infinity") { return year::max() / December / 31; }
+  if (s == "-infinity") { return year::min() / January / 1; }
+
+  Scanner sc(buf, sz);
+  int y, m, d;
+  if (!scanDate(sc, y, m, d)) { invalid("decodeDate"); }
+
+  bool bc = sc.rest(" BC");
+  if (!bc && !sc.done()) { invalid("decodeDate"); }
+  return toDate(y, m, d, bc);
+}
+
+
+//----------------------------------------------------------------------------
+/// 24:00:00 is allowed.
+TimeOfDay decodeTime(const char *buf, int sz)
+{
+  Scanner sc(buf, sz);
+  std::int64_t us;
+  if (!scanTime(sc, us) || !sc.done() || us > 86400 * std::int64_t(1000000)) {
+    invalid("decodeTime");
+  }
+  return microseconds(us);
+}
+
+
+//----------------------------------------------------------------------------
+Timestamp decodeTimestamp(const char *buf, int sz)
+{
+  return timestamp(buf, sz, false);
+}
+
+
+//----------------------------------------------------------------------------
+Timestamp decodeTimestampTZ(const char *buf, int sz)
+{
+  return timestamp(buf, sz, true);
+}
+
+
+//----------------------------------------------------------------------------
+/// Fields such as "-1 years", "2 mons", "3 days" and a signed time, each
+/// optional and separated by a space. "00:00:00" is zero.
+Interval decodeInterval(const char *buf, int sz)
+{
+  std::string_view s(buf, sz);
+  if (s == "infinity") {
+    return {INT64_MAX, INT32_MAX, INT32_MAX};
+  }
+  if (s == "-infinity") {
+    return {INT64_MIN, INT32_MIN, INT32_MIN};
+  }
+
+  Interval iv;
+  Scanner sc(buf, sz);
+  while (!sc.done())
+  {
+    bool neg = sc.skip('-');
+    if (!neg) { sc.skip('+'); }
+
+    Scanner field = sc;
+    std::int64_t v;
+    if (!sc.number(v)) { invalid("decodeInterval"); }
+
+    if (sc.peek(':')) {
+      if (!scanTime(field, v)) { invalid("decodeInterval"); }
+      iv.microseconds = neg ? -v : v;
+      sc = field;
+    }
+    else {
+      if (!sc.skip(' ')) { invalid("decodeInterval"); }
+      auto unit = sc.word();
+      auto n = static_cast<std::int32_t>(neg ? -v : v);
+      if (unit == "year" || unit == "years") { iv.months += n * 12; }
+      else if (unit == "mon" || unit == "mons") { iv.months += n; }
+      else if (unit == "day" || unit == "days") { iv.days += n; }
+      else { invalid("decodeInterval"); }
+    }
+
+    if (!sc.done() && !sc.skip(' ')) { invalid("decodeInterval"); }
+  }
+  return iv;
+}
+
+
+//----------------------------------------------------------------------------
+Date decodeDateBinary(const char *buf, int sz)
+{
+  if (sz != 4) { invalid("decodeDateBinary"); }
+
+  auto d = int32(buf);
+  if (d == INT32_MAX) { return year::max() / December / 31; }
+  if (d == INT32_MIN) { return year::min() / January / 1; }
+  return Date(PG_EPOCH + days(d));
+}
+
+
+//----------------------------------------------------------------------------
+TimeOfDay decodeTimeBinary(const char *buf, int sz)
+{
+  if (sz != 8) { invalid("decodeTimeBinary"); }
+  return microseconds(int64(buf));
+}
+
+
+//----------------------------------------------------------------------------
+Timestamp decodeTimestampBinary(const char *buf, int sz)
+{
+  if (sz != 8) { invalid("decodeTimestampBinary"); }
+
+  auto us = int64(buf);
+  if (us == INT64_MAX) { return Timestamp::max(); }
+  if (us == INT64_MIN) { return Timestamp::min(); }
+  return Timestamp(PG_EPOCH) + microseconds(us);
+}
+
+
+//----------------------------------------------------------------------------
+Interval decodeIntervalBinary(const char *buf, int sz)
+{
+  if (sz != 16) { invalid("decodeIntervalBinary"); }
+  return {int64(buf), int32(buf + 8), int32(buf + 12)};
+}
+
+
 //////////////////////////////////////////////////////////////////////////////
 } // namespace pg
 } // namespace lapq
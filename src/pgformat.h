@@ -7,9 +7,25 @@
 #include <iostream>
 #include <system_error>
 #include <map>
+#include <unordered_map>
+#include <deque>
+#include <vector>
+#include <functional>
 #include <locale>
 #include <sstream>
 #include <any>
+#include <bit>
+#include <chrono>
+#include <charconv>
+#include <cstring>
+#include <limits>
+#include <span>
+#include <type_traits>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
 
 #include "types.h"
 #include "pgtype.h"
@@ -35,12 +51,140 @@ std::ostream &operator<<(std::ostream &os, const std::vector<FieldSpec> &obj);
 
 
 ///////////////////////////////////////////////////////////////////////////////
-/// Decode the buffer and return the C++ value.
+/// The settings the server reports with ParameterStatus: server_version,
+/// integer_datetimes, DateStyle, TimeZone, client_encoding and others. The
+/// FSM of each connection keeps them up to date, including after a SET.
+class ServerParameters {
+public:
+  using map_type = std::map<std::string, std::string, std::less<>>;
+
+  void set(std::string_view name, std::string_view value);
+
+  /// The value of name, empty if the server has not reported it.
+  std::string_view get(std::string_view name) const;
+  const map_type &all() const { return m_value; }
+
+  /// DateStyle is ISO (the server default), dates, times and timestamps
+  /// have a fixed text format. False until the server reports DateStyle.
+  bool isoDateStyle() const { return m_iso_datestyle; }
+
+  /// IntervalStyle is postgres (the server default), intervals have a fixed
+  /// text format. False until the server reports IntervalStyle.
+  bool postgresIntervalStyle() const { return m_postgres_intervalstyle; }
+
+  /// The text of type oid is in the format of the ISO decoders: DateStyle
+  /// ISO, and for interval also IntervalStyle postgres.
+  bool isoFormat(int oid) const
+  {
+    return m_iso_datestyle
+           && (oid != PG_INTERVALOID || m_postgres_intervalstyle);
+  }
+
+  /// client_encoding is UTF8, text needs no validation or conversion.
+  bool utf8() const { return m_utf8; }
+
+  /// integer_datetimes is on (always since PostgreSQL 10), binary times are
+  /// int64 microseconds.
+  bool integerDatetimes() const { return m_integer_datetimes; }
+
+  /// server_version as a number, 170002 for 17.2 and 90603 for 9.6.3, 0 if
+  /// unknown.
+  int serverVersion() const { return m_server_version; }
+
+//----------------------------------------------------------------------------
+private:
+  map_type m_value;
+  bool m_iso_datestyle = false;
+  bool m_postgres_intervalstyle = false;
+  bool m_utf8 = false;
+  bool m_integer_datetimes = true;
+  int m_server_version = 0;
+
+}; // ServerParameters
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// Decode the buffer and return the C++ value. The number decoders do not
+/// allocate and throw std::invalid_argument if buf is not a number.
 bool decodeBool(const char *buf, int sz);
+std::int16_t decodeInt2(const char *buf, int sz);
 int decodeInt4(const char *buf, int sz);
+std::int64_t decodeInt8(const char *buf, int sz);
+std::uint32_t decodeOid(const char *buf, int sz);
+float decodeFloat4(const char *buf, int sz);
+double decodeFloat8(const char *buf, int sz);
 std::string decodeText(const char *buf, int sz);
 
 
+///////////////////////////////////////////////////////////////////////////////
+/// Dates and times. A Timestamp counts microseconds since the Unix epoch, for
+/// timestamptz in UTC. infinity and -infinity decode to the largest and
+/// smallest value of the type.
+using Timestamp = std::chrono::sys_time<std::chrono::microseconds>;
+using Date = std::chrono::year_month_day;
+using TimeOfDay = std::chrono::microseconds;
+
+/// An interval as PostgreSQL keeps it. Months and days are not folded into
+/// microseconds since their length varies.
+struct Interval
+{
+  std::int64_t microseconds = 0;
+  std::int32_t days = 0;
+  std::int32_t months = 0;
+
+  bool operator==(const Interval &) const = default;
+};
+
+/// Text in DateStyle ISO and IntervalStyle postgres, for example
+/// "2024-02-29 13:45:00.25+05:30" and "1 year 2 mons -3 days 04:05:06". They
+/// do not allocate or use a locale and throw std::invalid_argument on any
+/// other format. decodeTimestampTZ() also takes a timestamp without offset
+/// as UTC.
+Date decodeDate(const char *buf, int sz);
+TimeOfDay decodeTime(const char *buf, int sz);
+Timestamp decodeTimestamp(const char *buf, int sz);
+Timestamp decodeTimestampTZ(const char *buf, int sz);
+Interval decodeInterval(const char *buf, int sz);
+
+/// Binary format: days (int32) or microseconds (int64) since 2000-01-01,
+/// and for interval microseconds, days and months. This is the format of
+/// integer_datetimes, the only one since PostgreSQL 10.
+Date decodeDateBinary(const char *buf, int sz);
+TimeOfDay decodeTimeBinary(const char *buf, int sz);
+Timestamp decodeTimestampBinary(const char *buf, int sz);
+Interval decodeIntervalBinary(const char *buf, int sz);
+
+
+//----------------------------------------------------------------------------
+/// Parse n <= 16 ASCII digits eight at a time (SWAR), false if one of them
+/// is not a digit.
+inline bool parseDigits(const char *buf, int n, std::uint64_t &v)
+{
+  auto chunk = [](const char *p, int k, std::uint64_t &r) {
+    std::uint64_t x = 0x3030303030303030;     // leading '0' padding
+    std::memcpy(reinterpret_cast<char *>(&x) + (8 - k), p, k);
+
+    if ((((x & 0xF0F0F0F0F0F0F0F0) |
+          (((x + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4))
+         != 0x3333333333333333)) {
+      return false;
+    }
+
+    x = (x & 0x0F0F0F0F0F0F0F0F) * 2561 >> 8;
+    x = (x & 0x00FF00FF00FF00FF) * 6553601 >> 16;
+    r = (x & 0x0000FFFF0000FFFF) * 42949672960001 >> 32;
+    return true;
+  };
+
+  if (n <= 8) { return chunk(buf, n, v); }
+
+  std::uint64_t hi, lo;
+  if (!chunk(buf, n - 8, hi) || !chunk(buf + n - 8, 8, lo)) { return false; }
+  v = hi * 100000000 + lo;
+  return true;
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 template <typename T = std::any>
 class PGFormatType {
@@ -50,53 +194,139 @@ public:
   using decode_function =
     std::function<value_type(const char *buf, int sz)>;
 
-  using map_type = std::map<decltype(FieldSpec::type_oid), decode_function>;
-  using iterator = typename map_type::iterator;
+  using oid_type = decltype(FieldSpec::type_oid);
+  using map_type = std::unordered_map<oid_type, decode_function>;
+
+  /// OIDs below this are built in and indexed by a flat table.
+  static constexpr oid_type builtin_oid_limit = 16384;
 
   //------------------------------------------------------------------------
-  PGFormatType<value_type>()
-    : m_pg_decoder
+  PGFormatType() : m_text(pg::decodeText)
   {
-    { lapq::pg::PG_BOOLOID, pg::decodeBool },
-    { lapq::pg::PG_INT4OID, pg::decodeInt4 },
-    { lapq::pg::PG_TEXTOID, pg::decodeText }
+    emplace(lapq::pg::PG_BOOLOID, pg::decodeBool);
+    emplace(lapq::pg::PG_INT2OID, pg::decodeInt2);
+    emplace(lapq::pg::PG_INT4OID, pg::decodeInt4);
+    emplace(lapq::pg::PG_INT8OID, pg::decodeInt8);
+    emplace(lapq::pg::PG_OIDOID, pg::decodeOid);
+    emplace(lapq::pg::PG_FLOAT4OID, pg::decodeFloat4);
+    emplace(lapq::pg::PG_FLOAT8OID, pg::decodeFloat8);
+    emplace(lapq::pg::PG_TEXTOID, pg::decodeText);
+
+    emplaceBinary(lapq::pg::PG_DATEOID, pg::decodeDateBinary);
+    emplaceBinary(lapq::pg::PG_TIMEOID, pg::decodeTimeBinary);
+    emplaceBinary(lapq::pg::PG_TIMESTAMPOID, pg::decodeTimestampBinary);
+    emplaceBinary(lapq::pg::PG_TIMESTAMPTZOID, pg::decodeTimestampBinary);
+    emplaceBinary(lapq::pg::PG_INTERVALOID, pg::decodeIntervalBinary);
   }
-  {}
 
-  virtual ~PGFormatType<value_type>() {}
+  virtual ~PGFormatType() {}
 
   //------------------------------------------------------------------------
   virtual value_type decode(const FieldSpec &fs,
                             const char *buf,
                             int sz) const
   {
-    if (fs.type_format == 1) {      // binary format not supported
+    auto f = decoder(fs);
+    if (!f) {                       // binary format not supported
       throw (1); // fixme
     }
+    return (*f)(buf, sz);
+  }
+
+  /// The decoder for a column, resolved once per RowDescription. Returns
+  /// nullptr for a binary format without decoder. The pointer is valid as
+  /// long as this PGFormatType. With the server's parameters a decoder
+  /// registered with emplaceISO() is taken if the text is in ISO format,
+  /// see ServerParameters::isoFormat().
+  const decode_function *decoder(const FieldSpec &fs,
+                                 const ServerParameters *sp) const
+  {
+    if (sp && fs.type_format == 0 && sp->isoFormat(fs.type_oid)) {
+      auto it = m_iso.find(fs.type_oid);
+      if (it != m_iso.end()) { return &it->second; }
+    }
+    return decoder(fs);
+  }
+
+  const decode_function *decoder(const FieldSpec &fs) const
+  {
+    if (fs.type_format == 1) {
+      auto it = m_binary.find(fs.type_oid);
+      return (it != m_binary.end()) ? &it->second : nullptr;
+    }
 
-    auto it = m_pg_decoder.find(fs.type_oid);
-    if (it != m_pg_decoder.end()) {
-      return (it->second)(buf, sz);
+    auto oid = fs.type_oid;
+    if (oid >= 0 && std::size_t(oid) < m_index.size() && m_index[oid]) {
+      return &m_builtin[m_index[oid] - 1];
     }
 
-    return pg::decodeText(buf, sz);
+    auto it = m_pg_decoder.find(oid);
+    if (it != m_pg_decoder.end()) { return &it->second; }
+
+    return &m_text;
   }
 
 
   //------------------------------------------------------------------------
-  template <typename... Args>
-  std::pair<iterator, bool> emplace(Args&&... args)
+  /// Register a decoder, built in OIDs go to the flat table and user types
+  /// to the hash map. Returns false if the OID already has a decoder.
+  template <typename F>
+  bool emplace(oid_type oid, F &&f)
+  {
+    if (oid < 0 || oid >= builtin_oid_limit) {
+      return m_pg_decoder.emplace(oid, std::forward<F>(f)).second;
+    }
+
+    if (std::size_t(oid) >= m_index.size()) { m_index.resize(oid + 1, 0); }
+    if (m_index[oid]) { return false; }
+
+    m_builtin.emplace_back(std::forward<F>(f));
+    m_index[oid] = static_cast<std::uint16_t>(m_builtin.size());
+    return true;
+  }
+
+  /// Register a fixed-format decoder for text that follows DateStyle. It is
+  /// only used while the server reports DateStyle ISO, and for interval
+  /// IntervalStyle postgres. Returns false if the OID already has one.
+  template <typename F>
+  bool emplaceISO(oid_type oid, F &&f)
+  {
+    return m_iso.emplace(oid, std::forward<F>(f)).second;
+  }
+
+  /// Opt in to decoding the text of date, time, timestamp, timestamptz and
+  /// interval into pg::Date, pg::TimeOfDay, pg::Timestamp and pg::Interval.
+  /// Without it they are std::string, as are the values of a format that
+  /// opted in while the server's DateStyle or IntervalStyle is another, so
+  /// a caller that opts in keeps them at ISO and postgres.
+  void emplaceChrono()
+  {
+    emplaceISO(lapq::pg::PG_DATEOID, pg::decodeDate);
+    emplaceISO(lapq::pg::PG_TIMEOID, pg::decodeTime);
+    emplaceISO(lapq::pg::PG_TIMESTAMPOID, pg::decodeTimestamp);
+    emplaceISO(lapq::pg::PG_TIMESTAMPTZOID, pg::decodeTimestampTZ);
+    emplaceISO(lapq::pg::PG_INTERVALOID, pg::decodeInterval);
+  }
+
+  /// Register a decoder for the binary format of a type.
+  template <typename F>
+  bool emplaceBinary(oid_type oid, F &&f)
   {
-    return m_pg_decoder.emplace(std::forward<Args>(args)...);
+    return m_binary.emplace(oid, std::forward<F>(f)).second;
   }
 
 //----------------------------------------------------------------------------
 protected:
-  map_type m_pg_decoder;
+  map_type m_pg_decoder;                      // user types
 
 
 //----------------------------------------------------------------------------
 private:
+  std::vector<std::uint16_t> m_index;         // by OID, 1 + m_builtin index
+  std::deque<decode_function> m_builtin;      // stable addresses
+  map_type m_iso;                             // DateStyle ISO only
+  map_type m_binary;                          // type_format 1
+  decode_function m_text;
 
 }; // PGFormatType
 
@@ -104,6 +334,214 @@ using PGFormat = PGFormatType<>;
 
 
 
+///////////////////////////////////////////////////////////////////////////////
+/// Decode a text number, throws std::invalid_argument if buf is not one.
+/// Integers of up to 16 digits take the SWAR path on little endian hosts.
+template <typename T> T decodeNumber(const char *buf, int sz)
+{
+  if constexpr (std::is_integral_v<T>
+                && std::endian::native == std::endian::little)
+  {
+    bool neg = (sz > 0 && *buf == '-');
+    int n = sz - neg;
+    std::uint64_t u;
+    if (n > 0 && n <= 16 && (!neg || std::is_signed_v<T>)
+        && parseDigits(buf + neg, n, u))
+    {
+      auto s = neg ? -std::int64_t(u) : std::int64_t(u);
+      if (s >= std::int64_t(std::numeric_limits<T>::min())
+          && (s < 0 || u <= std::uint64_t(std::numeric_limits<T>::max())))
+      {
+        return static_cast<T>(s);
+      }
+    }
+  }
+
+  T v{};
+  auto [p, ec] = std::from_chars(buf, buf + sz, v);
+  if (ec != std::errc() || p != buf + sz) {
+    throw std::invalid_argument("decodeNumber");
+  }
+  return v;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// The statically selected decoder for a C++ type. accepts() tells if a
+/// column of the given type OID can be decoded into T.
+template <typename T> struct Decoder;
+
+template <> struct Decoder<bool>
+{
+  static bool accepts(int oid) { return oid == PG_BOOLOID; }
+  static bool decode(const char *buf, int sz) { return decodeBool(buf, sz); }
+};
+
+template <> struct Decoder<std::int16_t>
+{
+  static bool accepts(int oid) { return oid == PG_INT2OID; }
+  static std::int16_t decode(const char *buf, int sz)
+  {
+    return decodeNumber<std::int16_t>(buf, sz);
+  }
+};
+
+template <> struct Decoder<std::int32_t>
+{
+  static bool accepts(int oid)
+  {
+    return oid == PG_INT4OID || oid == PG_INT2OID;
+  }
+  static std::int32_t decode(const char *buf, int sz)
+  {
+    return decodeNumber<std::int32_t>(buf, sz);
+  }
+};
+
+template <> struct Decoder<std::int64_t>
+{
+  static bool accepts(int oid)
+  {
+    return oid == PG_INT8OID || oid == PG_INT4OID || oid == PG_INT2OID
+        || oid == PG_OIDOID;
+  }
+  static std::int64_t decode(const char *buf, int sz)
+  {
+    return decodeNumber<std::int64_t>(buf, sz);
+  }
+};
+
+template <> struct Decoder<std::uint32_t>
+{
+  static bool accepts(int oid) { return oid == PG_OIDOID; }
+  static std::uint32_t decode(const char *buf, int sz)
+  {
+    return decodeNumber<std::uint32_t>(buf, sz);
+  }
+};
+
+template <> struct Decoder<float>
+{
+  static bool accepts(int oid) { return oid == PG_FLOAT4OID; }
+  static float decode(const char *buf, int sz)
+  {
+    return decodeNumber<float>(buf, sz);
+  }
+};
+
+template <> struct Decoder<double>
+{
+  static bool accepts(int oid)
+  {
+    return oid == PG_FLOAT8OID || oid == PG_FLOAT4OID
+        || oid == PG_INT4OID || oid == PG_INT2OID;
+  }
+  static double decode(const char *buf, int sz)
+  {
+    return decodeNumber<double>(buf, sz);
+  }
+};
+
+/// Any column can be read as its text.
+template <> struct Decoder<std::string>
+{
+  static bool accepts(int) { return true; }
+  static std::string decode(const char *buf, int sz)
+  {
+    return std::string(buf, sz);
+  }
+};
+
+/// The view refers to buf, the caller must keep it alive.
+template <> struct Decoder<std::string_view>
+{
+  static bool accepts(int) { return true; }
+  static std::string_view decode(const char *buf, int sz)
+  {
+    return std::string_view(buf, sz);
+  }
+};
+
+/// ISO text only, see decodeDate().
+template <> struct Decoder<Date>
+{
+  static bool accepts(int oid) { return oid == PG_DATEOID; }
+  static Date decode(const char *buf, int sz) { return decodeDate(buf, sz); }
+};
+
+template <> struct Decoder<TimeOfDay>
+{
+  static bool accepts(int oid) { return oid == PG_TIMEOID; }
+  static TimeOfDay decode(const char *buf, int sz)
+  {
+    return decodeTime(buf, sz);
+  }
+};
+
+/// A timestamp without time zone is taken as UTC.
+template <> struct Decoder<Timestamp>
+{
+  static bool accepts(int oid)
+  {
+    return oid == PG_TIMESTAMPTZOID || oid == PG_TIMESTAMPOID;
+  }
+  static Timestamp decode(const char *buf, int sz)
+  {
+    return decodeTimestampTZ(buf, sz);
+  }
+};
+
+template <> struct Decoder<Interval>
+{
+  static bool accepts(int oid) { return oid == PG_INTERVALOID; }
+  static Interval decode(const char *buf, int sz)
+  {
+    return decodeInterval(buf, sz);
+  }
+};
+
+/// True if Decoder<T> reads only text in DateStyle ISO and IntervalStyle
+/// postgres, see ServerParameters::isoFormat(). A result checks the style
+/// with the RowDescription, as a cell in another style would not decode.
+template <typename T> inline constexpr bool iso_text_v = false;
+template <> inline constexpr bool iso_text_v<Date> = true;
+template <> inline constexpr bool iso_text_v<TimeOfDay> = true;
+template <> inline constexpr bool iso_text_v<Timestamp> = true;
+template <> inline constexpr bool iso_text_v<Interval> = true;
+template <typename T>
+inline constexpr bool iso_text_v<std::optional<T>> = iso_text_v<T>;
+
+/// NULL is std::nullopt, it is handled by the caller.
+template <typename T> struct Decoder<std::optional<T>>
+{
+  static bool accepts(int oid) { return Decoder<T>::accepts(oid); }
+  static std::optional<T> decode(const char *buf, int sz)
+  {
+    return Decoder<T>::decode(buf, sz);
+  }
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// A text cell, sz is -1 for NULL.
+struct TextCell
+{
+  const char *buf;
+  int sz;
+};
+
+/// Decode a column of text cells in one loop, a NULL decodes to T{}.
+template <typename T>
+void decodeColumn(std::span<const TextCell> cells, T *out)
+{
+  for (auto &c : cells)
+  {
+    *out++ = (c.sz < 0) ? T{} : Decoder<T>::decode(c.buf, c.sz);
+  }
+}
+
+
+
 
 
 //============================================================================
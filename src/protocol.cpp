@@ -18,6 +18,7 @@ namespace pv3 {
 
 const std::int32_t PROTOCOL_VERSION = 196608;
 const std::int32_t SSL_REQUEST_CODE = 80877103;
+const std::int32_t CANCEL_REQUEST_CODE = 80877102;
 
 
 //============================================================================
@@ -100,68 +101,22 @@ void serialize(const std::vector<decltype(pg::FieldSpec::type_oid)> &oid,
 
 
 //============================================================================
-//----------------------------------------------------------------------------
-template<typename T>
-Buffer::size_type deserialize(T &t, 
-                              const Buffer &buf,
-                              const Buffer::size_type pos = 0)
-{
-  return 0;
-}
-
-template<>
-Buffer::size_type deserialize(std::string &s,
-                              const Buffer &buf,
-                              const Buffer::size_type pos)
-{
-  s.clear();
-  auto tmp = reinterpret_cast<const char *>(buf.data() + pos);
-  while (*tmp) { s.push_back(*tmp++); }
-  return s.size() + 1;
-}
-
-
-//----------------------------------------------------------------------------
-Buffer::size_type deserializeInt16(int &t,
-                                   const Buffer &b,
-                                   const Buffer::size_type pos = 0)
-{
-  auto tmp = reinterpret_cast<const std::uint16_t *>(b.data() + pos);
-  t = ntohs(*tmp);
-  return sizeof(std::uint16_t);
-}
-
-
-//----------------------------------------------------------------------------
-Buffer::size_type deserializeInt32(int &t,
-                                   const Buffer &b,
-                                   const Buffer::size_type pos = 0)
+/// The body of a received message, checked against the expected type.
+std::error_code body(const Header &header,
+                     const Buffer &buf,
+                     MessageType mtype,
+                     std::span<const char> &body)
 {
-  auto tmp = reinterpret_cast<const std::uint32_t *>(b.data() + pos);
-  t = ntohl(*tmp);
-  return sizeof(std::uint32_t);
-}
-
-
-//----------------------------------------------------------------------------
-Buffer::size_type deserializeByte1(char &c,
-                                   const Buffer &buf,
-                                   const Buffer::size_type pos = 0)
-{
-  auto tmp = reinterpret_cast<const char *>(buf.data() + pos);
-  c = *tmp;
-  return 1;
-}
+  if (header.bodyLen() < 0 || buf.size() < std::size_t(header.bodyLen())) {
+    return std::error_code(EMSGSIZE, std::generic_category());
+  }
 
+  if (header.messageType() != mtype) {
+    return std::error_code(EBADMSG, std::generic_category());
+  }
 
-//----------------------------------------------------------------------------
-Buffer::size_type deserializeByte4(Byte4 &a,
-                                   const Buffer &buf,
-                                   const Buffer::size_type pos = 0)
-{
-  auto tmp = reinterpret_cast<const unsigned char *>(buf.data() + pos);
-  for (auto &c : a) { c = *tmp++; }
-  return 4;
+  body = std::span<const char>(buf.data(), header.bodyLen());
+  return {};
 }
 
 
@@ -184,19 +139,18 @@ std::error_code Header::serialize(Buffer &buf) const
 //----------------------------------------------------------------------------
 std::error_code Header::deserialize(const Buffer &buf)
 {
-  std::error_code ec;
-
-  if (buf.size() < Header::size()) {
-    return std::error_code(EMSGSIZE, std::generic_category());
+  Reader rd(buf);
+  if (!rd.byte1(m_mtype) || !rd.int32(m_body_length)) {
+    return rd.error();
   }
-
-  auto pos = pv3::deserializeByte1(m_mtype, buf);
-  pos = pv3::deserializeInt32(m_body_length, buf, pos);
   m_body_length -= 4;
+  if (m_body_length < 0) {
+    return std::error_code(EBADMSG, std::generic_category());
+  }
 
   //DBG("mtype=" << m_mtype << ", len=" << m_body_length);
 
-  return ec;
+  return {};
 }
 
 
@@ -241,6 +195,17 @@ std::error_code SSLRequest::serialize(Buffer &buf) const
 
 
 
+//////////////////////////////////////////////////////////////////////////////
+std::error_code CancelRequest::serialize(Buffer &buf) const
+{
+  serializeInt32(pv3::CANCEL_REQUEST_CODE, buf);
+  serializeInt32(m_pid, buf);
+  serializeInt32(m_key, buf);
+  return std::error_code();
+}
+
+
+
 //////////////////////////////////////////////////////////////////////////////
 //----------------------------------------------------------------------------
 StartUp::StartUp(const Option &option) : m_dboption(option) {}
@@ -250,7 +215,15 @@ StartUp::StartUp(const Option &option) : m_dboption(option) {}
 std::error_code StartUp::serialize(Buffer &buf) const
 {
   serializeInt32(pv3::PROTOCOL_VERSION, buf);
-  pv3::serialize(m_dboption, buf);
+
+  // The options of the client, such as host or sslmode, are not sent.
+  for (auto &c : m_dboption)
+  {
+    if (!util::isStartupOption(c.first)) { continue; }
+    pv3::serialize(c.first, buf);
+    pv3::serialize(c.second, buf);
+  }
+  buf.push_back(0);
 
   return std::error_code();
 }
@@ -262,25 +235,27 @@ std::error_code StartUp::serialize(Buffer &buf) const
 std::error_code Authentication::deserialize(const Header &header,
                                             const Buffer &buf)
 {
-  std::error_code ec;
-
-  if (buf.size() < header.bodyLen()) {
-    return std::error_code(EMSGSIZE, std::generic_category());
-  }
+  std::span<const char> b, data;
+  auto ec = pv3::body(header, buf, messageType(), b);
+  if (ec) { return ec; }
 
-  if (header.messageType() != messageType()) {
-    return std::error_code(EBADMSG, std::generic_category());
-  }
+  ec = decodeAuthentication(b, m_auth_type, data);
+  if (ec) { return ec; }
 
-  auto pos = pv3::deserializeInt32(m_auth_type, buf);
+  switch (authType())
+  {
+    case AUTH_MD5_PASSWORD:
+      if (data.size() < m_salt.size()) {
+        return std::error_code(EMSGSIZE, std::generic_category());
+      }
+      std::memcpy(m_salt.data(), data.data(), m_salt.size());
+    break;
 
-  if (header.bodyLen() > 4) {
-    switch (authType())
-    {
-      case AUTH_MD5_PASSWORD:
-        pos = deserializeByte4(m_salt, buf, pos);
-      break;
-    }
+    case AUTH_SASL:
+    case AUTH_SASL_CONTINUE:
+    case AUTH_SASL_FINAL:
+      m_data.assign(data.data(), data.size());
+    break;
   }
 
   //DBG("auth=" << buf);
@@ -312,17 +287,10 @@ std::error_code Bind::serialize(Buffer &buf) const
 
 //////////////////////////////////////////////////////////////////////////////
 std::error_code BindComplete::deserialize(const Header &header,
-                                          const Buffer &buf)
+                                           const Buffer &buf)
 {
-  if (buf.size() < header.bodyLen()) {
-    return std::error_code(EMSGSIZE, std::generic_category());
-  }
-
-  if (header.messageType() != messageType()) {
-    return std::error_code(EBADMSG, std::generic_category());
-  }
-
-  return {};
+  std::span<const char> b;
+  return pv3::body(header, buf, messageType(), b);
 }
 
 
@@ -361,17 +329,10 @@ std::error_code Execute::serialize(Buffer &buf) const
 
 //////////////////////////////////////////////////////////////////////////////
 std::error_code CloseComplete::deserialize(const Header &header,
-                                           const Buffer &buf)
+                                            const Buffer &buf)
 {
-  if (buf.size() < header.bodyLen()) {
-    return std::error_code(EMSGSIZE, std::generic_category());
-  }
-
-  if (header.messageType() != messageType()) {
-    return std::error_code(EBADMSG, std::generic_category());
-  }
-
-  return {};
+  std::span<const char> b;
+  return pv3::body(header, buf, messageType(), b);
 }
 
 
@@ -380,28 +341,14 @@ std::error_code CloseComplete::deserialize(const Header &header,
 std::error_code NoticeResponse::deserialize(const Header &header,
                                             const Buffer &buf)
 {
-  std::error_code ec;
-
-  if (buf.size() < header.bodyLen()) {
-    return std::error_code(EMSGSIZE, std::generic_category());
-  }
-
-  if (header.messageType() != messageType()) {
-    return std::error_code(EBADMSG, std::generic_category());
-  }
-
-  char field_type;
-  auto pos = pv3::deserializeByte1(field_type, buf);
+  std::span<const char> b;
+  auto ec = pv3::body(header, buf, messageType(), b);
+  if (ec) { return ec; }
 
-  while (field_type)
+  return decodeFields(b, [this](SQLErrorField f, std::string_view v)
   {
-    std::string tmp;
-    pos += pv3::deserialize(tmp, buf, pos);
-    m_error.emplace(static_cast<SQLErrorField>(field_type), tmp);
-    pos += pv3::deserializeByte1(field_type, buf, pos);
-  }
-
-  return {};
+    m_error[f] = v;
+  });
 }
 
 
@@ -410,25 +357,11 @@ std::error_code ParameterDescription::deserialize(const Header &header,
                               const Buffer &buf,
                               std::vector<decltype(pg::FieldSpec::type_oid)> &v)
 {
-  if (buf.size() < header.bodyLen()) {
-    return std::error_code(EMSGSIZE, std::generic_category());
-  }
-
-  if (header.messageType() != messageType()) {
-    return std::error_code(EBADMSG, std::generic_category());
-  }
-
-  int num;
-  auto pos = pv3::deserializeInt16(num, buf);
-
-  decltype(pg::FieldSpec::type_oid) oid;
-  for (auto i = 0; i < num; ++i)
-    {
-    pos += pv3::deserializeInt32(oid, buf, pos);
-    v.push_back(oid);
-  }
+  std::span<const char> b;
+  auto ec = pv3::body(header, buf, messageType(), b);
+  if (ec) { return ec; }
 
-  return {};
+  return decodeParameterDescription(b, v);
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -444,19 +377,10 @@ std::error_code Parse::serialize(Buffer &buf) const
 
 //////////////////////////////////////////////////////////////////////////////
 std::error_code ParseComplete::deserialize(const Header &header,
-                                           const Buffer &buf)
+                                            const Buffer &buf)
 {
-  std::error_code ec;
-
-  if (buf.size() < header.bodyLen()) {
-    return std::error_code(EMSGSIZE, std::generic_category());
-  }
-
-  if (header.messageType() != messageType()) {
-    return std::error_code(EBADMSG, std::generic_category());
-  }
-
-  return {};
+  std::span<const char> b;
+  return pv3::body(header, buf, messageType(), b);
 }
 
 
@@ -489,6 +413,25 @@ std::error_code Password::serialize(Buffer &buf) const
 
 
 
+//////////////////////////////////////////////////////////////////////////////
+std::error_code SASLInitialResponse::serialize(Buffer &buf) const
+{
+  pv3::serialize(m_mechanism, buf);
+  pv3::serializeInt32(m_data.size(), buf);
+  pv3::serializeByte(m_data, buf);
+  return {};
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+std::error_code SASLResponse::serialize(Buffer &buf) const
+{
+  pv3::serializeByte(m_data, buf);
+  return {};
+}
+
+
+
 //////////////////////////////////////////////////////////////////////////////
 //----------------------------------------------------------------------------
 Query::Query(const std::string &q) : m_query{q} {}
@@ -507,34 +450,11 @@ std::error_code RowDescription::deserialize(const Header &header,
                                             const Buffer &buf,
                                             std::vector<pg::FieldSpec> &fsvec)
 {
-  std::error_code ec;
-
-  if (buf.size() < header.bodyLen()) {
-    return std::error_code(EMSGSIZE, std::generic_category());
-  }
-
-  if (header.messageType() != messageType()) {
-    return std::error_code(EBADMSG, std::generic_category());
-  }
-
-  int num;
-  auto pos = pv3::deserializeInt16(num, buf);
-
-  pg::FieldSpec fs;
-  for (auto i = 0; i < num; ++i)
-  {
-    pos += pv3::deserialize(fs.name, buf, pos);
-    pos += pv3::deserializeInt32(fs.table_oid, buf, pos);
-    pos += pv3::deserializeInt16(fs.col_num, buf, pos);
-    pos += pv3::deserializeInt32(fs.type_oid, buf, pos);
-    pos += pv3::deserializeInt16(fs.type_size, buf, pos);
-    pos += pv3::deserializeInt32(fs.type_mod, buf, pos);
-    pos += pv3::deserializeInt16(fs.type_format, buf, pos);
-
-    fsvec.push_back(fs);
-  }
+  std::span<const char> b;
+  auto ec = pv3::body(header, buf, messageType(), b);
+  if (ec) { return ec; }
 
-  return ec;
+  return decodeRowDescription(b, fsvec);
 }
 
 
@@ -543,18 +463,16 @@ std::error_code RowDescription::deserialize(const Header &header,
 std::error_code ParameterStatus::deserialize(const Header &header,
                                              const Buffer &buf)
 {
-  std::error_code ec;
-
-  if (buf.size() < header.bodyLen()) {
-    return std::error_code(EMSGSIZE, std::generic_category());
-  }
+  std::span<const char> b;
+  auto ec = pv3::body(header, buf, messageType(), b);
+  if (ec) { return ec; }
 
-  if (header.messageType() != messageType()) {
-    return std::error_code(EBADMSG, std::generic_category());
-  }
+  std::string_view name, value;
+  ec = decodeParameterStatus(b, name, value);
+  if (ec) { return ec; }
 
-  auto pos = pv3::deserialize(m_name, buf);
-  pos += pv3::deserialize(m_value, buf, pos);
+  m_name = name;
+  m_value = value;
 
   //DBG(m_name << "=" << m_value);
   return ec;
@@ -565,19 +483,11 @@ std::error_code ParameterStatus::deserialize(const Header &header,
 std::error_code BackendKeyData::deserialize(const Header &header,
                                             const Buffer &buf)
 {
-  std::error_code ec;
-
-  if (buf.size() < header.bodyLen()) {
-    return std::error_code(EMSGSIZE, std::generic_category());
-  }
-
-  if (header.messageType() != messageType()) {
-    return std::error_code(EBADMSG, std::generic_category());
-  }
+  std::span<const char> b;
+  auto ec = pv3::body(header, buf, messageType(), b);
+  if (ec) { return ec; }
 
-  auto pos = pv3::deserializeInt32(m_pid, buf);
-  pos += pv3::deserializeInt32(m_key, buf, pos);
-  return ec;
+  return decodeBackendKeyData(b, m_pid, m_key);
 }
 
 
@@ -585,49 +495,25 @@ std::error_code BackendKeyData::deserialize(const Header &header,
 std::error_code ReadyForQuery::deserialize(const Header &header,
                                            const Buffer &buf)
 {
-  std::error_code ec;
-
-  if (buf.size() < header.bodyLen()) {
-    return std::error_code(EMSGSIZE, std::generic_category());
-  }
-
-  if (header.messageType() != messageType()) {
-    return std::error_code(EBADMSG, std::generic_category());
-  }
+  std::span<const char> b;
+  auto ec = pv3::body(header, buf, messageType(), b);
+  if (ec) { return ec; }
 
-  auto pos = pv3::deserializeByte1(m_status, buf);
-  return ec;
+  return decodeReadyForQuery(b, m_status);
 }
 
 
 //////////////////////////////////////////////////////////////////////////////
 std::error_code DataRow::deserialize(const Header &header,
                                      const Buffer &buf,
-                                     ResultBase &res)
+                                     ResultBase &res,
+                                     std::size_t columns)
 {
-  std::error_code ec;
-
-  if (buf.size() < header.bodyLen()) {
-    return std::error_code(EMSGSIZE, std::generic_category());
-  }
-
-  if (header.messageType() != messageType()) {
-    return std::error_code(EBADMSG, std::generic_category());
-  }
-
-  int num;
-  auto pos = pv3::deserializeInt16(num, buf);
-
-  int sz;
-  res.add_row();
-  for (int i = 0; i < num; ++i)
-  {
-    pos += pv3::deserializeInt32(sz, buf, pos);
-    res.add_column(i, buf.data() + pos, sz);
-    pos += sz;
-  }
+  std::span<const char> b;
+  auto ec = pv3::body(header, buf, messageType(), b);
+  if (ec) { return ec; }
 
-  return ec;
+  return decodeDataRow(b, res, columns);
 }
 
 
@@ -636,17 +522,13 @@ std::error_code DataRow::deserialize(const Header &header,
 std::error_code CommandComplete::deserialize(const Header &header,
                                              const Buffer &buf)
 {
-  std::error_code ec;
-
-  if (buf.size() < header.bodyLen()) {
-    return std::error_code(EMSGSIZE, std::generic_category());
-  }
-
-  if (header.messageType() != messageType()) {
-    return std::error_code(EBADMSG, std::generic_category());
-  }
+  std::span<const char> b;
+  auto ec = pv3::body(header, buf, messageType(), b);
+  if (ec) { return ec; }
 
-  auto pos = pv3::deserialize(m_tag, buf);
+  std::string_view tag;
+  ec = decodeCommandComplete(b, tag);
+  m_tag = tag;
 
   //DBG("tag=" << m_tag);
   return ec;
@@ -661,29 +543,162 @@ std::error_code CommandComplete::deserialize(const Header &header,
 std::error_code ErrorResponse::deserialize(const Header &header,
                                            const Buffer &buf)
 {
-  std::error_code ec;
+  std::span<const char> b;
+  auto ec = pv3::body(header, buf, messageType(), b);
+  if (ec) { return ec; }
+
+  return decodeFields(b, [this](SQLErrorField f, std::string_view v)
+  {
+    m_error[f] = v;
+  });
+}
 
-  if (buf.size() < header.bodyLen()) {
-    return std::error_code(EMSGSIZE, std::generic_category());
-  }
 
-  if (header.messageType() != messageType()) {
+//============================================================================
+std::error_code decodeAuthentication(std::span<const char> body,
+                                     int &auth_type,
+                                     std::span<const char> &data)
+{
+  Reader rd(body);
+  if (!rd.int32(auth_type)) { return rd.error(); }
+
+  rd.bytes(rd.remaining(), data);
+  return rd.error();
+}
+
+
+//----------------------------------------------------------------------------
+std::error_code decodeBackendKeyData(std::span<const char> body,
+                                     int &pid, int &key)
+{
+  Reader rd(body);
+  rd.int32(pid) && rd.int32(key);
+  return rd.error();
+}
+
+
+//----------------------------------------------------------------------------
+std::error_code decodeCommandComplete(std::span<const char> body,
+                                      std::string_view &tag)
+{
+  Reader rd(body);
+  rd.string(tag);
+  return rd.error();
+}
+
+
+//----------------------------------------------------------------------------
+std::error_code decodeDataRow(std::span<const char> body, ResultBase &res,
+                              std::size_t columns)
+{
+  Reader rd(body);
+
+  int num;
+  if (!rd.int16(num)) { return rd.error(); }
+  if (num < 0 || std::size_t(num) != columns) {
     return std::error_code(EBADMSG, std::generic_category());
   }
 
-  char field_type;
-  auto pos = pv3::deserializeByte1(field_type, buf);
+  // Check every cell first, a truncated row must not be half added.
+  int sz;
+  std::span<const char> col;
+  Reader check(rd);
+  for (int i = 0; i < num; ++i)
+  {
+    if (!check.int32(sz) || (sz >= 0 && !check.bytes(sz, col))) {
+      return check.error();
+    }
+  }
+
+  if (res.add_raw_row(body)) { return {}; }
 
-  while (field_type)
+  res.add_row();
+  for (int i = 0; i < num; ++i)
   {
-    std::string tmp;
-    pos += pv3::deserialize(tmp, buf, pos);
-    m_error.emplace(static_cast<SQLErrorField>(field_type), tmp);
-    pos += pv3::deserializeByte1(field_type, buf, pos);
+    rd.int32(sz);
+    if (sz < 0) {                       // NULL
+      res.add_column(i, nullptr, -1);
+      continue;
+    }
+
+    rd.bytes(sz, col);
+    res.add_column(i, col.data(), sz);
   }
 
+  return {};
+}
 
-  return ec;
+
+//----------------------------------------------------------------------------
+std::error_code decodeParameterDescription(std::span<const char> body,
+                    std::vector<decltype(pg::FieldSpec::type_oid)> &v)
+{
+  Reader rd(body);
+
+  int num;
+  if (!rd.int16(num)) { return rd.error(); }
+
+  decltype(pg::FieldSpec::type_oid) oid;
+  for (auto i = 0; i < num; ++i)
+  {
+    if (!rd.int32(oid)) { return rd.error(); }
+    v.push_back(oid);
+  }
+
+  return {};
+}
+
+
+//----------------------------------------------------------------------------
+std::error_code decodeParameterStatus(std::span<const char> body,
+                                      std::string_view &name,
+                                      std::string_view &value)
+{
+  Reader rd(body);
+  rd.string(name) && rd.string(value);
+  return rd.error();
+}
+
+
+//----------------------------------------------------------------------------
+std::error_code decodeReadyForQuery(std::span<const char> body, char &status)
+{
+  Reader rd(body);
+  rd.byte1(status);
+  return rd.error();
+}
+
+
+//----------------------------------------------------------------------------
+std::error_code decodeRowDescription(std::span<const char> body,
+                                     std::vector<pg::FieldSpec> &fsvec)
+{
+  Reader rd(body);
+
+  int num;
+  if (!rd.int16(num)) { return rd.error(); }
+
+  fsvec.resize(num < 0 ? 0 : num);
+
+  std::string_view name;
+  for (auto &fs : fsvec)
+  {
+    if (!(rd.string(name) &&
+          rd.int32(fs.table_oid) &&
+          rd.int16(fs.col_num) &&
+          rd.int32(fs.type_oid) &&
+          rd.int16(fs.type_size) &&
+          rd.int32(fs.type_mod) &&
+          rd.int16(fs.type_format)))
+    {
+      fsvec.clear();
+      return rd.error();
+    }
+
+    fs.name = name;
+  }
+
+  return {};
 }
 
 
@@ -7,8 +7,11 @@
 #include <iostream>
 #include <system_error>
 #include <cstdint>
+#include <cstring>
 #include <map>
 #include <array>
+#include <span>
+#include <string_view>
 
 #include "types.h"
 #include "util.h"
@@ -51,6 +54,132 @@ private:
 
 
 
+///////////////////////////////////////////////////////////////////////////////
+/// Bounds checked reader over a message body. Every read checks the remaining
+/// length first. A failed read sets error() and returns false.
+class Reader {
+public:
+  explicit Reader(std::span<const char> buf) : m_buf(buf), m_pos(0) {}
+
+  std::size_t remaining() const { return m_buf.size() - m_pos; }
+  const std::error_code &error() const { return m_ec; }
+
+  //------------------------------------------------------------------------
+  bool byte1(char &c)
+  {
+    if (!need(1)) { return false; }
+    c = m_buf[m_pos++];
+    return true;
+  }
+
+  bool int16(int &v)
+  {
+    if (!need(2)) { return false; }
+    auto p = reinterpret_cast<const unsigned char *>(m_buf.data() + m_pos);
+    v = static_cast<std::int16_t>((p[0] << 8) | p[1]);
+    m_pos += 2;
+    return true;
+  }
+
+  bool int32(int &v)
+  {
+    if (!need(4)) { return false; }
+    auto p = reinterpret_cast<const unsigned char *>(m_buf.data() + m_pos);
+    v = static_cast<std::int32_t>((std::uint32_t{p[0]} << 24) |
+                                  (std::uint32_t{p[1]} << 16) |
+                                  (std::uint32_t{p[2]} << 8) | p[3]);
+    m_pos += 4;
+    return true;
+  }
+
+  bool bytes(std::size_t n, std::span<const char> &v)
+  {
+    if (!need(n)) { return false; }
+    v = m_buf.subspan(m_pos, n);
+    m_pos += n;
+    return true;
+  }
+
+  /// A null terminated string, the terminator is not part of s.
+  bool string(std::string_view &s)
+  {
+    auto begin = m_buf.data() + m_pos;
+    auto end = static_cast<const char *>(std::memchr(begin, 0, remaining()));
+    if (!end) { return fail(); }
+
+    s = std::string_view(begin, end - begin);
+    m_pos += s.size() + 1;
+    return true;
+  }
+
+//----------------------------------------------------------------------------
+private:
+  bool need(std::size_t n) { return (remaining() >= n) ? true : fail(); }
+
+  bool fail()
+  {
+    m_ec = std::error_code(EMSGSIZE, std::generic_category());
+    return false;
+  }
+
+  std::span<const char> m_buf;
+  std::size_t m_pos;
+  std::error_code m_ec;
+
+}; // Reader
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// Decode backend message bodies without constructing a Message. Values are
+/// views into body or are passed straight to the sink.
+std::error_code decodeAuthentication(std::span<const char> body,
+                                     int &auth_type,
+                                     std::span<const char> &data);
+
+std::error_code decodeBackendKeyData(std::span<const char> body,
+                                     int &pid, int &key);
+
+std::error_code decodeCommandComplete(std::span<const char> body,
+                                      std::string_view &tag);
+
+/// EBADMSG if the row does not have the columns of its RowDescription.
+std::error_code decodeDataRow(std::span<const char> body, ResultBase &res,
+                              std::size_t columns);
+
+std::error_code decodeParameterDescription(std::span<const char> body,
+                    std::vector<decltype(pg::FieldSpec::type_oid)> &oid);
+
+std::error_code decodeParameterStatus(std::span<const char> body,
+                                      std::string_view &name,
+                                      std::string_view &value);
+
+std::error_code decodeReadyForQuery(std::span<const char> body, char &status);
+
+std::error_code decodeRowDescription(std::span<const char> body,
+                                     std::vector<pg::FieldSpec> &fsvec);
+
+
+//----------------------------------------------------------------------------
+/// Calls f(SQLErrorField, std::string_view) for every field of an
+/// ErrorResponse or NoticeResponse body.
+template<typename F>
+std::error_code decodeFields(std::span<const char> body, F &&f)
+{
+  Reader rd(body);
+  char field_type;
+  std::string_view value;
+
+  while (rd.byte1(field_type) && field_type)
+  {
+    if (!rd.string(value)) { break; }
+    f(static_cast<SQLErrorField>(field_type), value);
+  }
+  return rd.error();
+}
+
+
+
 ///////////////////////////////////////////////////////////////////////////////
 /// A Protocol Message.
 class Message {
@@ -85,6 +214,26 @@ private:
 
 
 
+///////////////////////////////////////////////////////////////////////////////
+/// Sent on a new connection to cancel the query running on the backend
+/// identified by BackendKeyData.
+class CancelRequest : public Message {
+public:
+  CancelRequest(int pid, int key) : m_pid(pid), m_key(key) {}
+
+  static constexpr MessageType mtype() { return 0; }
+  MessageType messageType() const override { return mtype(); }
+  std::error_code serialize(Buffer &buf) const override;
+
+//----------------------------------------------------------------------------
+private:
+  int m_pid;
+  int m_key;
+
+}; // CancelRequest
+
+
+
 ///////////////////////////////////////////////////////////////////////////////
 ///
 class StartUp : public Message {
@@ -117,15 +266,23 @@ public:
   static const int AUTH_OK = 0;
   static const int AUTH_KERBEROS_V5 = 2;
   static const int AUTH_MD5_PASSWORD = 5;
+  static const int AUTH_SASL = 10;
+  static const int AUTH_SASL_CONTINUE = 11;
+  static const int AUTH_SASL_FINAL = 12;
 
   int authType() const { return m_auth_type; }
   const Byte4 &salt() const { return m_salt; }
 
+  /// The mechanisms of AUTH_SASL, NUL separated, or the SASL data of
+  /// AUTH_SASL_CONTINUE and AUTH_SASL_FINAL.
+  const std::string &data() const { return m_data; }
+
 
 //----------------------------------------------------------------------------
 private:
   int m_auth_type;
   Byte4 m_salt;
+  std::string m_data;
 
 }; // Authentication
 
@@ -136,7 +293,7 @@ class Bind : public Message {
 public:
   Bind(const std::string &name,
        const std::string &portal,
-       const std::vector<std::string> &bind)
+       std::span<const std::string> bind)
     : m_name(name), m_portal(portal), m_bind(bind)
   {}
 
@@ -148,7 +305,7 @@ public:
 private:
   const std::string &m_name;
   const std::string &m_portal;
-  const std::vector<std::string> &m_bind;
+  std::span<const std::string> m_bind;
 
 }; // Bind
 
@@ -336,6 +493,49 @@ private:
 
 
 
+///////////////////////////////////////////////////////////////////////////////
+/// First SASL message: the chosen mechanism and its initial response.
+class SASLInitialResponse : public Message
+{
+public:
+  SASLInitialResponse(const std::string &mechanism, const std::string &data)
+    : m_mechanism(mechanism), m_data(data)
+  {}
+
+  static constexpr MessageType mtype() { return 'p'; };
+  MessageType messageType() const override { return mtype(); }
+
+  std::error_code serialize(Buffer &buf) const override;
+
+//----------------------------------------------------------------------------
+private:
+  const std::string &m_mechanism;
+  const std::string &m_data;
+
+}; // SASLInitialResponse
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+///
+class SASLResponse : public Message
+{
+public:
+  SASLResponse(const std::string &data) : m_data(data) {}
+
+  static constexpr MessageType mtype() { return 'p'; };
+  MessageType messageType() const override { return mtype(); }
+
+  std::error_code serialize(Buffer &buf) const override;
+
+//----------------------------------------------------------------------------
+private:
+  const std::string &m_data;
+
+}; // SASLResponse
+
+
+
 ///////////////////////////////////////////////////////////////////////////////
 ///
 class Query : public Message
@@ -428,7 +628,8 @@ public:
   static constexpr MessageType mtype() { return 'D'; };
   MessageType messageType() const override { return mtype(); }
 
-  std::error_code deserialize(const Header &header, const Buffer &buf, ResultBase &res);
+  std::error_code deserialize(const Header &header, const Buffer &buf,
+                              ResultBase &res, std::size_t columns);
 
 };
 
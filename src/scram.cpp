@@ -0,0 +1,300 @@
+
+/// @file scram.cpp
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+
+#include <charconv>
+#include <cstring>
+#include <map>
+#include <mutex>
+
+#include "error.h"
+#include "scram.h"
+
+
+namespace lapq {
+namespace pv3 {
+///////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+using Key = Scram::Key;
+
+//----------------------------------------------------------------------------
+Key hmac(const Key &key, std::string_view msg)
+{
+  Key out;
+  unsigned int len = out.size();
+  HMAC(EVP_sha256(), key.data(), key.size(),
+       reinterpret_cast<const unsigned char *>(msg.data()), msg.size(),
+       out.data(), &len);
+  return out;
+}
+
+
+//----------------------------------------------------------------------------
+Key sha256(std::string_view s)
+{
+  Key out;
+  SHA256(reinterpret_cast<const unsigned char *>(s.data()), s.size(),
+         out.data());
+  return out;
+}
+
+
+//----------------------------------------------------------------------------
+std::string_view view(const Key &k)
+{
+  return {reinterpret_cast<const char *>(k.data()), k.size()};
+}
+
+
+//----------------------------------------------------------------------------
+/// The value of attribute name (e.g. 'r') in a comma separated message.
+bool attribute(std::string_view msg, char name, std::string_view &value)
+{
+  while (!msg.empty())
+  {
+    auto end = msg.find(',');
+    auto attr = msg.substr(0, end);
+    if (attr.size() >= 2 && attr[0] == name && attr[1] == '=') {
+      value = attr.substr(2);
+      return true;
+    }
+    if (end == std::string_view::npos) { break; }
+    msg.remove_prefix(end + 1);
+  }
+  return false;
+}
+
+
+//----------------------------------------------------------------------------
+/// The username with ',' and '=' escaped, RFC 5802 5.1.
+std::string saslName(const std::string &user)
+{
+  std::string s;
+  for (auto c : user)
+  {
+    if (c == ',') { s += "=2C"; }
+    else if (c == '=') { s += "=3D"; }
+    else { s += c; }
+  }
+  return s;
+}
+
+
+//----------------------------------------------------------------------------
+std::error_code protocolError()
+{
+  return std::error_code(EPROTO, std::generic_category());
+}
+
+
+//----------------------------------------------------------------------------
+/// ClientKey and ServerKey of a SaltedPassword.
+struct CachedKeys
+{
+  Key client_key;
+  Key server_key;
+};
+
+std::mutex s_mutex;
+std::map<std::string, CachedKeys> s_keys;   // by cacheKey()
+
+
+//----------------------------------------------------------------------------
+/// The random HMAC key of the cache keys, nothing is cached without it.
+const Key *secret()
+{
+  static const auto key = []
+  {
+    Key k;
+    return std::make_pair(RAND_bytes(k.data(), k.size()) == 1, k);
+  }();
+  return key.first ? &key.second : nullptr;
+}
+
+
+//----------------------------------------------------------------------------
+/// Salt, iterations and the HMAC of the password, empty without a secret.
+std::string cacheKey(const std::string &password, const std::string &salt,
+                     int iterations)
+{
+  auto key = secret();
+  if (!key) { return {}; }
+  return salt + '\0' + std::to_string(iterations) + '\0'
+         + std::string(view(hmac(*key, password)));
+}
+
+} // namespace
+
+
+
+//////////////////////////////////////////////////////////////////////////////
+std::string base64Encode(std::string_view s)
+{
+  std::string out(4 * ((s.size() + 2) / 3), '\0');
+  auto len = EVP_EncodeBlock(reinterpret_cast<unsigned char *>(out.data()),
+               reinterpret_cast<const unsigned char *>(s.data()), s.size());
+  out.resize(len);
+  return out;
+}
+
+
+//----------------------------------------------------------------------------
+bool base64Decode(std::string_view s, std::string &out)
+{
+  if (s.size() % 4 != 0) { return false; }
+
+  out.resize(3 * s.size() / 4);
+  auto len = EVP_DecodeBlock(reinterpret_cast<unsigned char *>(out.data()),
+               reinterpret_cast<const unsigned char *>(s.data()), s.size());
+  if (len < 0) { return false; }
+
+  // EVP_DecodeBlock counts the padding as data
+  if (!s.empty() && s.back() == '=') { --len; }
+  if (s.size() > 1 && s[s.size() - 2] == '=') { --len; }
+  out.resize(len);
+  return true;
+}
+
+
+
+//////////////////////////////////////////////////////////////////////////////
+Scram::Scram(const std::string &user, const std::string &password,
+             const std::string &nonce)
+  : m_user(user), m_password(password), m_nonce(nonce)
+{
+  if (m_nonce.empty()) {
+    unsigned char raw[18];
+    if (RAND_bytes(raw, sizeof(raw)) != 1) {
+      m_error = std::make_error_code(std::errc::resource_unavailable_try_again);
+      return;
+    }
+    m_nonce = base64Encode({reinterpret_cast<const char *>(raw), sizeof(raw)});
+  }
+}
+
+
+//----------------------------------------------------------------------------
+/// "n,," declares no channel binding.
+std::string Scram::clientFirst() const
+{
+  return "n,,n=" + saslName(m_user) + ",r=" + m_nonce;
+}
+
+
+//----------------------------------------------------------------------------
+std::error_code Scram::serverFirst(std::string_view msg, std::string &final)
+{
+  if (m_error) { return m_error; }
+
+  std::string_view nonce, salt64, iter;
+  if (!attribute(msg, 'r', nonce) || !attribute(msg, 's', salt64)
+      || !attribute(msg, 'i', iter))
+  {
+    return protocolError();
+  }
+
+  // The server nonce extends ours.
+  if (nonce.size() <= m_nonce.size() || nonce.substr(0, m_nonce.size())
+                                        != m_nonce)
+  {
+    return protocolError();
+  }
+
+  std::string salt;
+  int iterations = 0;
+  auto end = iter.data() + iter.size();
+  auto r = std::from_chars(iter.data(), end, iterations);
+  if (!base64Decode(salt64, salt) || r.ec != std::errc() || r.ptr != end
+      || iterations < 1)
+  {
+    return protocolError();
+  }
+
+  Key client_key;
+  keys(m_password, salt, iterations, client_key, m_server_key);
+
+  std::string without_proof = "c=biws,r=" + std::string(nonce);
+  m_auth_message = clientFirst().substr(3) + "," + std::string(msg) + ","
+                   + without_proof;
+
+  auto signature = hmac(sha256(view(client_key)), m_auth_message);
+  Key proof;
+  for (std::size_t i = 0; i < proof.size(); ++i) {
+    proof[i] = client_key[i] ^ signature[i];
+  }
+
+  final = without_proof + ",p=" + base64Encode(view(proof));
+  return {};
+}
+
+
+//----------------------------------------------------------------------------
+std::error_code Scram::serverFinal(std::string_view msg) const
+{
+  std::string_view v64;
+  std::string v;
+  if (!attribute(msg, 'v', v64) || !base64Decode(v64, v)) {
+    return protocolError();
+  }
+
+  auto signature = hmac(m_server_key, m_auth_message);
+  if (v != view(signature)) {
+    return make_error_code(lapq::errc::server_signature);
+  }
+  return {};
+}
+
+
+//----------------------------------------------------------------------------
+/// When the cache is full an arbitrary entry makes room, as in the
+/// SessionCache.
+void Scram::keys(const std::string &password, const std::string &salt,
+                 int iterations, Key &client_key, Key &server_key)
+{
+  auto id = cacheKey(password, salt, iterations);
+  if (!id.empty()) {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    auto it = s_keys.find(id);
+    if (it != s_keys.end()) {
+      client_key = it->second.client_key;
+      server_key = it->second.server_key;
+      return;
+    }
+  }
+
+  Key salted;
+  PKCS5_PBKDF2_HMAC(password.data(), password.size(),
+                    reinterpret_cast<const unsigned char *>(salt.data()),
+                    salt.size(), iterations, EVP_sha256(),
+                    salted.size(), salted.data());
+
+  client_key = hmac(salted, "Client Key");
+  server_key = hmac(salted, "Server Key");
+  OPENSSL_cleanse(salted.data(), salted.size());
+  if (id.empty()) { return; }
+
+  std::lock_guard<std::mutex> lock(s_mutex);
+  if (s_keys.size() >= MAX_CACHED && s_keys.find(id) == s_keys.end()) {
+    s_keys.erase(s_keys.begin());
+  }
+  s_keys[id] = {client_key, server_key};
+}
+
+
+//----------------------------------------------------------------------------
+std::size_t Scram::cached()
+{
+  std::lock_guard<std::mutex> lock(s_mutex);
+  return s_keys.size();
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+} // namespace pv3
+} // namespace lapq
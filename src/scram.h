@@ -0,0 +1,77 @@
+
+/// @file scram.h
+
+#ifndef LAPQ_SCRAM_H
+#define LAPQ_SCRAM_H
+
+#include <array>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+
+namespace lapq {
+namespace pv3 {
+//============================================================================
+
+
+//////////////////////////////////////////////////////////////////////////////
+/// SCRAM-SHA-256 client (RFC 5802, RFC 7677) without channel binding, as
+/// used by SASL authentication.
+///
+/// The 4096 or more PBKDF2 iterations that derive the SaltedPassword are run
+/// once per password, salt and iteration count in the process. The
+/// ClientKey and ServerKey of the last MAX_CACHED are kept for reconnects,
+/// keyed by the salt, the iteration count and an HMAC of the password under
+/// a random key of the process, never by the password or a plain hash of it.
+class Scram {
+public:
+  static constexpr const char *MECHANISM = "SCRAM-SHA-256";
+  static constexpr std::size_t MAX_CACHED = 64;
+
+  using Key = std::array<unsigned char, 32>;
+
+  /// The server takes the user of StartUp. nonce is random if empty, if no
+  /// random bytes are available error() is set and the exchange fails.
+  Scram(const std::string &user, const std::string &password,
+        const std::string &nonce = {});
+
+  const std::error_code &error() const { return m_error; }
+
+  /// client-first-message
+  std::string clientFirst() const;
+
+  /// Take the server-first-message and make the client-final-message.
+  std::error_code serverFirst(std::string_view msg, std::string &final);
+
+  /// Verify the server signature of the server-final-message.
+  std::error_code serverFinal(std::string_view msg) const;
+
+  /// Derive the ClientKey and ServerKey, or take them from the cache.
+  static void keys(const std::string &password, const std::string &salt,
+                   int iterations, Key &client_key, Key &server_key);
+
+  /// Number of cached key pairs.
+  static std::size_t cached();
+
+//----------------------------------------------------------------------------
+private:
+  std::string m_user;
+  std::string m_password;
+  std::string m_nonce;
+  std::string m_auth_message;
+  Key m_server_key{};
+  std::error_code m_error;
+
+}; // Scram
+
+
+std::string base64Encode(std::string_view s);
+bool base64Decode(std::string_view s, std::string &out);
+
+
+//============================================================================
+} // namespace pv3
+} // namespace lapq
+
+#endif
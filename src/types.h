@@ -4,12 +4,16 @@
 #define LAPQ_TYPES_H
 
 #include <iostream>
+#include <array>
 #include <vector>
+#include <memory_resource>
 
 namespace lapq {
 
 //----------------------------------------------------------------------------
-using Buffer = std::vector<char>;
+/// Message buffers take a std::pmr::memory_resource, the connections
+/// allocate them from a pool.
+using Buffer = std::pmr::vector<char>;
 std::ostream &operator<<(std::ostream &os, const Buffer &obj);
 
 using Byte4 = std::array<unsigned char, 4>;
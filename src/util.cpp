@@ -5,7 +5,10 @@
 #include <sys/types.h>
 #include <pwd.h>
 
+#include <algorithm>
 #include <filesystem>
+#include <mutex>
+#include <set>
 
 #include "dbconnection.h"
 
@@ -49,6 +52,7 @@ void getEnv(Option &option)
   static const std::map<std::string, std::string> env
   {
     {{"PGUSER"}, opt::USER},
+    {{"PGPASSWORD"}, opt::PASSWORD},
     {{"PGDATABASE"}, opt::DATABASE},
     {{"PGAPPNAME"}, opt::APPLICATION_NAME},
     {{"PGDATESTYLE"}, opt::DATESTYLE},
@@ -64,8 +68,12 @@ void getEnv(Option &option)
     {{"PGSSLROOTCERT"}, opt::SSLROOTCERT},
     {{"PGSSLCRL"}, opt::SSLCRL},
     {{"SSL_CERT_DIR"}, opt::SSL_CERT_DIR},
+    {{"PGSSLNEGOTIATION"}, opt::SSLNEGOTIATION},
 
-    {{"PGREQUIREPEER"}, opt::REQUIREPEER}
+    {{"PGREQUIREPEER"}, opt::REQUIREPEER},
+
+    {{"PGHOST"}, opt::HOST},
+    {{"PGPORT"}, opt::PORT}
   };
 
   char *c;
@@ -100,6 +108,104 @@ Option getEnv()
 
 
 
+//----------------------------------------------------------------------------
+bool isStartupOption(const std::string &key)
+{
+  static const std::set<std::string> client
+  {
+    opt::PASSWORD,
+    opt::SSLMODE, opt::SSLCOMPRESSION, opt::SSLCERT, opt::SSLKEY,
+    opt::SSLROOTCERT, opt::SSLCRL, opt::SSL_CERT_DIR, opt::SSLNEGOTIATION,
+    opt::SSLKTLS, opt::REQUIREPEER,
+    opt::HOST, opt::PORT, opt::TARGET_SESSION_ATTRS, opt::ATTEMPT_DELAY,
+    opt::NODELAY, opt::RCVBUF, opt::SNDBUF, opt::KEEPALIVES,
+    opt::KEEPALIVES_IDLE, opt::KEEPALIVES_INTERVAL, opt::KEEPALIVES_COUNT
+  };
+
+  return client.find(key) == client.end();
+}
+
+
+//----------------------------------------------------------------------------
+Address getAddress(const Option &option, bool tcp)
+{
+  Address addr{tcp ? "localhost" : "/var/run/postgresql", "5432"};
+
+  auto it = option.find(opt::HOST);
+  if (it != option.end() && !it->second.empty()) { addr.host = it->second; }
+
+  it = option.find(opt::PORT);
+  if (it != option.end() && !it->second.empty()) { addr.port = it->second; }
+
+  return addr;
+}
+
+
+//----------------------------------------------------------------------------
+std::error_code getAddresses(const Option &option, std::vector<Address> &addr,
+                             bool tcp)
+{
+  auto split = [&option](const std::string &key)
+  {
+    std::vector<std::string> v;
+    auto it = option.find(key);
+    if (it == option.end()) { return v; }
+
+    std::string::size_type pos = 0, end;
+    do {
+      end = it->second.find(',', pos);
+      v.push_back(it->second.substr(pos, end - pos));
+      pos = end + 1;
+    } while (end != std::string::npos);
+    return v;
+  };
+
+  auto host = split(opt::HOST);
+  auto port = split(opt::PORT);
+  if (host.empty()) { host.emplace_back(); }
+  if (port.size() > 1 && port.size() != host.size()) {
+    return std::error_code(EINVAL, std::generic_category());
+  }
+
+  auto dflt = getAddress({}, tcp);
+  addr.clear();
+  for (std::size_t i = 0; i < host.size(); ++i)
+  {
+    auto &p = port.empty() ? dflt.port : port[port.size() == 1 ? 0 : i];
+    addr.push_back({host[i].empty() ? dflt.host : host[i],
+                    p.empty() ? dflt.port : p});
+  }
+  return {};
+}
+
+
+//----------------------------------------------------------------------------
+SocketOption getSocketOption(const Option &option)
+{
+  SocketOption so;
+
+  auto integer = [&option](const std::string &key, int &val)
+  {
+    auto it = option.find(key);
+    if (it != option.end()) { val = std::atoi(it->second.c_str()); }
+  };
+
+  int nodelay = 1, keepalive = 1;
+  integer(opt::NODELAY, nodelay);
+  integer(opt::KEEPALIVES, keepalive);
+  so.nodelay = (nodelay != 0);
+  so.keepalive = (keepalive != 0);
+
+  integer(opt::RCVBUF, so.rcvbuf);
+  integer(opt::SNDBUF, so.sndbuf);
+  integer(opt::KEEPALIVES_IDLE, so.keepalive_idle);
+  integer(opt::KEEPALIVES_INTERVAL, so.keepalive_interval);
+  integer(opt::KEEPALIVES_COUNT, so.keepalive_count);
+
+  return so;
+}
+
+
 //----------------------------------------------------------------------------
 SSLMode getSSLMode(const Option &option)
 {
@@ -112,6 +218,17 @@ SSLMode getSSLMode(const Option &option)
 }
 
 
+//----------------------------------------------------------------------------
+SSLNegotiation getSSLNegotiation(const Option &option)
+{
+  auto it = option.find(opt::SSLNEGOTIATION);
+  if (it != option.end() && it->second == "direct") {
+    return SSLNegotiation::direct;
+  }
+  return SSLNegotiation::postgres;
+}
+
+
 
 
 //----------------------------------------------------------------------------
@@ -230,9 +347,97 @@ Error setContext(const Option &option, asio::ssl::context &context)
     }
   }
 
-  return Error(ec);
+  return Error(std::error_code());    // a missing default file is no error
+}
+
+//----------------------------------------------------------------------------
+namespace {
+
+/// The files setContext() reads for option, given or default, and the
+/// OpenSSL default verify paths it falls back to without a root certificate.
+std::vector<std::string> contextFiles(const Option &option)
+{
+  std::vector<std::string> files;
+  auto file = [&](const std::string &key, const std::string &name)
+  {
+    std::string fname;
+    if (!getOption(option, key, fname)) { fname = getDefaultFileName(name); }
+    files.push_back(fname);
+  };
+
+  file(opt::SSLROOTCERT, SSLROOTCERT_FILE);
+  file(opt::SSLCRL, SSLCRL_FILE);
+  file(opt::SSLCERT, SSLCERT_FILE);
+  file(opt::SSLKEY, SSLKEY_FILE);
+
+  // A certificate added to or removed from the directory changes its mtime.
+  auto path = [&](const char *env, const char *fallback)
+  {
+    auto p = std::getenv(env);
+    files.push_back(p ? p : fallback);
+  };
+  path(X509_get_default_cert_file_env(), X509_get_default_cert_file());
+  path(X509_get_default_cert_dir_env(), X509_get_default_cert_dir());
+  return files;
+}
+
+
+/// The modification times of files, file_time_type::min() if missing.
+std::vector<file_time_type> modified(const std::vector<std::string> &files)
+{
+  std::vector<file_time_type> mtime;
+  for (auto &f : files)
+  {
+    std::error_code ec;
+    auto t = last_write_time(f, ec);
+    mtime.push_back(ec ? file_time_type::min() : t);
+  }
+  return mtime;
+}
+
+
+struct CachedContext
+{
+  std::vector<file_time_type> mtime;
+  std::shared_ptr<asio::ssl::context> context;
+};
+
+} // namespace
+
+
+//----------------------------------------------------------------------------
+/// The key is the sslmode and the files. A context that fails to load is
+/// not cached.
+std::shared_ptr<asio::ssl::context> sharedContext(const Option &option,
+                                                  Error &er)
+{
+  static std::mutex mutex;
+  static std::map<std::string, CachedContext> cache;
+
+  auto files = contextFiles(option);
+  std::string key = std::to_string(static_cast<int>(getSSLMode(option)));
+  for (auto &f : files) { key += '\0' + f; }
+
+  auto mtime = modified(files);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = cache.find(key);
+  if (it != cache.end() && it->second.mtime == mtime) {
+    er = Error(std::error_code());
+    return it->second.context;
+  }
+
+  auto context = std::make_shared<asio::ssl::context>(
+                   asio::ssl::context::tls_client);
+  er = setContext(option, *context);
+  if (er) { return nullptr; }
+
+  pv3::SessionCache::instance().attach(context->native_handle());
+  cache[key] = {std::move(mtime), context};
+  return context;
 }
 
+
 #define DBG(s) do { std::cout << s << std::endl; } while (false)
 
 //----------------------------------------------------------------------------
@@ -8,7 +8,9 @@
 #include <iostream>
 #include <string>
 #include <map>
+#include <vector>
 #include <functional>
+#include <memory>
 
 #include "asio.hpp"
 #include "asio/ssl.hpp"
@@ -23,6 +25,10 @@ using Option = std::map<std::string, std::string>;
 
 enum class SSLMode { require = 0, verify_ca, verify_full };
 
+/// postgres sends an SSLRequest first, direct starts TLS at once with ALPN
+/// "postgresql" (PostgreSQL 17 and later).
+enum class SSLNegotiation { postgres = 0, direct };
+
 
 
 namespace opt {
@@ -30,6 +36,7 @@ namespace opt {
 
 //----------------------------------------------------------------------------
 const std::string USER{"user"};
+const std::string PASSWORD{"password"};
 const std::string DATABASE{"database"};
 const std::string APPLICATION_NAME{"application_name"};
 const std::string DATESTYLE{"DATEStyle"};
@@ -45,8 +52,23 @@ const std::string SSLKEY{"SSLKEY"};
 const std::string SSLROOTCERT{"SSLRootcert"};
 const std::string SSLCRL{"SSLCRL"};
 const std::string SSL_CERT_DIR{"SSL_cert_dir"};
+const std::string SSLNEGOTIATION{"sslnegotiation"};
+const std::string SSLKTLS{"sslktls"};
 const std::string REQUIREPEER{"REQuirepeer"};
 
+const std::string HOST{"host"};
+const std::string PORT{"port"};
+const std::string TARGET_SESSION_ATTRS{"target_session_attrs"};
+const std::string ATTEMPT_DELAY{"attempt_delay"};
+
+const std::string NODELAY{"tcp_nodelay"};
+const std::string RCVBUF{"rcvbuf"};
+const std::string SNDBUF{"sndbuf"};
+const std::string KEEPALIVES{"keepalives"};
+const std::string KEEPALIVES_IDLE{"keepalives_idle"};
+const std::string KEEPALIVES_INTERVAL{"keepalives_interval"};
+const std::string KEEPALIVES_COUNT{"keepalives_count"};
+
 
 
 //////////////////////////////////////////////////////////////////////////////
@@ -60,8 +82,62 @@ namespace util {
 void getEnv(Option &option);
 Option getEnv();
 
+/// False for the options used by the client, they are not sent in StartUp.
+bool isStartupOption(const std::string &key);
+
+
+//----------------------------------------------------------------------------
+/// The server address from opt::HOST and opt::PORT. A host starting with '/'
+/// is the directory of a unix-domain socket, as with libpq.
+struct Address
+{
+  std::string host;
+  std::string port;
+
+  bool local() const { return !host.empty() && host[0] == '/'; }
+
+  /// The unix-domain socket in the host directory.
+  std::string path() const { return host + "/.s.PGSQL." + port; }
+};
+
+/// Without opt::HOST the default is the local socket directory, or
+/// localhost for tcp if tcp is true.
+Address getAddress(const Option &option, bool tcp = false);
+
+/// The comma separated hosts of opt::HOST. opt::PORT has a port per host or
+/// one port for all, any other number of ports is EINVAL.
+std::error_code getAddresses(const Option &option, std::vector<Address> &addr,
+                             bool tcp = false);
+
+
+//----------------------------------------------------------------------------
+/// Socket options, 0 leaves the system default. Buffer sizes also apply to
+/// unix-domain sockets, the others only to tcp.
+struct SocketOption
+{
+  bool nodelay = true;
+  int rcvbuf = 0;
+  int sndbuf = 0;
+  bool keepalive = true;
+  int keepalive_idle = 0;         // seconds
+  int keepalive_interval = 0;     // seconds
+  int keepalive_count = 0;
+};
+
+SocketOption getSocketOption(const Option &option);
+
 Error setContext(const Option &option, asio::ssl::context &context);
 SSLMode getSSLMode(const Option &option);
+SSLNegotiation getSSLNegotiation(const Option &option);
+
+/// A client context loaded by setContext(), shared by every caller with the
+/// same effective SSL options. It is loaded again only when one of the
+/// certificate, key or CRL files, or the default verify file or directory of
+/// OpenSSL, has changed since, so connecting does not parse the PEM files
+/// each time. Connection and AsyncConnection use it when opt::SSLMODE is
+/// given without a context. The context must not be modified.
+std::shared_ptr<asio::ssl::context> sharedContext(const Option &option,
+                                                  Error &er);
 
 bool verifyCertificate(SSLMode sslmode, bool preverified,
     asio::ssl::verify_context& context);
@@ -0,0 +1,142 @@
+/*
+ * Receive throughput of many asynchronous connections on one io_service.
+ * A server thread per connection streams DataRows over loopback tcp and the
+ * client frames them with TCPAsyncConnection::read(), as the FSM does.
+ *
+ * Build once as is (epoll) and once with -DLAPQ_IO_URING=ON to compare.
+ *
+ *   bench_recv [connections] [rows] [row bytes]
+ */
+
+
+#include <arpa/inet.h>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lapq.h"
+#include "connection.h"
+#include "protocol.h"
+
+using namespace std;
+using namespace lapq;
+
+
+//============================================================================
+// rows DataRows of one text column of size bytes, then ReadyForQuery.
+//
+static std::string script(int rows, int size)
+{
+  auto int32 = [](std::uint32_t v)
+  {
+    v = htonl(v);
+    return std::string(reinterpret_cast<const char *>(&v), sizeof(v));
+  };
+
+  std::string row = "D" + int32(4 + 2 + 4 + size) + std::string("\0\1", 2)
+                  + int32(size) + std::string(size, 'x');
+  std::string s;
+  s.reserve(row.size() * rows + 6);
+  for (int i = 0; i < rows; ++i) { s += row; }
+  return s + "Z" + int32(5) + "I";
+}
+
+
+//============================================================================
+// Reads messages until ReadyForQuery.
+//
+struct Reader {
+  std::shared_ptr<pv3::TCPAsyncConnection> con;
+  std::size_t messages = 0;
+  std::error_code er;
+
+  void next()
+  {
+    con->read(pv3::Header::size(),
+    [this](const std::error_code &ec, std::size_t, const Buffer &buf)
+    {
+      pv3::Header head;
+      er = ec ? ec : head.deserialize(buf);
+      if (er) { return; }
+
+      con->read(head.bodyLen(), [this, head]
+      (const std::error_code &ec, std::size_t, const Buffer &)
+      {
+        if (ec) { er = ec; return; }
+        ++messages;
+        if (head.messageType() != 'Z') { next(); }
+      });
+    });
+  }
+};
+
+
+//============================================================================
+int main(int argc, char *argv[])
+{
+  int connections = argc > 1 ? std::stoi(argv[1]) : 64;
+  int rows = argc > 2 ? std::stoi(argv[2]) : 100000;
+  int size = argc > 3 ? std::stoi(argv[3]) : 20;
+
+  auto data = script(rows, size);
+
+  asio::io_service sios;
+  asio::ip::tcp::acceptor acceptor(sios,
+    asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+  auto ep = acceptor.local_endpoint();
+
+  std::vector<std::thread> servers;
+  for (int i = 0; i < connections; ++i)
+  {
+    servers.emplace_back([&]
+    {
+      std::error_code ec;
+      asio::ip::tcp::socket s(sios);
+      acceptor.accept(s, ec);
+      if (!ec) { asio::write(s, asio::buffer(data), ec); }
+    });
+  }
+
+  asio::io_service mios;
+  std::vector<Reader> readers(connections);
+  for (auto &r : readers)
+  {
+    r.con = std::make_shared<pv3::TCPAsyncConnection>(mios,
+              pv3::TCPAsyncConnection::Endpoints{ep});
+    r.con->connect([&r](const std::error_code &ec)
+    {
+      if (ec) { r.er = ec; return; }
+      r.next();
+    });
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  mios.run();
+  std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+
+  for (auto &t : servers) { t.join(); }
+
+  std::size_t messages = 0;
+  for (auto &r : readers)
+  {
+    if (r.er) { cout << "Error: " << r.er.message() << endl; return 1; }
+    messages += r.messages;
+  }
+
+#if defined(ASIO_HAS_IO_URING_AS_DEFAULT)
+  cout << "io_uring";
+#else
+  cout << "epoll";
+#endif
+  cout << " connections=" << connections
+       << " messages=" << messages
+       << " seconds=" << secs.count()
+       << " msg/s=" << static_cast<std::size_t>(messages / secs.count())
+       << " MB/s=" << data.size() * connections / secs.count() / 1e6
+       << endl;
+
+  return 0;
+}
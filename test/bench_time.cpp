@@ -0,0 +1,84 @@
+/*
+ * Decoding timestamptz text: pg::decodeTimestampTZ() against the usual
+ * std::get_time parse of the same ISO strings into a std::chrono time.
+ *
+ *   bench_time [rows]
+ */
+
+
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "lapq.h"
+
+using namespace std;
+using namespace lapq;
+
+
+//============================================================================
+// The usual parse, the fraction and offset by hand.
+//
+static pg::Timestamp getTime(const std::string &s)
+{
+  std::tm tm{};
+  std::istringstream is(s);
+  is >> std::get_time(&tm, "%Y-%m-%d %H:%M:%S");
+
+  double frac = 0;
+  if (is.peek() == '.') { is >> frac; }
+
+  int offset = 0;
+  is >> offset;
+
+  auto t = std::chrono::system_clock::from_time_t(timegm(&tm))
+           - std::chrono::hours(offset);
+  return std::chrono::time_point_cast<std::chrono::microseconds>(t)
+         + std::chrono::microseconds(std::lround(frac * 1e6));
+}
+
+
+//============================================================================
+int main(int argc, char *argv[])
+{
+  int rows = argc > 1 ? std::stoi(argv[1]) : 1000000;
+
+  std::vector<std::string> text;
+  text.reserve(rows);
+  for (int i = 0; i < rows; ++i)
+  {
+    char buf[40];
+    std::snprintf(buf, sizeof(buf), "2024-%02d-%02d %02d:%02d:%02d.%06d+00",
+                  1 + i % 12, 1 + i % 28, i % 24, i % 60, (i / 60) % 60,
+                  i % 1000000);
+    text.emplace_back(buf);
+  }
+
+  auto run = [&](auto decode)
+  {
+    std::chrono::microseconds sum{0};
+    auto start = std::chrono::steady_clock::now();
+    for (auto &s : text) { sum += decode(s).time_since_epoch() % 1000; }
+    std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+    return std::make_pair(t.count(), sum.count());
+  };
+
+  auto [t1, s1] = run(getTime);
+  auto [t2, s2] = run([](const std::string &s)
+  {
+    return pg::decodeTimestampTZ(s.data(), s.size());
+  });
+
+  if (s1 != s2) { cout << "Error: results differ" << endl; return 1; }
+
+  cout << "std::get_time rows=" << rows << " seconds=" << t1
+       << " rows/s=" << rows / t1 << endl;
+  cout << "decodeTimestampTZ rows=" << rows << " seconds=" << t2
+       << " rows/s=" << rows / t2 << endl;
+  return 0;
+}
@@ -0,0 +1,173 @@
+/*
+ * TLS receive throughput over loopback: SSLAsyncConnection, which decrypts
+ * in user space through asio::ssl::stream, against KTLSAsyncConnection,
+ * which lets the kernel decrypt when it supports kTLS (modprobe tls).
+ *
+ *   bench_tls [rows] [row bytes]
+ */
+
+
+#include <arpa/inet.h>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "lapq.h"
+#include "connection.h"
+#include "protocol.h"
+
+using namespace std;
+using namespace lapq;
+using tcp = asio::ip::tcp;
+
+
+//============================================================================
+// rows DataRows of one text column of size bytes, then ReadyForQuery.
+//
+static std::string script(int rows, int size)
+{
+  auto int32 = [](std::uint32_t v)
+  {
+    v = htonl(v);
+    return std::string(reinterpret_cast<const char *>(&v), sizeof(v));
+  };
+
+  std::string row = "D" + int32(4 + 2 + 4 + size) + std::string("\0\1", 2)
+                  + int32(size) + std::string(size, 'x');
+  std::string s;
+  s.reserve(row.size() * rows + 6);
+  for (int i = 0; i < rows; ++i) { s += row; }
+  return s + "Z" + int32(5) + "I";
+}
+
+
+//============================================================================
+// A throwaway self-signed server certificate.
+//
+static void selfSigned(asio::ssl::context &ctx)
+{
+  EVP_PKEY *key = EVP_EC_gen("P-256");
+  X509 *cert = X509_new();
+  X509_set_version(cert, 2);
+  X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+  X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+  X509_set_pubkey(cert, key);
+  X509_set_issuer_name(cert, X509_get_subject_name(cert));
+  X509_sign(cert, key, EVP_sha256());
+
+  SSL_CTX_use_certificate(ctx.native_handle(), cert);
+  SSL_CTX_use_PrivateKey(ctx.native_handle(), key);
+  X509_free(cert);
+  EVP_PKEY_free(key);
+}
+
+
+//============================================================================
+// Connect, handshake and read messages until ReadyForQuery.
+//
+template<typename C>
+double receive(asio::io_service &mios, asio::ssl::context &cctx,
+               const tcp::endpoint &ep, std::size_t &messages,
+               std::string &ktls)
+{
+  auto con = std::make_shared<C>(mios, SSLMode::require, cctx,
+                                 typename C::Endpoints{ep});
+  std::error_code er;
+  std::chrono::steady_clock::time_point start;
+
+  std::function<void()> next = [&]
+  {
+    con->read(pv3::Header::size(),
+    [&](const std::error_code &ec, std::size_t, const Buffer &buf)
+    {
+      pv3::Header head;
+      er = ec ? ec : head.deserialize(buf);
+      if (er) { return; }
+
+      con->read(head.bodyLen(), [&, head]
+      (const std::error_code &ec, std::size_t, const Buffer &)
+      {
+        if (ec) { er = ec; return; }
+        ++messages;
+        if (head.messageType() != 'Z') { next(); }
+      });
+    });
+  };
+
+  con->connect([&](const std::error_code &ec)
+  {
+    if (ec) { er = ec; return; }
+    con->handshake([&](const std::error_code &ec)
+    {
+      if (ec) { er = ec; return; }
+      start = std::chrono::steady_clock::now();
+      next();
+    });
+  });
+
+  mios.restart();
+  mios.run();
+  std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+
+  if constexpr (std::is_same_v<C, pv3::KTLSAsyncConnection>) {
+    ktls = con->ktlsReceive() ? "on" : "off";
+  }
+  con->close([](const std::error_code &) {});
+
+  if (er) { cout << "Error: " << er.message() << endl; return 0; }
+  return secs.count();
+}
+
+
+//============================================================================
+int main(int argc, char *argv[])
+{
+  int rows = argc > 1 ? std::stoi(argv[1]) : 1000000;
+  int size = argc > 2 ? std::stoi(argv[2]) : 100;
+
+  auto data = script(rows, size);
+
+  asio::io_service sios;
+  asio::ssl::context sctx(asio::ssl::context::tls_server);
+  selfSigned(sctx);
+  tcp::acceptor acceptor(sios,
+    tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+
+  // Serve the two clients in turn.
+  std::thread server([&]
+  {
+    for (int i = 0; i < 2; ++i)
+    {
+      std::error_code ec;
+      asio::ssl::stream<tcp::socket> s(sios, sctx);
+      acceptor.accept(s.next_layer(), ec);
+
+      char request[8];
+      asio::read(s.next_layer(), asio::buffer(request), ec);
+      asio::write(s.next_layer(), asio::buffer("S", 1), ec);
+      s.handshake(asio::ssl::stream_base::server, ec);
+      asio::write(s, asio::buffer(data), ec);
+      s.read_some(asio::buffer(request), ec);
+    }
+  });
+
+  asio::io_service mios;
+  asio::ssl::context cctx(asio::ssl::context::tls_client);
+  auto ep = acceptor.local_endpoint();
+
+  std::size_t m1 = 0, m2 = 0;
+  std::string ktls;
+  auto t1 = receive<pv3::SSLAsyncConnection>(mios, cctx, ep, m1, ktls);
+  auto t2 = receive<pv3::KTLSAsyncConnection>(mios, cctx, ep, m2, ktls);
+  server.join();
+
+  auto mb = data.size() / 1e6;
+  cout << "asio::ssl::stream messages=" << m1 << " seconds=" << t1
+       << " MB/s=" << mb / t1 << endl;
+  cout << "kTLS (" << ktls << ") messages=" << m2 << " seconds=" << t2
+       << " MB/s=" << mb / t2 << endl;
+
+  return 0;
+}
@@ -0,0 +1,1433 @@
+/*
+ * Drive the protocol state machine with canned backend messages. These tests
+ * do not require a database server.
+ */
+
+
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <thread>
+
+#include "lapq.h"
+#include "fsm.h"
+#include "function-runner.h"
+
+using namespace std;
+using namespace lapq;
+
+
+//============================================================================
+// Serves reads from a buffer filled with backend messages and discards
+// writes, except for the bodies of the StartUp, the last Bind, the last
+// password message and the last cancel. A write of the message type in
+// broken fails with EPIPE. All handlers are called inline, like the
+// blocking Connection.
+//
+class ScriptConnection : public pv3::ConnectionBase {
+public:
+  void connect(EHandler &&eh) override { eh({}); }
+
+  void read(std::size_t len, RHandler &&rh) override
+  {
+    if (m_pos + len > m_script.size()) {
+      rh(std::error_code(ENODATA, std::generic_category()), 0, {});
+      return;
+    }
+    Buffer buf(m_script.begin() + m_pos, m_script.begin() + m_pos + len);
+    m_pos += len;
+    rh({}, len, buf);
+  }
+
+  void write(const pv3::Message &msg, WHandler &&wh) override
+  {
+    if (broken && msg.messageType() == broken) {
+      wh(std::error_code(EPIPE, std::generic_category()), 0);
+      return;
+    }
+    if (msg.messageType() == 'B') {
+      bind.clear();
+      msg.serialize(bind);
+    }
+    else if (msg.messageType() == 0 && start.empty()) {
+      msg.serialize(start);
+    }
+    else if (msg.messageType() == 'p') {
+      password.clear();
+      msg.serialize(password);
+      if (reply) { reply(std::string(password.begin(), password.end())); }
+    }
+    wh({}, 0);
+  }
+  void close(EHandler &&eh) override { eh({}); }
+  bool blocking() const override { return true; }
+
+  void cancel(int pid, int key, EHandler &&eh) override
+  {
+    cancelled = {pid, key};
+    eh({});
+  }
+
+  //------------------------------------------------------------------------
+  void message(char mtype, const std::string &body)
+  {
+    m_script.push_back(mtype);
+    length(body.size() + 4);
+    m_script.insert(m_script.end(), body.begin(), body.end());
+  }
+
+  static std::string int16(int v)
+  {
+    auto n = htons(static_cast<std::uint16_t>(v));
+    return std::string(reinterpret_cast<const char *>(&n), sizeof(n));
+  }
+
+  static std::string int32(int v)
+  {
+    auto n = htonl(static_cast<std::uint32_t>(v));
+    return std::string(reinterpret_cast<const char *>(&n), sizeof(n));
+  }
+
+  static std::string cstr(const std::string &s) { return s + '\0'; }
+
+  //------------------------------------------------------------------------
+  void startup()
+  {
+    message('R', int32(0));
+    message('S', cstr("client_encoding") + cstr("UTF8"));
+    message('K', int32(1234) + int32(5678));
+    message('Z', "I");
+  }
+
+  void rowDescription(const std::vector<std::pair<std::string, int>> &col)
+  {
+    auto body = int16(col.size());
+    for (auto &c : col)
+    {
+      body += cstr(c.first) + int32(0) + int16(0) + int32(c.second)
+            + int16(-1) + int32(-1) + int16(0);
+    }
+    message('T', body);
+  }
+
+  void dataRow(const std::vector<std::string> &val)
+  {
+    auto body = int16(val.size());
+    for (auto &v : val) { body += int32(v.size()) + v; }
+    message('D', body);
+  }
+
+  const Buffer &script() const { return m_script; }
+
+  Buffer bind;
+  Buffer start;
+  Buffer password;
+  std::function<void(const std::string &)> reply;   // to a password message
+  std::pair<int, int> cancelled{0, 0};      // pid and key of the cancel
+  char broken = 0;                          // message type whose write fails
+
+private:
+  void length(std::size_t v)
+  {
+    auto s = int32(static_cast<int>(v));
+    m_script.insert(m_script.end(), s.begin(), s.end());
+  }
+
+  Buffer m_script;
+  std::size_t m_pos = 0;
+
+}; // ScriptConnection
+
+
+//============================================================================
+// Connect and ignore messages that have no transition in the current state.
+//
+void connect_ignore(int, char **)
+{
+  asio::io_service mios;
+  ScriptConnection con;
+  con.message('R', ScriptConnection::int32(0));
+  con.message('N', "");                         // no transition in AUTH
+  con.startup();
+
+  pv3::FSM fsm(mios, con);
+  std::error_code er = make_error_code(lapq::errc::busy);
+  fsm.connect(Option{}, [&](const std::error_code &ec) { er = ec; });
+
+  if (er) { cout << "Error: " << er.message() << endl; return; }
+  cout << "Ok" << endl;
+}
+
+
+//============================================================================
+// Client options such as host and sslmode are not sent in StartUp, and the
+// host selects a unix-domain socket directory or tcp.
+//
+void startup_options(int, char **)
+{
+  asio::io_service mios;
+  ScriptConnection con;
+  con.startup();
+
+  Option option
+  {
+    {opt::USER, "gptest"}, {opt::HOST, "/tmp"}, {opt::PORT, "5433"},
+    {opt::SSLMODE, "verify_full"}, {opt::NODELAY, "0"}, {opt::RCVBUF, "65536"}
+  };
+
+  pv3::FSM fsm(mios, con);
+  std::error_code er;
+  fsm.connect(option, [&](const std::error_code &ec) { er = ec; });
+  if (er) { cout << "Error: " << er.message() << endl; return; }
+
+  std::string body(con.start.begin() + 4, con.start.end());
+  if (body != ScriptConnection::cstr("user") + ScriptConnection::cstr("gptest")
+              + '\0')
+  {
+    cout << "Error: startup=" << body << endl;
+    return;
+  }
+
+  auto addr = util::getAddress(option);
+  auto so = util::getSocketOption(option);
+  if (!addr.local() || addr.path() != "/tmp/.s.PGSQL.5433"
+      || so.nodelay || so.rcvbuf != 65536 || !so.keepalive)
+  {
+    cout << "Error: address=" << addr.path() << endl;
+    return;
+  }
+
+  std::vector<util::Address> hosts;
+  auto ec = util::getAddresses({{opt::HOST, "a,/tmp,b"},
+                                {opt::PORT, "5433,5434,5435"}}, hosts);
+  if (ec || hosts.size() != 3 || hosts[0].host != "a"
+      || hosts[0].port != "5433" || !hosts[1].local()
+      || hosts[2].port != "5435")
+  {
+    cout << "Error: hosts=" << hosts.size() << endl;
+    return;
+  }
+
+  // One port for all hosts, or one per host.
+  ec = util::getAddresses({{opt::HOST, "a,b"}, {opt::PORT, "6000"}}, hosts);
+  auto mismatch = util::getAddresses({{opt::HOST, "a,b,c"},
+                                      {opt::PORT, "1,2"}}, hosts);
+  if (ec || hosts.size() != 2 || hosts[1].port != "6000"
+      || mismatch != std::errc::invalid_argument)
+  {
+    cout << "Error: ports " << mismatch.message() << endl;
+    return;
+  }
+
+  addr = util::getAddress({{opt::HOST, "db.example.com"}});
+  if (addr.local() || addr.host != "db.example.com" || addr.port != "5432"
+      || util::getAddress({}, true).host != "localhost")
+  {
+    cout << "Error: host=" << addr.host << endl;
+    return;
+  }
+
+  cout << "Ok" << endl;
+}
+
+
+//============================================================================
+// SCRAM-SHA-256 against the exchange of RFC 7677, the derived keys are
+// cached, and the FSM answers AUTH_SASL and AUTH_MD5_PASSWORD with the
+// password option, which is not sent in StartUp.
+//
+void scram(int, char **)
+{
+  const std::string nonce = "rOprNGfwEbeRWgbNEkqO";
+  const std::string server_first = "r=rOprNGfwEbeRWgbNEkqO%hvYDpWUa2RaTCAfuxFI"
+                             "lj)hNlF$k0,s=W22ZaJ0SNY7soEsUEjb6gQ==,i=4096";
+  const std::string client_final = "c=biws,r=rOprNGfwEbeRWgbNEkqO%hvYDpWUa2RaT"
+       "CAfuxFIlj)hNlF$k0,p=dHzbZapWIk4jUhN+Ute9ytag9zjfMHgsqmmiz7AndVQ=";
+  const std::string server_final =
+                          "v=6rriTRBi23WpRR/wtup+mMhUZUn/dB5nLTJRsjl95G4=";
+
+  auto cached = pv3::Scram::cached();
+  for (int i = 0; i < 2; ++i)
+  {
+    pv3::Scram sc("user", "pencil", nonce);
+    std::string final;
+    if (sc.clientFirst() != "n,,n=user,r=" + nonce
+        || sc.serverFirst(server_first, final) || final != client_final
+        || sc.serverFinal(server_final))
+    {
+      cout << "Error: final=" << final << endl;
+      return;
+    }
+
+    if (sc.serverFinal("v=AAAA") != lapq::errc::server_signature) {
+      cout << "Error: bad signature accepted" << endl;
+      return;
+    }
+  }
+
+  if (pv3::Scram::cached() != cached + 1) {
+    cout << "Error: cached=" << pv3::Scram::cached() << endl;
+    return;
+  }
+
+  // A nonce the server did not extend, and iteration counts that are not a
+  // positive number.
+  pv3::Scram sc("user", "pencil", nonce);
+  std::string final;
+  if (!sc.serverFirst("r=xyz,s=W22ZaJ0SNY7soEsUEjb6gQ==,i=4096", final)) {
+    cout << "Error: foreign nonce accepted" << endl;
+    return;
+  }
+
+  for (auto i : {"0", "-1", "4096x", "", "99999999999"})
+  {
+    auto msg = "r=" + nonce + "srv,s=W22ZaJ0SNY7soEsUEjb6gQ==,i=" + i;
+    if (!sc.serverFirst(msg, final)) {
+      cout << "Error: iterations " << i << " accepted" << endl;
+      return;
+    }
+  }
+
+  // The cache is bounded.
+  for (std::size_t i = 0; i <= pv3::Scram::MAX_CACHED; ++i)
+  {
+    pv3::Scram::Key client_key, server_key;
+    pv3::Scram::keys("pencil", "salt" + std::to_string(i), 1, client_key,
+                     server_key);
+  }
+  if (pv3::Scram::cached() != pv3::Scram::MAX_CACHED) {
+    cout << "Error: cached=" << pv3::Scram::cached() << endl;
+    return;
+  }
+
+  Option option{{opt::USER, "gptest"}, {opt::PASSWORD, "secret"}};
+  {
+    asio::io_service mios;
+    ScriptConnection con;
+    con.message('R', ScriptConnection::int32(10)
+                     + ScriptConnection::cstr("SCRAM-SHA-256") + '\0');
+
+    pv3::FSM fsm(mios, con);
+    std::error_code er;
+    fsm.connect(option, [&](const std::error_code &ec) { er = ec; });
+
+    std::string start(con.start.begin(), con.start.end());
+    std::string body(con.password.begin(), con.password.end());
+    auto first = ScriptConnection::cstr("SCRAM-SHA-256");
+    if (er.value() != ENODATA || start.find("secret") != std::string::npos
+        || body.compare(0, first.size(), first) != 0
+        || body.compare(first.size() + 4, 14, "n,,n=gptest,r=") != 0)
+    {
+      cout << "Error: sasl=" << body << endl;
+      return;
+    }
+  }
+
+  // AuthenticationOk after AUTH_SASL_CONTINUE, without AUTH_SASL_FINAL,
+  // skips the server signature.
+  {
+    asio::io_service mios;
+    ScriptConnection con;
+    con.message('R', ScriptConnection::int32(10)
+                     + ScriptConnection::cstr("SCRAM-SHA-256") + '\0');
+    con.reply = [&con](const std::string &body)
+    {
+      if (body.compare(0, 13, "SCRAM-SHA-256") != 0) { return; }
+      auto r = body.find(",r=");
+      con.message('R', ScriptConnection::int32(11) + body.substr(r + 1)
+                       + "srv,s=W22ZaJ0SNY7soEsUEjb6gQ==,i=4096");
+      con.message('R', ScriptConnection::int32(0));
+      con.startup();
+    };
+
+    pv3::FSM fsm(mios, con);
+    std::error_code er;
+    fsm.connect(option, [&](const std::error_code &ec) { er = ec; });
+    if (er != lapq::errc::server_signature) {
+      cout << "Error: unverified AuthenticationOk" << endl;
+      return;
+    }
+  }
+
+  {
+    asio::io_service mios;
+    ScriptConnection con;
+    con.message('R', ScriptConnection::int32(10)
+                     + ScriptConnection::cstr("SCRAM-SHA-256-PLUS") + '\0');
+
+    pv3::FSM fsm(mios, con);
+    std::error_code er;
+    fsm.connect(option, [&](const std::error_code &ec) { er = ec; });
+    if (er.value() != ENOTSUP) {
+      cout << "Error: mechanism=" << er.message() << endl;
+      return;
+    }
+  }
+
+  {
+    asio::io_service mios;
+    ScriptConnection con;
+    con.message('R', ScriptConnection::int32(5) + "salt");
+    con.startup();
+
+    pv3::FSM fsm(mios, con);
+    std::error_code er;
+    fsm.connect(option, [&](const std::error_code &ec) { er = ec; });
+
+    // md5(md5("secretgptest") + "salt")
+    std::string body(con.password.begin(), con.password.end());
+    if (er || body != ScriptConnection::cstr(
+                                "md5308d2992df4b6a00ee728b6415477633"))
+    {
+      cout << "Error: md5=" << body << endl;
+      return;
+    }
+  }
+
+  cout << "Ok" << endl;
+}
+
+
+//============================================================================
+// A simple query returning several rows.
+//
+void query_rows(int, char **)
+{
+  asio::io_service mios;
+  ScriptConnection con;
+  con.startup();
+  con.rowDescription({{"abc", pg::PG_TEXTOID}, {"one", pg::PG_INT4OID}});
+  for (int i = 0; i < 100; ++i)
+  {
+    con.dataRow({"row" + std::to_string(i), std::to_string(i)});
+  }
+  con.message('C', ScriptConnection::cstr("SELECT 100"));
+  con.message('Z', "I");
+
+  pv3::FSM fsm(mios, con);
+  std::error_code er;
+  fsm.connect(Option{}, [&](const std::error_code &ec) { er = ec; });
+  if (er) { cout << "Error: " << er.message() << endl; return; }
+
+  ResultSet rset;
+  er = make_error_code(lapq::errc::busy);
+  fsm.exec("select", &rset, [&](const std::error_code &ec) { er = ec; });
+  if (er) { cout << "Error: " << er.message() << endl; return; }
+
+  if (rset.size() != 1 || rset[0].size() != 100) {
+    cout << "Error: size=" << rset[0].size() << endl;
+    return;
+  }
+
+  if (rset[0].get<std::string>(42, "abc") != "row42"
+      || rset[0].get<int>(99, 1) != 99)
+  {
+    cout << "Error: unexpected value" << endl;
+    return;
+  }
+
+  cout << "Ok" << endl;
+}
+
+
+//============================================================================
+// ParameterStatus is kept, also when a SET within a query changes it, and
+// picks the decoders registered for DateStyle ISO in a format that opted in
+// to them.
+//
+void parameter_status(int, char **)
+{
+  asio::io_service mios;
+  ScriptConnection con;
+  con.message('R', ScriptConnection::int32(0));
+  con.message('S', ScriptConnection::cstr("server_version")
+                   + ScriptConnection::cstr("9.6.3"));
+  con.message('S', ScriptConnection::cstr("DateStyle")
+                   + ScriptConnection::cstr("ISO, MDY"));
+  con.startup();
+
+  con.rowDescription({{"d", pg::PG_DATEOID}});
+  con.dataRow({"2024-02-29"});
+  con.message('C', ScriptConnection::cstr("SELECT 1"));
+  con.message('C', ScriptConnection::cstr("SET"));
+  con.message('S', ScriptConnection::cstr("DateStyle")
+                   + ScriptConnection::cstr("SQL, DMY"));
+  con.message('S', ScriptConnection::cstr("server_version")
+                   + ScriptConnection::cstr("17.2 (Debian 17.2-1)"));
+  con.rowDescription({{"d", pg::PG_DATEOID}});
+  con.dataRow({"29/02/2024"});
+  con.message('C', ScriptConnection::cstr("SELECT 1"));
+  con.message('Z', "I");
+
+  pv3::FSM fsm(mios, con);
+  std::error_code er;
+  fsm.connect(Option{}, [&](const std::error_code &ec) { er = ec; });
+  if (er) { cout << "Error: " << er.message() << endl; return; }
+
+  auto &sp = fsm.parameters();
+  if (!sp.isoDateStyle() || !sp.utf8() || sp.serverVersion() != 90603
+      || sp.get("client_encoding") != "UTF8" || !sp.get("TimeZone").empty())
+  {
+    cout << "Error: version=" << sp.serverVersion() << endl;
+    return;
+  }
+
+  pg::PGFormat pgf;
+  pgf.emplaceChrono();
+  ResultSet rset(pgf);
+  fsm.exec("select; set; select", &rset,
+           [&](const std::error_code &ec) { er = ec; });
+  if (er) { cout << "Error: " << er.message() << endl; return; }
+
+  using namespace std::chrono;
+  if (rset.size() != 2
+      || rset[0].get<pg::Date>(0, 0) != year(2024) / February / 29
+      || rset[1].get<std::string>(0, 0) != "29/02/2024")
+  {
+    cout << "Error: unexpected value" << endl;
+    return;
+  }
+
+  if (sp.isoDateStyle() || sp.get("DateStyle") != "SQL, DMY"
+      || sp.serverVersion() != 170002)
+  {
+    cout << "Error: DateStyle=" << sp.get("DateStyle") << endl;
+    return;
+  }
+
+  cout << "Ok" << endl;
+}
+
+
+//============================================================================
+// Enough rows to overflow the stack if every message recursed.
+//
+void many_rows(int, char **)
+{
+  constexpr int rows = 500000;
+
+  asio::io_service mios;
+  ScriptConnection con;
+  con.startup();
+  con.rowDescription({{"one", pg::PG_INT4OID}});
+  for (int i = 0; i < rows; ++i) { con.dataRow({std::to_string(i)}); }
+  con.message('C', ScriptConnection::cstr("SELECT"));
+  con.message('Z', "I");
+
+  pv3::FSM fsm(mios, con);
+  std::error_code er;
+  fsm.connect(Option{}, [&](const std::error_code &ec) { er = ec; });
+  if (er) { cout << "Error: " << er.message() << endl; return; }
+
+  ResultSet rset;
+  fsm.exec("select", &rset, [&](const std::error_code &ec) { er = ec; });
+  if (er) { cout << "Error: " << er.message() << endl; return; }
+
+  if (rset[0].size() != rows || rset[0].get<int>(rows - 1, 0) != rows - 1) {
+    cout << "Error: size=" << rset[0].size() << endl;
+    return;
+  }
+
+  cout << "Ok" << endl;
+}
+
+
+//============================================================================
+// A DataRow whose column length runs past the end of the message must fail
+// without reading beyond the buffer or adding part of the row, as must one
+// with more cells than its RowDescription or one without a RowDescription.
+//
+void truncated_row(int, char **)
+{
+  asio::io_service mios;
+  ScriptConnection truncated;
+  truncated.startup();
+  truncated.rowDescription({{"abc", pg::PG_TEXTOID}, {"def", pg::PG_TEXTOID}});
+  truncated.message('D', ScriptConnection::int16(2)
+                         + ScriptConnection::int32(2) + "ok"
+                         + ScriptConnection::int32(64) + "short");
+
+  std::error_code er;
+  for (int column = 0; column < 2; ++column)
+  {
+    ScriptConnection con = truncated;
+    pv3::FSM fsm(mios, con);
+    fsm.connect(Option{}, [&](const std::error_code &ec) { er = ec; });
+    if (er) { cout << "Error: " << er.message() << endl; return; }
+
+    // Nothing of the row is added.
+    ResultSet rset;
+    ColumnResultSet cset;
+    ResultBase *res = column ? static_cast<ResultBase *>(&cset) : &rset;
+    fsm.exec("select", res, [&](const std::error_code &ec) { er = ec; });
+    if (er != std::error_code(EMSGSIZE, std::generic_category())
+        || (column ? cset[0].size() : rset[0].size()) != 0)
+    {
+      cout << "Error: " << er.message() << endl;
+      return;
+    }
+  }
+
+  // A cell more than the RowDescription has, and a row without one.
+  ScriptConnection extra;
+  extra.startup();
+  extra.rowDescription({{"abc", pg::PG_TEXTOID}});
+  extra.dataRow({"one", "two"});
+
+  ScriptConnection orphan;
+  orphan.startup();
+  orphan.dataRow({"one"});
+
+  for (auto *script : {&extra, &orphan})
+  {
+    for (int raw = 0; raw < 2; ++raw)
+    {
+      ScriptConnection con = *script;
+      pv3::FSM fsm(mios, con);
+      fsm.connect(Option{}, [&](const std::error_code &ec) { er = ec; });
+
+      ResultSet rset;
+      RawResultSet raw_set;
+      ResultBase *res = raw ? static_cast<ResultBase *>(&raw_set) : &rset;
+      fsm.exec("select", res, [&](const std::error_code &ec) { er = ec; });
+      if (er != std::error_code(EBADMSG, std::generic_category())) {
+        cout << "Error: malformed row " << er.message() << endl;
+        return;
+      }
+    }
+  }
+
+  cout << "Ok" << endl;
+}
+
+
+//============================================================================
+// An ErrorResponse is added to the result and NULL columns are empty.
+//
+void query_error(int, char **)
+{
+  asio::io_service mios;
+  ScriptConnection con;
+  con.startup();
+  con.rowDescription({{"abc", pg::PG_TEXTOID}});
+  con.message('D', ScriptConnection::int16(1) + ScriptConnection::int32(-1));
+  con.message('C', ScriptConnection::cstr("SELECT 1"));
+  con.message('E', "SERROR" + ScriptConnection::cstr("")
+                   + "C42601" + ScriptConnection::cstr("")
+                   + "Msyntax error" + ScriptConnection::cstr("") + '\0');
+  con.message('Z', "I");
+
+  pv3::FSM fsm(mios, con);
+  std::error_code er;
+  fsm.connect(Option{}, [&](const std::error_code &ec) { er = ec; });
+  if (er) { cout << "Error: " << er.message() << endl; return; }
+
+  ResultSet rset;
+  fsm.exec("select", &rset, [&](const std::error_code &ec) { er = ec; });
+  if (er) { cout << "Error: " << er.message() << endl; return; }
+
+  if (rset.size() != 2 || !rset[0] || rset[1]) {
+    cout << "Error: size=" << rset.size() << endl;
+    return;
+  }
+
+  if (rset[0][0][0].has_value() || rset[1].error().at(CODE) != "42601") {
+    cout << "Error: unexpected value" << endl;
+    return;
+  }
+
+  cout << "Ok" << endl;
+}
+
+
+//============================================================================
+// Exceeding the row budget cancels the query and drops the remaining rows
+// and the cancel error. The next exec starts with a fresh count.
+//
+void budget(int, char **)
+{
+  asio::io_service mios;
+  ScriptConnection con;
+  con.startup();
+  con.rowDescription({{"one", pg::PG_INT4OID}});
+  for (int i = 0; i < 100; ++i) { con.dataRow({std::to_string(i)}); }
+  con.message('E', "SERROR" + ScriptConnection::cstr("")
+                   + "C57014" + ScriptConnection::cstr("")
+                   + "Mcanceling statement" + ScriptConnection::cstr("")
+                   + '\0');
+  con.message('Z', "I");
+
+  con.rowDescription({{"one", pg::PG_INT4OID}});
+  for (int i = 0; i < 10; ++i) { con.dataRow({std::to_string(i)}); }
+  con.message('C', ScriptConnection::cstr("SELECT 10"));
+  con.message('Z', "I");
+
+  pv3::FSM fsm(mios, con);
+  std::error_code er;
+  fsm.connect(Option{}, [&](const std::error_code &ec) { er = ec; });
+  if (er) { cout << "Error: " << er.message() << endl; return; }
+
+  ResultSet rset;
+  rset.budget(SIZE_MAX, 10);
+  fsm.exec("select", &rset, [&](const std::error_code &ec) { er = ec; });
+  if (er != make_error_code(lapq::errc::budget_exceeded)) {
+    cout << "Error: " << er.message() << endl;
+    return;
+  }
+
+  if (con.cancelled != std::pair<int, int>{1234, 5678}) {
+    cout << "Error: cancel pid=" << con.cancelled.first << endl;
+    return;
+  }
+
+  if (rset.size() != 1 || rset[0].size() != 10 || rset.used_rows() != 11) {
+    cout << "Error: size=" << rset.size() << endl;
+    return;
+  }
+
+  ResultSet next;
+  next.budget(SIZE_MAX, 10);
+  fsm.exec("select", &next, [&](const std::error_code &ec) { er = ec; });
+  if (er || next[0].size() != 10) {
+    cout << "Error: " << er.message() << endl;
+    return;
+  }
+
+  cout << "Ok" << endl;
+}
+
+
+//============================================================================
+// Execute a prepared statement twice, rebinding the query and reusing the
+// result.
+//
+void exec_reuse(int, char **)
+{
+  asio::io_service mios;
+  ScriptConnection con;
+  con.startup();
+  for (int i = 1; i <= 2; ++i)
+  {
+    con.message('2', "");
+    con.rowDescription({{"n", pg::PG_INT4OID}});
+    con.dataRow({std::to_string(i * 10)});
+    con.message('C', ScriptConnection::cstr("SELECT 1"));
+    con.message('Z', "I");
+  }
+
+  pv3::FSM fsm(mios, con);
+  std::error_code er;
+  fsm.connect(Option{}, [&](const std::error_code &ec) { er = ec; });
+  if (er) { cout << "Error: " << er.message() << endl; return; }
+
+  DBQuery q("stmt", "select $1::int4 * 10");
+  ResultSet rset;
+  for (int i = 1; i <= 2; ++i)
+  {
+    q.reset();
+    q.bind(i);
+    rset.reset();
+
+    er = make_error_code(lapq::errc::busy);
+    fsm.exec(&q, &rset, [&](const std::error_code &ec) { er = ec; });
+    if (er) { cout << "Error: " << er.message() << endl; return; }
+
+    std::string bind(con.bind.begin(), con.bind.end());
+    if (q.bind_value().size() != 1
+        || bind.find(ScriptConnection::int32(1) + std::to_string(i))
+           == std::string::npos)
+    {
+      cout << "Error: bind" << endl;
+      return;
+    }
+
+    if (rset.size() != 1 || rset[0].size() != 1
+        || rset[0].get<int>(0, 0) != i * 10)
+    {
+      cout << "Error: unexpected value" << endl;
+      return;
+    }
+  }
+
+  // Characters bind as text, not as their code.
+  DBQuery c("select $1, $2");
+  c.bind('x');
+  c.bind(static_cast<unsigned char>('y'));
+  if (c.bind_value()[0] != "x" || c.bind_value()[1] != "y") {
+    cout << "Error: bind char=" << c.bind_value()[0] << endl;
+    return;
+  }
+
+  cout << "Ok" << endl;
+}
+
+
+//============================================================================
+// A failed write of an extended query or a Parse reaches the handler.
+//
+void write_error(int, char **)
+{
+  for (auto broken : {'B', 'D', 'E', 'S', 'P'})
+  {
+    asio::io_service mios;
+    ScriptConnection con;
+    con.startup();
+
+    pv3::FSM fsm(mios, con);
+    std::error_code er;
+    fsm.connect(Option{}, [&](const std::error_code &ec) { er = ec; });
+    if (er) { cout << "Error: " << er.message() << endl; return; }
+
+    con.broken = broken;
+    DBQuery q("stmt", "select 1");
+    ResultSet rset;
+    auto eh = [&](const std::error_code &ec) { er = ec; };
+    if (broken == 'P') { fsm.parse(&q, eh); }
+    else { fsm.exec(&q, &rset, eh); }
+
+    if (er.value() != EPIPE) {
+      cout << "Error: " << broken << " " << er.message() << endl;
+      return;
+    }
+  }
+
+  cout << "Ok" << endl;
+}
+
+
+//============================================================================
+// Frame messages out of a socket through a RecvBuffer, blocking and
+// asynchronous, including a message larger than the buffer.
+//
+void recv_buffer(int, char **)
+{
+  constexpr int rows = 2000;
+  const std::string big(3 * pv3::RecvBuffer::CAPACITY + 7, 'x');
+
+  ScriptConnection con;
+  for (int i = 0; i < rows; ++i) { con.dataRow({std::to_string(i)}); }
+  con.dataRow({big});
+  con.message('Z', "I");
+
+  // The DataRows in order, then the big one, then ReadyForQuery.
+  int n = 0;
+  auto check = [&](const pv3::Header &head, const Buffer &body)
+  {
+    if (n++ > rows) { return head.messageType() == 'Z'; }
+    std::string value(body.begin() + 6, body.end());
+    return value == (n <= rows ? std::to_string(n - 1) : big);
+  };
+
+  using Socket = asio::local::stream_protocol::socket;
+  asio::io_service mios;
+
+  for (auto async : {false, true})
+  {
+    Socket reader(mios), writer(mios);
+    asio::local::connect_pair(reader, writer);
+    std::thread feed([&] { asio::write(writer, asio::buffer(con.script())); });
+
+    pv3::RecvBuffer rb(mios);
+    std::error_code er;
+    bool ok = true;
+    n = 0;
+
+    if (!async) {
+      Buffer hbuf, body;
+      while (ok && n <= rows + 1) {
+        pv3::Header head;
+        pv3::syncRead(reader, rb, pv3::Header::size(), hbuf, er);
+        if (!er) { er = head.deserialize(hbuf); }
+        if (!er) { pv3::syncRead(reader, rb, head.bodyLen(), body, er); }
+        if (er) { break; }
+        ok = check(head, body);
+      }
+    }
+    else {
+      std::function<void()> next = [&]
+      {
+        pv3::asyncRead(reader, rb, pv3::Header::size(), nullptr,
+        [&](const std::error_code &ec, std::size_t, const Buffer &hbuf)
+        {
+          pv3::Header head;
+          er = ec ? ec : head.deserialize(hbuf);
+          if (er) { return; }
+
+          pv3::asyncRead(reader, rb, head.bodyLen(), nullptr,
+          [&, head](const std::error_code &ec, std::size_t, const Buffer &body)
+          {
+            er = ec;
+            if (er) { return; }
+            ok = check(head, body);
+            if (ok && n <= rows + 1) { next(); }
+          });
+        });
+      };
+      next();
+      mios.restart();
+      mios.run();
+    }
+    feed.join();
+
+    if (er || !ok || n != rows + 2) {
+      cout << "Error: async=" << async << " n=" << n << " " << er.message()
+           << endl;
+      return;
+    }
+  }
+
+  cout << "Ok" << endl;
+}
+
+
+//============================================================================
+// A self-signed EC certificate for localhost.
+//
+struct SelfSigned
+{
+  SelfSigned() : key(EVP_EC_gen("P-256")), cert(X509_new())
+  {
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+    X509_set_pubkey(cert, key);
+
+    auto name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+      reinterpret_cast<const unsigned char *>("localhost"), -1, -1, 0);
+    X509_set_issuer_name(cert, name);
+    X509_sign(cert, key, EVP_sha256());
+  }
+
+  ~SelfSigned() { X509_free(cert); EVP_PKEY_free(key); }
+
+  void use(asio::ssl::context &ctx)
+  {
+    SSL_CTX_use_certificate(ctx.native_handle(), cert);
+    SSL_CTX_use_PrivateKey(ctx.native_handle(), key);
+  }
+
+  void write(const std::string &cert_file, const std::string &key_file)
+  {
+    auto f = fopen(cert_file.c_str(), "w");
+    PEM_write_X509(f, cert);
+    fclose(f);
+    f = fopen(key_file.c_str(), "w");
+    PEM_write_PrivateKey(f, key, nullptr, nullptr, 0, nullptr, nullptr);
+    fclose(f);
+  }
+
+  EVP_PKEY *key;
+  X509 *cert;
+};
+
+
+//============================================================================
+// The backend side of a blocking socket.
+//
+struct FakeBackend
+{
+  using tcp = asio::ip::tcp;
+
+  /// Reads the StartUp, false on EOF.
+  static bool startup(tcp::socket &s)
+  {
+    std::error_code ec;
+    char len[4];
+    asio::read(s, asio::buffer(len), ec);
+    if (ec) { return false; }
+
+    std::uint32_t n;
+    std::memcpy(&n, len, 4);
+    std::string body(ntohl(n) - 4, '\0');
+    asio::read(s, asio::buffer(body), ec);
+    return !ec;
+  }
+
+  /// Reads a message and returns its type, 0 on EOF.
+  static char message(tcp::socket &s)
+  {
+    std::error_code ec;
+    char header[5];
+    asio::read(s, asio::buffer(header), ec);
+    if (ec) { return 0; }
+
+    std::uint32_t n;
+    std::memcpy(&n, header + 1, 4);
+    std::string body(ntohl(n) - 4, '\0');
+    asio::read(s, asio::buffer(body), ec);
+    return ec ? 0 : header[0];
+  }
+};
+
+
+//============================================================================
+// Connection attempts are raced: a refused host fails over to the next at
+// once, a stalled one is overtaken after opt::ATTEMPT_DELAY and closed when
+// another wins, and a server rejected by opt::TARGET_SESSION_ATTRS is told
+// to Terminate. The AsyncConnection is released once the caller lets go.
+//
+void race(int, char **)
+{
+  using tcp = asio::ip::tcp;
+  const tcp::endpoint loopback(asio::ip::address_v4::loopback(), 0);
+  auto port = [](tcp::acceptor &a)
+  {
+    return std::to_string(a.local_endpoint().port());
+  };
+
+  asio::io_service sios;
+  tcp::acceptor stall(sios, loopback), good(sios, loopback);
+  tcp::acceptor replica(sios, loopback);
+  std::string refused;
+  {
+    tcp::acceptor closed(sios, loopback);
+    refused = port(closed);
+  }
+
+  ScriptConnection ready;
+  ready.startup();
+
+  ScriptConnection readonly;
+  readonly.rowDescription({{"transaction_read_only", pg::PG_TEXTOID}});
+  readonly.dataRow({"on"});
+  readonly.message('C', ScriptConnection::cstr("SHOW"));
+  readonly.message('Z', "I");
+
+  bool stall_closed = false;
+  char terminated = 0;
+  std::thread server([&]
+  {
+    std::error_code ec;
+    tcp::socket s1(sios), s2(sios), s3(sios);
+
+    stall.accept(s1, ec);
+    FakeBackend::startup(s1);
+
+    good.accept(s2, ec);
+    FakeBackend::startup(s2);
+    asio::write(s2, asio::buffer(ready.script()), ec);
+    stall_closed = (FakeBackend::message(s1) == 0);
+
+    replica.accept(s3, ec);
+    FakeBackend::startup(s3);
+    asio::write(s3, asio::buffer(ready.script()), ec);
+    if (FakeBackend::message(s3) == 'Q') {
+      asio::write(s3, asio::buffer(readonly.script()), ec);
+      terminated = FakeBackend::message(s3);
+    }
+  });
+
+  asio::io_service mios;
+  std::error_code er = make_error_code(lapq::errc::busy);
+  auto con = AsyncConnection::create(mios);
+  con->connect({{opt::USER, "gptest"},
+                {opt::HOST, "127.0.0.1,127.0.0.1,127.0.0.1"},
+                {opt::PORT, refused + "," + port(stall) + "," + port(good)},
+                {opt::ATTEMPT_DELAY, "100"}},
+               [&](const std::error_code &ec) { er = ec; });
+  mios.run();
+
+  std::weak_ptr<AsyncConnection> weak = con;
+  con.reset();
+
+  std::error_code rejected;
+  auto con2 = AsyncConnection::create(mios);
+  con2->connect({{opt::USER, "gptest"}, {opt::HOST, "127.0.0.1"},
+                 {opt::PORT, port(replica)},
+                 {opt::TARGET_SESSION_ATTRS, "read-write"}},
+                [&](const std::error_code &ec) { rejected = ec; });
+  mios.restart();
+  mios.run();
+  server.join();
+
+  if (er || !weak.expired() || !stall_closed) {
+    cout << "Error: " << er.message() << " expired=" << weak.expired()
+         << " stall_closed=" << stall_closed << endl;
+    return;
+  }
+
+  if (rejected != lapq::errc::session_attrs || terminated != 'X') {
+    cout << "Error: " << rejected.message() << " terminated="
+         << int(terminated) << endl;
+    return;
+  }
+
+  cout << "Ok" << endl;
+}
+
+
+//============================================================================
+// The second TLS connection to a server resumes the session of the first.
+// A verify_full connection does not resume the session of a require one,
+// which skipped the certificate check, and so fails on the self-signed
+// certificate.
+//
+void ssl_session(int, char **)
+{
+  using tcp = asio::ip::tcp;
+
+  asio::io_service mios;
+  asio::ssl::context sctx(asio::ssl::context::tls_server);
+  SelfSigned().use(sctx);
+
+  tcp::acceptor acceptor(mios, tcp::endpoint(asio::ip::address_v4::loopback(),
+                                             0));
+  auto ep = acceptor.local_endpoint();
+
+  // Answer the SSLRequest, send one byte after the handshake and wait for
+  // the client to close.
+  std::thread server([&]
+  {
+    for (int i = 0; i < 3; ++i)
+    {
+      std::error_code ec;
+      asio::ssl::stream<tcp::socket> s(mios, sctx);
+      acceptor.accept(s.next_layer(), ec);
+
+      char request[8];
+      asio::read(s.next_layer(), asio::buffer(request), ec);
+      asio::write(s.next_layer(), asio::buffer("S", 1), ec);
+      s.handshake(asio::ssl::stream_base::server, ec);
+      asio::write(s, asio::buffer("x", 1), ec);
+      s.read_some(asio::buffer(request), ec);
+    }
+  });
+
+  asio::ssl::context cctx(asio::ssl::context::tls_client);
+  std::vector<bool> resumed;
+  std::error_code er;
+
+  for (int i = 0; i < 3 && !er; ++i)
+  {
+    auto sslmode = (i < 2) ? SSLMode::require : SSLMode::verify_full;
+    pv3::SSLConnection con(mios, sslmode, cctx, {ep}, {}, "localhost");
+    auto eh = [&](const std::error_code &ec) { if (!er) { er = ec; } };
+    con.connect(eh);
+    if (!er) { con.handshake(eh); }
+    if (!er) {
+      con.read(1, [&](const std::error_code &ec, std::size_t, const Buffer &)
+      {
+        er = ec;
+      });
+    }
+    resumed.push_back(con.resumed());
+    con.close(eh);
+  }
+  server.join();
+
+  if (!er || resumed != std::vector<bool>{false, true, false}
+      || pv3::SessionCache::instance().size() != 1)
+  {
+    cout << "Error: resumed=" << resumed.size() << " " << er.message()
+         << endl;
+    return;
+  }
+
+  cout << "Ok" << endl;
+}
+
+
+//============================================================================
+// Contexts with the same SSL options are shared until a file changes, and
+// used by a Connection given opt::SSLMODE without a context.
+//
+void ssl_context(int, char **)
+{
+  namespace fs = std::filesystem;
+
+  auto dir = fs::temp_directory_path() / ("lapq-" + std::to_string(getpid()));
+  fs::create_directory(dir);
+  auto cert = (dir / "client.crt").string();
+  auto key = (dir / "client.key").string();
+  SelfSigned().write(cert, key);
+
+  Option option{{opt::SSLCERT, cert}, {opt::SSLKEY, key}};
+  Error er1, er2, er3, er4;
+  auto c1 = util::sharedContext(option, er1);
+  auto c2 = util::sharedContext(option, er2);
+
+  fs::last_write_time(cert, fs::last_write_time(cert) + std::chrono::seconds(1));
+  auto c3 = util::sharedContext(option, er3);
+
+  option[opt::SSLKEY] = (dir / "missing.key").string();
+  auto c4 = util::sharedContext(option, er4);
+  fs::remove_all(dir);
+
+  if (er1 || er2 || er3 || !c1 || c1 != c2 || c3 == c1 || !c3 || !er4 || c4) {
+    cout << "Error: " << er1.what() << " " << er3.what() << endl;
+    return;
+  }
+
+  // With opt::SSLMODE a connection loads the shared context, and fails
+  // before connecting if it cannot.
+  asio::io_service mios;
+  option[opt::SSLMODE] = "require";
+  if (Connection(mios).connect(option) != er4.code()) {
+    cout << "Error: context not loaded" << endl;
+    return;
+  }
+
+  using tcp = asio::ip::tcp;
+  tcp::acceptor acceptor(mios, tcp::endpoint(asio::ip::address_v4::loopback(),
+                                             0));
+  std::string request;
+  std::thread server([&]
+  {
+    std::error_code ec;
+    tcp::socket s(mios);
+    acceptor.accept(s, ec);
+    char buf[8];
+    asio::read(s, asio::buffer(buf), ec);
+    if (!ec) { request.assign(buf, sizeof(buf)); }
+    asio::write(s, asio::buffer("N", 1), ec);
+  });
+
+  auto port = std::to_string(acceptor.local_endpoint().port());
+  auto er = Connection(mios).connect({{opt::HOST, "127.0.0.1"},
+                                      {opt::PORT, port},
+                                      {opt::SSLMODE, "require"}});
+  std::error_code ec;
+  tcp::socket unblock(mios);                // the server, if not connected
+  unblock.connect(acceptor.local_endpoint(), ec);
+  server.join();
+
+  // The length and code of an SSLRequest.
+  if (!er || request != ScriptConnection::int32(8)
+                        + ScriptConnection::int32(80877103))
+  {
+    cout << "Error: no SSLRequest " << er.message() << endl;
+    return;
+  }
+
+  cout << "Ok" << endl;
+}
+
+
+//============================================================================
+// With sslnegotiation=direct the handshake starts without an SSLRequest and
+// fails unless the server selects ALPN "postgresql".
+//
+void ssl_direct(int, char **)
+{
+  using tcp = asio::ip::tcp;
+
+  auto negotiation = util::getSSLNegotiation({{opt::SSLNEGOTIATION, "direct"}});
+  if (negotiation != SSLNegotiation::direct) {
+    cout << "Error: negotiation" << endl;
+    return;
+  }
+
+  asio::io_service mios;
+  SelfSigned cert;
+  asio::ssl::context alpn(asio::ssl::context::tls_server);
+  asio::ssl::context plain(asio::ssl::context::tls_server);
+  cert.use(alpn);
+  cert.use(plain);
+
+  SSL_CTX_set_alpn_select_cb(alpn.native_handle(),
+  [](SSL *, const unsigned char **out, unsigned char *outlen,
+     const unsigned char *in, unsigned int inlen, void *) -> int
+  {
+    if (inlen < 11 || std::memcmp(in, "\x0apostgresql", 11) != 0) {
+      return SSL_TLSEXT_ERR_ALERT_FATAL;
+    }
+    *out = in + 1;
+    *outlen = 10;
+    return SSL_TLSEXT_ERR_OK;
+  }, nullptr);
+
+  tcp::acceptor acceptor(mios, tcp::endpoint(asio::ip::address_v4::loopback(),
+                                             0));
+  auto ep = acceptor.local_endpoint();
+
+  // The first byte from the client must start a TLS record.
+  char first = 0;
+  std::thread server([&]
+  {
+    for (auto ctx : {&alpn, &plain})
+    {
+      std::error_code ec;
+      asio::ssl::stream<tcp::socket> s(mios, *ctx);
+      acceptor.accept(s.next_layer(), ec);
+      s.next_layer().receive(asio::buffer(&first, 1),
+                             tcp::socket::message_peek, ec);
+      s.handshake(asio::ssl::stream_base::server, ec);
+      char buf[1];
+      s.read_some(asio::buffer(buf), ec);
+    }
+  });
+
+  asio::ssl::context cctx(asio::ssl::context::tls_client);
+  std::vector<std::error_code> result;
+  for (int i = 0; i < 2; ++i)
+  {
+    pv3::SSLConnection con(mios, SSLMode::require, cctx, {ep}, {}, {},
+                           SSLNegotiation::direct);
+    std::error_code er;
+    auto eh = [&](const std::error_code &ec) { if (!er) { er = ec; } };
+    con.connect(eh);
+    if (!er) { con.handshake(eh); }
+    result.push_back(er);
+    con.close([](const std::error_code &) {});
+  }
+  server.join();
+
+  if (first != 0x16 || result[0]
+      || result[1] != std::error_code(EPROTO, std::generic_category()))
+  {
+    cout << "Error: first=" << int(first) << " " << result[0].message()
+         << " " << result[1].message() << endl;
+    return;
+  }
+
+  cout << "Ok" << endl;
+}
+
+
+//============================================================================
+// KTLSAsyncConnection frames the messages of a TLS server and writes a
+// Query, with or without kTLS in the kernel.
+//
+void ssl_ktls(int, char **)
+{
+  using tcp = asio::ip::tcp;
+  constexpr int rows = 2000;
+  const std::string big(3 * pv3::RecvBuffer::CAPACITY + 7, 'x');
+
+  ScriptConnection script;
+  for (int i = 0; i < rows; ++i) { script.dataRow({std::to_string(i)}); }
+  script.dataRow({big});
+  script.message('Z', "I");
+
+  asio::io_service mios;
+  asio::ssl::context sctx(asio::ssl::context::tls_server);
+  SelfSigned().use(sctx);
+
+  tcp::acceptor acceptor(mios, tcp::endpoint(asio::ip::address_v4::loopback(),
+                                             0));
+  auto ep = acceptor.local_endpoint();
+
+  // Answer the SSLRequest, send the script and read the Query.
+  std::string query;
+  std::thread server([&]
+  {
+    std::error_code ec;
+    asio::ssl::stream<tcp::socket> s(mios, sctx);
+    acceptor.accept(s.next_layer(), ec);
+
+    char request[8];
+    asio::read(s.next_layer(), asio::buffer(request), ec);
+    asio::write(s.next_layer(), asio::buffer("S", 1), ec);
+    s.handshake(asio::ssl::stream_base::server, ec);
+    asio::write(s, asio::buffer(script.script()), ec);
+
+    char buf[64];
+    auto n = asio::read(s, asio::buffer(buf, 5 + 9), ec);
+    query.assign(buf, n);
+  });
+
+  asio::ssl::context cctx(asio::ssl::context::tls_client);
+  auto con = std::make_shared<pv3::KTLSAsyncConnection>(mios, SSLMode::require,
+               cctx, pv3::KTLSAsyncConnection::Endpoints{ep});
+
+  int n = 0;
+  std::error_code er;
+  std::function<void()> next = [&]
+  {
+    con->read(pv3::Header::size(),
+    [&](const std::error_code &ec, std::size_t, const Buffer &hbuf)
+    {
+      pv3::Header head;
+      er = ec ? ec : head.deserialize(hbuf);
+      if (er) { return; }
+
+      con->read(head.bodyLen(),
+      [&, head](const std::error_code &ec, std::size_t, const Buffer &body)
+      {
+        er = ec;
+        if (er) { return; }
+
+        bool ok = (n < rows) ? std::string(body.begin() + 6, body.end())
+                               == std::to_string(n)
+                : (n == rows) ? body.size() == big.size() + 6
+                : head.messageType() == 'Z';
+        if (!ok) { er = std::error_code(EBADMSG, std::generic_category()); }
+        if (er || n++ <= rows) { if (!er) { next(); } return; }
+
+        con->write(pv3::Query("select 1"),
+        [&](const std::error_code &ec, std::size_t) { er = ec; });
+      });
+    });
+  };
+
+  con->connect([&](const std::error_code &ec)
+  {
+    if (ec) { er = ec; return; }
+    con->handshake([&](const std::error_code &ec)
+    {
+      if (ec) { er = ec; return; }
+      next();
+    });
+  });
+  mios.run();
+  server.join();
+
+  if (er || n != rows + 2 || query.substr(5) != std::string("select 1\0", 9))
+  {
+    cout << "Error: n=" << n << " " << er.message() << endl;
+    return;
+  }
+
+  cout << "Ok ktls send=" << con->ktlsSend() << " receive="
+       << con->ktlsReceive() << endl;
+}
+
+
+//============================================================================
+int main(int argc, char *argv[])
+{
+  if (argc < 2) {
+    cerr << "Error: Requires at least one test name." << endl;
+    return 1;
+  }
+
+  if (argv[1] == 0) {
+    cerr << "Error: Requires a valid test name." << endl;
+    return 1;
+  }
+
+//----------------------------------------------------------------------------
+  utest::FunctionRunner tests;
+  tests.ADDFUNC(connect_ignore);
+  tests.ADDFUNC(startup_options);
+  tests.ADDFUNC(query_rows);
+  tests.ADDFUNC(many_rows);
+  tests.ADDFUNC(truncated_row);
+  tests.ADDFUNC(query_error);
+  tests.ADDFUNC(exec_reuse);
+  tests.ADDFUNC(write_error);
+  tests.ADDFUNC(budget);
+  tests.ADDFUNC(recv_buffer);
+  tests.ADDFUNC(ssl_session);
+  tests.ADDFUNC(ssl_context);
+  tests.ADDFUNC(ssl_direct);
+  tests.ADDFUNC(ssl_ktls);
+  tests.ADDFUNC(scram);
+  tests.ADDFUNC(parameter_status);
+  tests.ADDFUNC(race);
+
+//----------------------------------------------------------------------------
+  if (!tests.run(argv[1], argc, argv)) {
+    cerr << "Error: Unknown test (" << argv[1] << ")" << endl;
+    return 1;
+  }
+
+  return 0;
+}
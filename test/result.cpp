@@ -0,0 +1,842 @@
+/*
+ * Fill result sinks the way the protocol layer does. These tests do not
+ * require a database server.
+ */
+
+
+#include <iostream>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <optional>
+#include <vector>
+#include <memory_resource>
+
+#include "lapq.h"
+#include "function-runner.h"
+
+using namespace std;
+using namespace lapq;
+
+using Row = std::vector<std::optional<std::string>>;
+
+struct Item
+{
+  std::optional<bool> flag;
+  std::optional<std::string> name;
+  std::optional<int> num;
+};
+
+LAPQ_MAPPING(Item, lapq::field("name", &Item::name),
+                   lapq::field(1, &Item::num),
+                   lapq::field("flag", &Item::flag))
+
+struct Event
+{
+  pg::Timestamp at;
+  std::optional<pg::Interval> length;
+};
+
+LAPQ_MAPPING(Event, lapq::field("at", &Event::at),
+                    lapq::field("length", &Event::length))
+
+
+//============================================================================
+pg::FieldSpec field(const std::string &name, int oid)
+{
+  return pg::FieldSpec{name, 0, 0, oid, -1, -1, 0};
+}
+
+//----------------------------------------------------------------------------
+// Adds one statement result with the given rows, std::nullopt is NULL.
+//
+void feed(ResultBase &res,
+          const std::vector<pg::FieldSpec> &fs,
+          const std::vector<Row> &rows)
+{
+  res.add_result(fs);
+  for (auto &r : rows)
+  {
+    res.add_row();
+    for (std::size_t i = 0; i < r.size(); ++i)
+    {
+      if (r[i]) { res.add_column(i, r[i]->data(), r[i]->size()); }
+      else { res.add_column(i, nullptr, -1); }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+const std::vector<pg::FieldSpec> fields
+{
+  field("name", pg::PG_TEXTOID),
+  field("num", pg::PG_INT4OID),
+  field("flag", pg::PG_BOOLOID)
+};
+
+const std::vector<Row> rows
+{
+  {"one", "1", "t"},
+  {std::nullopt, std::nullopt, std::nullopt},
+  {"three", "-3", "f"}
+};
+
+
+//============================================================================
+// Decoders are resolved per column, built in OIDs from the flat table and
+// user types from the hash map.
+//
+void record_set(int, char **)
+{
+  pg::PGFormat pgf;
+  pgf.emplace(pg::PG_INT4OID, [](const char *, int) { return std::any(0); });
+  pgf.emplace(16404, [](const char *buf, int sz) {
+    return std::any(std::string(buf, sz) + "!");
+  });
+
+  auto fs = fields;
+  fs.push_back(field("color", 16404));
+  fs.push_back(field("price", pg::PG_CASHOID));
+
+  ResultSet rset(pgf);
+  feed(rset, fs, {{"one", "1", "t", "red", "$1.00"}});
+
+  auto &rs = rset[0];
+  if (!rset || rs.size() != 1
+      || rs.get<int>(0, "num") != 1
+      || rs.get<std::string>(0, "color") != "red!"
+      || rs.get<std::string>(0, "price") != "$1.00"
+      || !rs.get<bool>(0, 2))
+  {
+    cout << "Error: unexpected value" << endl;
+    return;
+  }
+
+  cout << "Ok" << endl;
+}
+
+
+//============================================================================
+// Names are resolved once to a handle that is used as a position.
+//
+void column_handle(int, char **)
+{
+  auto fs = fields;
+  fs.push_back(field("num", pg::PG_TEXTOID));     // repeated name
+
+  ResultSet rset;
+  feed(rset, fs, {{"one", "1", "t", "x"}, {"two", "2", "f", "y"}});
+
+  auto &rs = rset[0];
+  auto num = rs.handle("num");
+  if (!num || num.index() != 1 || rs.handle("flag").index() != 2) {
+    cout << "Error: handle" << endl;
+    return;
+  }
+
+  int sum = 0;
+  for (std::size_t r = 0; r < rs.size(); ++r) { sum += rs.get<int>(r, num); }
+
+  if (sum != 3 || rs.get<std::string>(1, "name") != "two") {
+    cout << "Error: unexpected value" << endl;
+    return;
+  }
+
+  try {
+    rs.handle("none");
+    cout << "Error: unknown column" << endl;
+    return;
+  }
+  catch (const std::out_of_range &) {}
+
+  cout << "Ok" << endl;
+}
+
+
+//============================================================================
+// reset() keeps the sets and rows of the previous execution for reuse.
+//
+void reset(int, char **)
+{
+  ResultSet rset;
+  feed(rset, fields, rows);
+  auto record = rset[0][0].data();
+
+  ColumnResultSet cset;
+  feed(cset, fields, rows);
+  auto blob = cset[0].column(0).text(0).data();
+
+  rset.reset();
+  cset.reset();
+  if (rset || rset.size() != 0 || cset.size() != 0) {
+    cout << "Error: reset" << endl;
+    return;
+  }
+
+  // A reused set without rows shows none of the previous ones.
+  feed(rset, fields, {});
+  if (!rset[0].empty() || rset[0].begin() != rset[0].end()) {
+    cout << "Error: stale rows" << endl;
+    return;
+  }
+  rset.reset();
+
+  feed(rset, fields, {rows[2]});
+  feed(cset, fields, {rows[2]});
+  if (rset.size() != 1 || rset[0].size() != 1 || cset[0].size() != 1
+      || rset[0].get<std::string>(0, "name") != "three"
+      || &rset[0].front() != &rset[0].back()
+      || cset[0].get<std::string_view>(0, 0) != "three")
+  {
+    cout << "Error: unexpected value" << endl;
+    return;
+  }
+
+  if (rset[0][0].data() != record || cset[0].column(0).text(0).data() != blob)
+  {
+    cout << "Error: storage not reused" << endl;
+    return;
+  }
+
+  cout << "Ok" << endl;
+}
+
+
+//============================================================================
+// Counts the bytes allocated through it.
+//
+class CountingResource : public std::pmr::memory_resource {
+public:
+  std::size_t bytes = 0;
+
+private:
+  void *do_allocate(std::size_t n, std::size_t align) override
+  {
+    bytes += n;
+    return std::pmr::new_delete_resource()->allocate(n, align);
+  }
+
+  void do_deallocate(void *p, std::size_t n, std::size_t align) override
+  {
+    std::pmr::new_delete_resource()->deallocate(p, n, align);
+  }
+
+  bool do_is_equal(const memory_resource &o) const noexcept override
+  {
+    return this == &o;
+  }
+
+}; // CountingResource
+
+
+//============================================================================
+// Rows are allocated from the memory resource given to the result.
+//
+void memory_resource(int, char **)
+{
+  CountingResource mr;
+  {
+    ResultSet rset(&mr);
+    feed(rset, fields, rows);
+    if (rset[0].size() != 3 || mr.bytes == 0
+        || rset[0][2].get_allocator().resource() != &mr)
+    {
+      cout << "Error: ResultSet bytes=" << mr.bytes << endl;
+      return;
+    }
+
+    // Copies stay on the resource as well.
+    auto bytes = mr.bytes;
+    ResultSet copy(rset);
+    RecordSet<> set(rset[0]);
+    if (mr.bytes == bytes || copy[0][2].get_allocator().resource() != &mr
+        || set[2].get_allocator().resource() != &mr || set.size() != 3)
+    {
+      cout << "Error: copy bytes=" << mr.bytes - bytes << endl;
+      return;
+    }
+  }
+
+  mr.bytes = 0;
+  std::pmr::monotonic_buffer_resource arena(&mr);
+  {
+    TypedResult<std::optional<std::string_view>, std::optional<int>,
+                std::optional<bool>> tset(&arena);
+    feed(tset, fields, rows);
+    if (std::get<0>(tset[0][2]) != "three" || mr.bytes == 0) {
+      cout << "Error: TypedResult bytes=" << mr.bytes << endl;
+      return;
+    }
+  }
+
+  cout << "Ok" << endl;
+}
+
+
+//============================================================================
+// Columns are stored contiguously by type with a validity bitmap.
+//
+void column_set(int, char **)
+{
+  ColumnResultSet rset;
+  feed(rset, fields, rows);
+
+  auto &cs = rset[0];
+  if (!rset || cs.size() != 3 || cs.column_count() != 3) {
+    cout << "Error: size=" << cs.size() << endl;
+    return;
+  }
+
+  auto num = cs.column("num").values<std::int32_t>();
+  if (num.size() != 3 || num[0] != 1 || num[2] != -3) {
+    cout << "Error: int4 column" << endl;
+    return;
+  }
+
+  if (cs.get<std::string_view>(2, 0) != "three"
+      || cs.get<std::string>(0, "name") != "one"
+      || !cs.get<bool>(0, 2) || cs.get<bool>(2, "flag"))
+  {
+    cout << "Error: unexpected value" << endl;
+    return;
+  }
+
+  if (!cs.is_null(1, 0) || !cs.is_null(1, 1) || cs.is_null(2, 2)) {
+    cout << "Error: validity" << endl;
+    return;
+  }
+
+  cout << "Ok" << endl;
+}
+
+
+//============================================================================
+// A text column in dictionary mode stores a code per row.
+//
+void dictionary(int, char **)
+{
+  const char *color[] = {"red", "green", "blue"};
+  std::vector<Row> data;
+  for (int i = 0; i < 1000; ++i)
+  {
+    if (i % 100 == 7) { data.push_back({std::nullopt}); }
+    else { data.push_back({color[i % 3]}); }
+  }
+
+  ColumnResultSet rset;
+  rset.dictionary("color");
+  feed(rset, {field("color", 16404)}, data);
+
+  auto &col = rset[0].column("color");
+  if (col.kind() != Column::Kind::DICT || col.size() != 1000
+      || col.dictionary_size() != 3)
+  {
+    cout << "Error: dictionary_size=" << col.dictionary_size() << endl;
+    return;
+  }
+
+  auto codes = col.values<Column::code_type>();
+  for (std::size_t i = 0; i < codes.size(); ++i)
+  {
+    auto expect = (i % 100 == 7) ? std::string_view{} : color[i % 3];
+    if (rset[0].get<std::string_view>(i, 0) != expect
+        || (codes[i] == Column::null_code) != rset[0].is_null(i, 0)
+        || (!col.is_null(i) && col.dictionary(codes[i]) != expect))
+    {
+      cout << "Error: row " << i << endl;
+      return;
+    }
+  }
+
+  cout << "Ok" << endl;
+}
+
+
+//============================================================================
+// Batches decoded on a pool are stitched in order and match the
+// ColumnResultSet of the same rows, including the validity bitmap across
+// batch boundaries and the codes of a dictionary column. Decoder exceptions
+// become an SQLError.
+//
+void parallel(int, char **)
+{
+  const char *color[] = {"red", "green", "blue", "cyan"};
+  const std::vector<pg::FieldSpec> fs
+  {
+    field("id", pg::PG_INT8OID),
+    field("name", pg::PG_TEXTOID),
+    field("color", 16404)
+  };
+
+  std::vector<Row> data;
+  for (int i = 0; i < 1000; ++i)
+  {
+    auto id = std::to_string(i);
+    auto name = (i % 13 == 5) ? std::optional<std::string>{}
+                              : std::optional<std::string>{"n" + id};
+    data.push_back({id, name, color[(i * 7) % (i < 500 ? 2 : 4)]});
+  }
+
+  ColumnResultSet expect;
+  expect.dictionary("color");
+  feed(expect, fs, data);
+
+  asio::thread_pool pool(4);
+  ParallelColumnResult rset(pool, 37);
+  rset.dictionary("color");
+
+  auto dataRow = [](const Row &r)
+  {
+    std::string body;
+    body.push_back(0);
+    body.push_back(char(r.size()));
+    for (auto &c : r)
+    {
+      std::uint32_t sz = c ? c->size() : std::uint32_t(-1);
+      for (int n = 3; n >= 0; --n) { body.push_back(char(sz >> (8 * n))); }
+      if (c) { body += *c; }
+    }
+    return body;
+  };
+
+  rset.add_result(fs);
+  for (auto &r : data)
+  {
+    if (!rset.add_raw_row(dataRow(r))) {
+      cout << "Error: add_raw_row" << endl;
+      return;
+    }
+  }
+  rset.end_result();
+
+  auto &cs = rset[0];
+  if (!rset || cs.size() != 1000) {
+    cout << "Error: size=" << cs.size() << endl;
+    return;
+  }
+
+  auto &e = expect[0];
+  for (std::size_t i = 0; i < e.size(); ++i)
+  {
+    for (std::size_t j = 0; j < fs.size(); ++j)
+    {
+      if (cs.is_null(i, j) != e.is_null(i, j)) {
+        cout << "Error: NULL at " << i << "," << j << endl;
+        return;
+      }
+    }
+
+    if (cs.get<std::int64_t>(i, 0) != e.get<std::int64_t>(i, 0)
+        || cs.get<std::string_view>(i, 1) != e.get<std::string_view>(i, 1)
+        || cs.get<std::string_view>(i, "color")
+           != e.get<std::string_view>(i, "color"))
+    {
+      cout << "Error: row " << i << endl;
+      return;
+    }
+  }
+
+  if (cs.column(2).dictionary_size() != 4) {
+    cout << "Error: dictionary_size=" << cs.column(2).dictionary_size()
+         << endl;
+    return;
+  }
+
+  // A decoder that throws fails the statement, in a batch and in place.
+  const std::vector<pg::FieldSpec> num{field("num", pg::PG_INT8OID)};
+  ParallelColumnResult bad(pool, 2);
+  bad.add_result(num);
+  for (auto v : {"1", "x", "3"}) { bad.add_raw_row(dataRow({v})); }
+  bad.end_result();
+  feed(bad, num, {{"1"}, {"x"}, {"3"}});
+
+  if (bad.size() != 2) { cout << "Error: sets=" << bad.size() << endl; return; }
+  for (std::size_t i = 0; i < bad.size(); ++i)
+  {
+    if (bad[i] || bad[i].error().at(SQLErrorField::CODE) != "22000") {
+      cout << "Error: decoder exception in set " << i << endl;
+      return;
+    }
+  }
+
+  cout << "Ok" << endl;
+}
+
+
+//============================================================================
+// Rows are kept undecoded and cells decoded when read.
+//
+void raw_set(int, char **)
+{
+  RawResultSet rset;
+  feed(rset, fields, rows);
+
+  auto &rs = rset[0];
+  if (!rset || rs.size() != 3 || rs.column_count() != 3) {
+    cout << "Error: size=" << rs.size() << endl;
+    return;
+  }
+
+  if (rs.text(2, 0) != "three" || rs.text(0, 1) != "1"
+      || rs.get<int>(2, "num") != -3 || rs.get<std::string>(0, 0) != "one"
+      || !rs.get<bool>(0, 2) || rs.get<bool>(2, "flag"))
+  {
+    cout << "Error: unexpected value" << endl;
+    return;
+  }
+
+  if (!rs.is_null(1, 0) || !rs.is_null(1, 2) || rs.is_null(2, 2)) {
+    cout << "Error: null" << endl;
+    return;
+  }
+
+  rset.clear();
+  if (rset.size() != 0) {
+    cout << "Error: clear" << endl;
+    return;
+  }
+
+  cout << "Ok" << endl;
+}
+
+
+//============================================================================
+// Rows are decoded into tuples, mismatched types fail the statement.
+//
+void typed_set(int, char **)
+{
+  TypedResult<std::optional<std::string_view>, std::optional<int>,
+              std::optional<bool>> rset;
+  feed(rset, fields, rows);
+
+  auto &ts = rset[0];
+  if (!rset || ts.size() != 3) {
+    cout << "Error: " << ts.error() << endl;
+    return;
+  }
+
+  auto &[name, num, flag] = ts[2];
+  if (name != "three" || num != -3 || flag != false
+      || std::get<0>(ts[1]) || std::get<1>(ts[1]))
+  {
+    cout << "Error: unexpected value" << endl;
+    return;
+  }
+
+  TypedResult<std::string, std::int16_t, bool> bad;
+  feed(bad, fields, rows);
+  if (bad || bad[0].error().at(CODE) != "42804" || !bad[0].empty()) {
+    cout << "Error: type mismatch" << endl;
+    return;
+  }
+
+  TypedResult<std::string, int, bool> null;
+  feed(null, fields, rows);
+  if (null || null[0].error().at(CODE) != "22004") {
+    cout << "Error: null" << endl;
+    return;
+  }
+
+  cout << "Ok" << endl;
+}
+
+
+//============================================================================
+// Rows are decoded into the members of a mapped struct.
+//
+void struct_set(int, char **)
+{
+  StructResult<Item> rset;
+  feed(rset, fields, rows);
+
+  auto &ss = rset[0];
+  if (!rset || ss.size() != 3) {
+    cout << "Error: " << ss.error() << endl;
+    return;
+  }
+
+  if (ss[0].name != "one" || ss[0].num != 1 || ss[0].flag != true
+      || ss[1].name || ss[1].num || ss[2].num != -3)
+  {
+    cout << "Error: unexpected value" << endl;
+    return;
+  }
+
+  StructResult<Item> missing;
+  feed(missing, {fields[0], fields[1]}, {});
+  if (missing || missing[0].error().at(CODE) != "42703") {
+    cout << "Error: missing column" << endl;
+    return;
+  }
+
+  cout << "Ok" << endl;
+}
+
+
+//============================================================================
+// Text numbers decode without allocation, also a whole column at a time.
+//
+void text_numbers(int, char **)
+{
+  auto int8 = [](const std::string &s) { return pg::decodeInt8(s.data(), s.size()); };
+
+  if (int8("0") != 0 || int8("-7") != -7 || int8("12345678") != 12345678
+      || int8("1234567890123456") != 1234567890123456
+      || int8("-9223372036854775808") != INT64_MIN
+      || pg::decodeInt2("-32768", 6) != -32768
+      || pg::decodeOid("4294967295", 10) != 4294967295u
+      || pg::decodeFloat8("-1.5e3", 6) != -1500.0
+      || !std::isinf(pg::decodeFloat8("Infinity", 8)))
+  {
+    cout << "Error: unexpected value" << endl;
+    return;
+  }
+
+  for (auto bad : {"", "-", "12a4", "32768", "1 "})
+  {
+    try {
+      pg::decodeInt2(bad, std::strlen(bad));
+      cout << "Error: accepted " << bad << endl;
+      return;
+    }
+    catch (const std::invalid_argument &) {}
+  }
+
+  RawResultSet rset;
+  feed(rset, {field("n", pg::PG_INT8OID), field("x", pg::PG_FLOAT8OID)},
+       {{"1", "0.5"}, {std::nullopt, "2"}, {"-30000000000", std::nullopt}});
+
+  auto n = rset[0].column<std::int64_t>(0);
+  auto x = rset[0].column<std::optional<double>>(1);
+  if (n != std::vector<std::int64_t>{1, 0, -30000000000}
+      || x[0] != 0.5 || x[1] != 2.0 || x[2]
+      || rset[0].get<std::int64_t>(0, "n") != 1)
+  {
+    cout << "Error: column" << endl;
+    return;
+  }
+
+  cout << "Ok" << endl;
+}
+
+
+//============================================================================
+// ISO text and binary dates and times decode into std::chrono types. The
+// text decoders are only picked by a format that opted in to them, while the
+// server reports DateStyle ISO and, for interval, IntervalStyle postgres.
+//
+void date_time(int, char **)
+{
+  using namespace std::chrono;
+  auto text = [](auto f, const std::string &s) { return f(s.data(), s.size()); };
+
+  auto leap = sys_days(year(2024) / February / 29);
+  if (text(pg::decodeDate, "2024-02-29") != year(2024) / February / 29
+      || text(pg::decodeDate, "0044-03-15 BC") != year(-43) / March / 15
+      || text(pg::decodeDate, "infinity") != year::max() / December / 31
+      || text(pg::decodeTime, "13:45:07.25") != 49507250000us
+      || text(pg::decodeTime, "24:00:00") != 24h
+      || text(pg::decodeTimestamp, "2024-02-29 13:45:00.000001")
+         != leap + 13h + 45min + 1us
+      || text(pg::decodeTimestampTZ, "2024-02-29 13:45:00+05:30")
+         != leap + 8h + 15min
+      || text(pg::decodeTimestampTZ, "2024-02-29 00:00:00-03")
+         != leap + 3h
+      || text(pg::decodeTimestampTZ, "2024-02-29 00:00:00") != leap
+      || text(pg::decodeTimestamp, "-infinity") != pg::Timestamp::min())
+  {
+    cout << "Error: text" << endl;
+    return;
+  }
+
+  if (text(pg::decodeInterval, "1 year 2 mons -3 days +04:05:06.5")
+      != pg::Interval{14706500000, -3, 14}
+      || text(pg::decodeInterval, "-00:00:01") != pg::Interval{-1000000, 0, 0}
+      || text(pg::decodeInterval, "1 day") != pg::Interval{0, 1, 0}
+      || text(pg::decodeInterval, "00:00:00") != pg::Interval{})
+  {
+    cout << "Error: interval" << endl;
+    return;
+  }
+
+  for (auto bad : {"", "2024-02-30", "2024-2-29", "2024-02-29 10:00:00+",
+                   "2024-02-29T10:00:00", "2024-02-29 10:00:00.1234567",
+                   "29/02/2024"})
+  {
+    try {
+      pg::decodeTimestampTZ(bad, std::strlen(bad));
+      cout << "Error: accepted " << bad << endl;
+      return;
+    }
+    catch (const std::invalid_argument &) {}
+  }
+
+  // 2000-01-02 00:00:01 as days and microseconds since 2000-01-01
+  std::string day("\0\0\0\1", 4);
+  std::string us("\0\0\0\x14\x1d\xe6\xa2\x40", 8);   // 86401000000
+  std::string iv = us + std::string("\xff\xff\xff\xff\0\0\0\2", 8);
+  if (pg::decodeDateBinary(day.data(), 4) != year(2000) / January / 2
+      || pg::decodeTimestampBinary(us.data(), 8)
+         != sys_days(year(2000) / January / 2) + 1s
+      || pg::decodeTimeBinary(us.data(), 8) != 24h + 1s
+      || pg::decodeIntervalBinary(iv.data(), 16)
+         != pg::Interval{86401000000, -1, 2})
+  {
+    cout << "Error: binary" << endl;
+    return;
+  }
+
+  const std::vector<pg::FieldSpec> fs
+  {
+    field("at", pg::PG_TIMESTAMPTZOID), field("d", pg::PG_DATEOID)
+  };
+  const std::vector<Row> rs{{"2024-02-29 00:00:00+00", "2024-02-29"}};
+
+  // The text decoders are opt in, and the styles unknown until reported.
+  pg::ServerParameters sp;
+  pg::PGFormat chrono;
+  chrono.emplaceChrono();
+  if (sp.isoDateStyle() || sp.postgresIntervalStyle()) {
+    cout << "Error: styles known before reported" << endl;
+    return;
+  }
+
+  sp.set("DateStyle", "ISO, MDY");
+  ResultSet iso(chrono), plain;
+  TypedResult<pg::Timestamp, std::optional<pg::Date>> typed;
+  iso.parameters(&sp);
+  plain.parameters(&sp);
+  typed.parameters(&sp);
+  feed(iso, fs, rs);
+  feed(plain, fs, rs);
+  feed(typed, fs, rs);
+
+  // An interval also needs IntervalStyle postgres.
+  const std::vector<pg::FieldSpec> ivs{field("i", pg::PG_INTERVALOID)};
+  const std::vector<Row> one_day{{"1 day"}};
+  ResultSet interval(chrono);
+  interval.parameters(&sp);
+  feed(interval, ivs, one_day);
+  sp.set("IntervalStyle", "postgres");
+  feed(interval, ivs, one_day);
+
+  sp.set("DateStyle", "SQL, DMY");
+  ResultSet sql(chrono);
+  sql.parameters(&sp);
+  feed(sql, fs, rs);
+
+  if (iso[0].get<pg::Timestamp>(0, "at") != leap
+      || iso[0].get<pg::Date>(0, 1) != year(2024) / February / 29
+      || plain[0].get<std::string>(0, "d") != "2024-02-29"
+      || interval[0].get<std::string>(0, 0) != "1 day"
+      || interval[1].get<pg::Interval>(0, 0) != pg::Interval{0, 1, 0}
+      || sql[0].get<std::string>(0, "d") != "2024-02-29"
+      || std::get<0>(typed[0][0]) != leap)
+  {
+    cout << "Error: decoder" << endl;
+    return;
+  }
+
+  cout << "Ok" << endl;
+}
+
+
+//============================================================================
+// TypedResult and StructResult reject date and time columns at the
+// RowDescription unless the server reports DateStyle ISO and, for interval,
+// IntervalStyle postgres, instead of throwing on every row.
+//
+void date_style(int, char **)
+{
+  const std::vector<pg::FieldSpec> fs
+  {
+    field("at", pg::PG_TIMESTAMPTZOID), field("length", pg::PG_INTERVALOID)
+  };
+  const std::vector<Row> sql{{"02/29/2024 00:00:00 UTC", "1 day"}};
+  const std::vector<Row> iso{{"2024-02-29 00:00:00+00", "1 day"}};
+  const std::vector<Row> standard{{"2024-02-29 00:00:00+00", "1 0:00:00"}};
+
+  pg::ServerParameters sp;
+  TypedResult<pg::Timestamp, std::optional<pg::Interval>> typed;
+  StructResult<Event> mapped;
+  typed.parameters(&sp);
+  mapped.parameters(&sp);
+
+  // Unknown, then SQL DateStyle, then ISO with IntervalStyle sql_standard,
+  // and last ISO with postgres.
+  feed(typed, fs, sql);
+  feed(mapped, fs, sql);
+  sp.set("DateStyle", "SQL, MDY");
+  feed(typed, fs, sql);
+  feed(mapped, fs, sql);
+  sp.set("DateStyle", "ISO, MDY");
+  sp.set("IntervalStyle", "sql_standard");
+  feed(typed, fs, standard);
+  feed(mapped, fs, standard);
+  sp.set("IntervalStyle", "postgres");
+  feed(typed, fs, iso);
+  feed(mapped, fs, iso);
+
+  for (std::size_t i = 0; i < 3; ++i)
+  {
+    if (typed[i] || typed[i].error().at(CODE) != "42804" || !typed[i].empty()
+        || mapped[i] || mapped[i].error().at(CODE) != "42804")
+    {
+      cout << "Error: style " << i << " accepted" << endl;
+      return;
+    }
+  }
+
+  using namespace std::chrono;
+  auto leap = sys_days(year(2024) / February / 29);
+  if (!typed[3] || std::get<0>(typed[3][0]) != leap
+      || std::get<1>(typed[3][0]) != pg::Interval{0, 1, 0}
+      || !mapped[3] || mapped[3][0].at != leap
+      || mapped[3][0].length != pg::Interval{0, 1, 0})
+  {
+    cout << "Error: ISO rejected" << endl;
+    return;
+  }
+
+  cout << "Ok" << endl;
+}
+
+
+//============================================================================
+int main(int argc, char *argv[])
+{
+  if (argc < 2) {
+    cerr << "Error: Requires at least one test name." << endl;
+    return 1;
+  }
+
+  if (argv[1] == 0) {
+    cerr << "Error: Requires a valid test name." << endl;
+    return 1;
+  }
+
+//----------------------------------------------------------------------------
+  utest::FunctionRunner tests;
+  tests.ADDFUNC(record_set);
+  tests.ADDFUNC(column_handle);
+  tests.ADDFUNC(reset);
+  tests.ADDFUNC(memory_resource);
+  tests.ADDFUNC(column_set);
+  tests.ADDFUNC(dictionary);
+  tests.ADDFUNC(parallel);
+  tests.ADDFUNC(raw_set);
+  tests.ADDFUNC(typed_set);
+  tests.ADDFUNC(struct_set);
+  tests.ADDFUNC(text_numbers);
+  tests.ADDFUNC(date_time);
+  tests.ADDFUNC(date_style);
+
+//----------------------------------------------------------------------------
+  if (!tests.run(argv[1], argc, argv)) {
+    cerr << "Error: Unknown test (" << argv[1] << ")" << endl;
+    return 1;
+  }
+
+  return 0;
+}